@@ -4,6 +4,9 @@ include $(CLEAR_VARS)
 LOCAL_MODULE    := libvlcjni
 
 LOCAL_SRC_FILES := libvlcjni.c libvlcjni-util.c libvlcjni-track.c libvlcjni-medialist.c aout.c vout.c libvlcjni-equalizer.c native_crash_handler.c
+LOCAL_SRC_FILES += libvlcjni-events.c
+LOCAL_SRC_FILES += aout_convert.c
+LOCAL_SRC_FILES += libvlcjni-mpool.c libvlcjni-probe.c libvlcjni-walker.c libvlcjni-watcher.c
 LOCAL_SRC_FILES += thumbnailer.c pthread-condattr.c pthread-rwlocks.c pthread-once.c eventfd.c sem.c
 LOCAL_SRC_FILES += pipe2.c
 LOCAL_SRC_FILES += wchar/wcpcpy.c
@@ -53,6 +56,9 @@ ifeq ($(ARCH), armeabi)
 endif
 ifeq ($(ARCH), armeabi-v7a)
 	LOCAL_CFLAGS += -DHAVE_ARMEABI_V7A
+	# NEON is optional on ARMv7, the kernels check for it at runtime
+	LOCAL_SRC_FILES += aout_convert_neon.c.neon
+	LOCAL_STATIC_LIBRARIES += cpufeatures
 endif
 ifneq (,$(wildcard $(LOCAL_PATH)/../$(VLC_SRC_DIR)/modules/codec/omxil/iomx_hwbuffer.c))
 	LOCAL_CFLAGS += -DHAVE_IOMX_DR
@@ -145,3 +151,5 @@ endef
 # call build_iomx for each libiomx-* in LIBVLC_LIBS
 $(foreach IOMX_MODULE,$(filter libiomx-%,$(LIBVLC_LIBS)), \
 	$(eval $(call build_iomx,$(IOMX_MODULE),$(subst libiomx-,,$(IOMX_MODULE)))))
+
+$(call import-module,android/cpufeatures)
@@ -22,28 +22,539 @@
 #include <assert.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <jni.h>
 
 #include <vlc/vlc.h>
 
 #include "aout.h"
+#include "aout_convert.h"
+#include "utils.h"
 
 #define LOG_TAG "VLC/JNI/aout"
 #include "log.h"
 
+#define THREAD_NAME "jni_aout"
+#define WRITER_THREAD_NAME "jni_aout_writer"
+
 // An audio frame will contain FRAME_SIZE samples
 #define FRAME_SIZE (4096*2)
 
+// Number of direct buffers used in turn by the writer thread
+#define DIRECT_BUFFER_COUNT 4
+
+// Target latency of the PCM ring, in ms, when LibVLC does not set one
+#define DEFAULT_LATENCY 200
+#define MIN_LATENCY 20
+#define MAX_LATENCY 2000
+
+// Number of enqueue dates kept to measure the latency (power of 2)
+#define MARK_COUNT 64
+
+/*
+ * aout_play does not call Java: it copies the samples into a native PCM
+ * ring and returns, so that a GC pause or a slow AudioTrack does not stall
+ * the decoder. A dedicated writer thread drains the ring into the Java
+ * AudioTrack.
+ *
+ * The ring is single producer (the libvlc audio thread) and single
+ * consumer (the writer thread), and is lock-free: each side only moves its
+ * own position. The lock and condition are only used to sleep when the
+ * ring is empty (writer) or above the target latency (aout_play), and to
+ * hand flush and pause requests to the writer thread.
+ */
+
+typedef struct
+{
+    uint32_t end;       /// Ring position right after the block
+    int64_t date;       /// Enqueue date of the block, in µs
+} aout_mark_t;
+
 typedef struct
 {
     jobject j_libVlc;   /// Pointer to the LibVLC Java object
-    jmethodID play;     /// Java method to play audio buffers
     jbyteArray buffer;  /// Raw audio data to be played
+
+    /* Direct buffers mode: the audio data is copied in native memory
+     * wrapped once by direct ByteBuffers that Java hands to the AudioTrack,
+     * without any intermediate Java heap array. */
+    bool direct;
+    size_t buffer_size;
+    void *direct_data[DIRECT_BUFFER_COUNT];
+    jobject direct_buffers[DIRECT_BUFFER_COUNT];
+    unsigned direct_index;
+
+    /* Conversion from the float samples of libvlc to the AudioTrack format */
+    aout_convert_t conv;
+    unsigned in_frame_size;      /// in bytes
+    unsigned out_frame_size;     /// in bytes
+    uint8_t *convert_buffer;     /// used when the ring wraps
+    unsigned rate;
+
+    /* PCM ring */
+    uint8_t *ring;
+    uint32_t ring_size;          /// in bytes, power of 2
+    uint32_t target;             /// target fill level, in bytes
+    unsigned byte_rate;          /// in bytes per second
+    unsigned latency;            /// target latency, in ms
+    volatile uint32_t write_pos; /// written by aout_play only
+    volatile uint32_t read_pos;  /// written by the writer thread only
+
+    aout_mark_t marks[MARK_COUNT];
+    volatile uint32_t mark_write;
+    volatile uint32_t mark_read;
+
+    /* Writer thread */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    volatile bool writer_waiting;
+    volatile bool player_waiting;
+    volatile bool flush_request;
+    volatile bool pause_request;
+    volatile bool exit_request;
+    bool started;                /// the ring reached its prefill level
 } aout_sys_t;
 
-/** Unique Java VM instance, as defined in libvlcjni.c */
-extern JavaVM *myVm;
+/* Statistics of the audio outputs, see LibVLC.getAudioStats() */
+static struct
+{
+    volatile unsigned underruns;
+    volatile unsigned overruns;
+    volatile int64_t latency;       /// last measured latency, in µs
+    volatile int64_t avg_latency;   /// smoothed latency, in µs
+    volatile int64_t converted;     /// frames converted
+    volatile int64_t convert_time;  /// time spent converting, in ns
+    volatile unsigned reused;       /// outputs kept from the previous track
+} aout_stats;
+
+/*
+ * aout_close does not destroy the output: it parks it, with its writer
+ * thread still playing the end of the track. If the next aout_open asks
+ * for the same format, it takes it back and the AudioTrack keeps playing
+ * without being torn down between the two tracks.
+ */
+static struct
+{
+    pthread_mutex_t lock;
+    aout_sys_t *sys;
+} parked = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void aout_destroy(aout_sys_t *p_sys);
+
+static int64_t monotonic_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t monotonic_us (void)
+{
+    return monotonic_ns () / 1000;
+}
+
+/* pthread_cond_timedwait uses CLOCK_REALTIME */
+static void deadline_after (struct timespec *ts, unsigned ms)
+{
+    clock_gettime (CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void release_direct_buffers (JNIEnv *p_env, aout_sys_t *p_sys)
+{
+    for (unsigned i = 0; i < DIRECT_BUFFER_COUNT; ++i)
+    {
+        if (p_sys->direct_buffers[i] != NULL)
+            (*p_env)->DeleteGlobalRef (p_env, p_sys->direct_buffers[i]);
+        free (p_sys->direct_data[i]);
+        p_sys->direct_buffers[i] = NULL;
+        p_sys->direct_data[i] = NULL;
+    }
+}
+
+static int create_direct_buffers (JNIEnv *p_env, aout_sys_t *p_sys)
+{
+    for (unsigned i = 0; i < DIRECT_BUFFER_COUNT; ++i)
+    {
+        p_sys->direct_data[i] = malloc (p_sys->buffer_size);
+        if (p_sys->direct_data[i] == NULL)
+            goto error;
+
+        jobject buffer = (*p_env)->NewDirectByteBuffer (p_env, p_sys->direct_data[i],
+                                                        p_sys->buffer_size);
+        if (buffer == NULL)
+            goto error;
+        p_sys->direct_buffers[i] = (*p_env)->NewGlobalRef (p_env, buffer);
+        (*p_env)->DeleteLocalRef (p_env, buffer);
+        if (p_sys->direct_buffers[i] == NULL)
+            goto error;
+    }
+    return 0;
+
+error:
+    if ((*p_env)->ExceptionCheck (p_env))
+        (*p_env)->ExceptionClear (p_env);
+    release_direct_buffers (p_env, p_sys);
+    return -1;
+}
+
+static inline uint32_t ring_fill (aout_sys_t *p_sys)
+{
+    uint32_t fill = p_sys->write_pos - p_sys->read_pos;
+    /* Read the samples only after having read the positions */
+    __sync_synchronize ();
+    return fill;
+}
+
+/**
+ * Copy size bytes from the ring, starting at the read position
+ **/
+static void ring_read (aout_sys_t *p_sys, uint8_t *dst, uint32_t size)
+{
+    uint32_t offset = p_sys->read_pos & (p_sys->ring_size - 1);
+    uint32_t first = p_sys->ring_size - offset;
+    if (first > size)
+        first = size;
+    memcpy (dst, p_sys->ring + offset, first);
+    memcpy (dst + first, p_sys->ring, size - first);
+}
+
+/**
+ * Get a pointer to write size bytes at once in the ring, or NULL if the
+ * write position is too close to the end of the ring
+ **/
+static uint8_t *ring_write_ptr (aout_sys_t *p_sys, uint32_t size)
+{
+    uint32_t offset = p_sys->write_pos & (p_sys->ring_size - 1);
+    return p_sys->ring_size - offset >= size ? p_sys->ring + offset : NULL;
+}
+
+static void ring_write (aout_sys_t *p_sys, const uint8_t *src, uint32_t size)
+{
+    uint32_t offset = p_sys->write_pos & (p_sys->ring_size - 1);
+    uint32_t first = p_sys->ring_size - offset;
+    if (first > size)
+        first = size;
+    memcpy (p_sys->ring + offset, src, first);
+    memcpy (p_sys->ring, src + first, size - first);
+}
+
+static void wake_up (aout_sys_t *p_sys)
+{
+    pthread_mutex_lock (&p_sys->lock);
+    pthread_cond_broadcast (&p_sys->cond);
+    pthread_mutex_unlock (&p_sys->lock);
+}
+
+static void call_java_void (JNIEnv *p_env, aout_sys_t *p_sys, jmethodID method,
+                            const char *error)
+{
+    (*p_env)->CallVoidMethod (p_env, p_sys->j_libVlc, method);
+    if ((*p_env)->ExceptionCheck (p_env))
+    {
+        LOGE ("%s", error);
+#ifndef NDEBUG
+        (*p_env)->ExceptionDescribe (p_env);
+#endif
+        (*p_env)->ExceptionClear (p_env);
+    }
+}
+
+/**
+ * Hand size bytes from the read position to the Java audio output, and
+ * release them in the ring.
+ **/
+static void writer_play (JNIEnv *p_env, aout_sys_t *p_sys, uint32_t size)
+{
+    if (p_sys->direct)
+    {
+        unsigned i = p_sys->direct_index;
+        p_sys->direct_index = (i + 1) % DIRECT_BUFFER_COUNT;
+        ring_read (p_sys, p_sys->direct_data[i], size);
+
+        __sync_synchronize ();
+        p_sys->read_pos += size;
+        if (p_sys->player_waiting)
+            wake_up (p_sys);
+
+        (*p_env)->CallVoidMethod (p_env, p_sys->j_libVlc, fields.LibVLC.playAudioDirectID,
+                                  p_sys->direct_buffers[i], (jint) size);
+    }
+    else
+    {
+        uint32_t offset = p_sys->read_pos & (p_sys->ring_size - 1);
+        uint32_t first = p_sys->ring_size - offset;
+        if (first > size)
+            first = size;
+        (*p_env)->SetByteArrayRegion (p_env, p_sys->buffer, 0, first,
+                                      (jbyte*) p_sys->ring + offset);
+        if (size > first)
+            (*p_env)->SetByteArrayRegion (p_env, p_sys->buffer, first, size - first,
+                                          (jbyte*) p_sys->ring);
+
+        __sync_synchronize ();
+        p_sys->read_pos += size;
+        if (p_sys->player_waiting)
+            wake_up (p_sys);
+
+        if ((*p_env)->ExceptionCheck (p_env))
+        {
+            LOGE ("An exception occurred while calling SetByteArrayRegion");
+            (*p_env)->ExceptionDescribe (p_env);
+            (*p_env)->ExceptionClear (p_env);
+            return;
+        }
+        (*p_env)->CallVoidMethod (p_env, p_sys->j_libVlc, fields.LibVLC.playAudioID,
+                                  p_sys->buffer, (jint) size);
+    }
+    if ((*p_env)->ExceptionCheck (p_env))
+    {
+        LOGE ("Unable to play the audio buffer!");
+        (*p_env)->ExceptionClear (p_env);
+    }
+
+    /* The latency is the age of the most recent block that was fully
+     * handed to the AudioTrack. */
+    int64_t date = -1;
+    uint32_t mark_read = p_sys->mark_read;
+    uint32_t mark_write = p_sys->mark_write;
+    __sync_synchronize ();
+    while (mark_read != mark_write)
+    {
+        const aout_mark_t *mark = &p_sys->marks[mark_read & (MARK_COUNT - 1)];
+        if ((int32_t) (mark->end - p_sys->read_pos) > 0)
+            break;
+        date = mark->date;
+        mark_read++;
+    }
+    __sync_synchronize ();
+    p_sys->mark_read = mark_read;
+
+    if (date >= 0)
+    {
+        int64_t latency = monotonic_us () - date;
+        aout_stats.latency = latency;
+        aout_stats.avg_latency = aout_stats.avg_latency
+                               ? (7 * aout_stats.avg_latency + latency) / 8 : latency;
+    }
+}
+
+static void *writer_thread (void *data)
+{
+    aout_sys_t *p_sys = data;
+
+    JNIEnv *p_env = jni_get_env (WRITER_THREAD_NAME);
+    if (p_env == NULL)
+    {
+        LOGE ("Could not attach the audio writer thread to the JVM !");
+        return NULL;
+    }
+
+    /* Wait for half of the target latency before starting to play, so
+     * that the ring can absorb the decoding jitter. */
+    const uint32_t prefill = p_sys->target / 2;
+
+    while (!p_sys->exit_request)
+    {
+        if (p_sys->flush_request)
+        {
+            if (p_sys->pause_request)
+                call_java_void (p_env, p_sys, fields.LibVLC.pauseAoutID,
+                                "Unable to pause audio player!");
+
+            pthread_mutex_lock (&p_sys->lock);
+            p_sys->read_pos = p_sys->write_pos;
+            p_sys->mark_read = p_sys->mark_write;
+            p_sys->started = false;
+            p_sys->flush_request = false;
+            p_sys->pause_request = false;
+            pthread_cond_broadcast (&p_sys->cond);
+            pthread_mutex_unlock (&p_sys->lock);
+            continue;
+        }
+
+        uint32_t fill = ring_fill (p_sys);
+        if (fill == 0 || (!p_sys->started && fill < prefill))
+        {
+            if (fill == 0 && p_sys->started)
+            {
+                /* The decoder did not keep up: rebuffer */
+                aout_stats.underruns++;
+                p_sys->started = false;
+            }
+
+            pthread_mutex_lock (&p_sys->lock);
+            p_sys->writer_waiting = true;
+            __sync_synchronize ();
+            int ret = 0;
+            if (!p_sys->exit_request && !p_sys->flush_request
+             && ring_fill (p_sys) == fill)
+            {
+                struct timespec deadline;
+                deadline_after (&deadline, p_sys->latency);
+                ret = pthread_cond_timedwait (&p_sys->cond, &p_sys->lock, &deadline);
+            }
+            p_sys->writer_waiting = false;
+            pthread_mutex_unlock (&p_sys->lock);
+
+            /* The decoder stopped feeding us (end of stream?): play what
+             * we have instead of waiting for the prefill level. */
+            if (ret == ETIMEDOUT && ring_fill (p_sys) > 0)
+                p_sys->started = true;
+            continue;
+        }
+
+        p_sys->started = true;
+        writer_play (p_env, p_sys, fill < p_sys->buffer_size ? fill : p_sys->buffer_size);
+    }
+    return NULL;
+}
+
+/**
+ * Drop the samples queued in the ring, and pause the Java audio output if
+ * requested. Returns once the writer thread is done.
+ **/
+static void aout_flush_ring (aout_sys_t *p_sys, bool pause)
+{
+    pthread_mutex_lock (&p_sys->lock);
+    p_sys->pause_request = pause;
+    p_sys->flush_request = true;
+    pthread_cond_broadcast (&p_sys->cond);
+    while (p_sys->flush_request)
+        pthread_cond_wait (&p_sys->cond, &p_sys->lock);
+    pthread_mutex_unlock (&p_sys->lock);
+}
+
+static void release_buffers (JNIEnv *p_env, aout_sys_t *p_sys)
+{
+    if (p_sys->direct)
+        release_direct_buffers (p_env, p_sys);
+    else if (p_sys->buffer != NULL)
+        (*p_env)->DeleteGlobalRef (p_env, p_sys->buffer);
+    aout_convert_clean (&p_sys->conv);
+    free (p_sys->convert_buffer);
+    free (p_sys->ring);
+}
+
+/*
+ * Capabilities of the AudioTrack. They do not change during the life of
+ * the process, so they are probed once, by the first aout_open, instead
+ * of being discovered by trial and error on every track.
+ */
+static const unsigned probe_rates[] = {
+    8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+    bool probed;
+    unsigned native_rate;   /// output rate of the mixer, 0 if unknown
+    unsigned rates;         /// bit i set if probe_rates[i] is supported
+    unsigned formats[2];    /// bit n set if n channels are supported, s16 and float
+} caps = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int get_native_sample_rate (JNIEnv *p_env)
+{
+    jclass cls = (*p_env)->FindClass (p_env, "android/media/AudioTrack");
+    if (cls == NULL)
+    {
+        (*p_env)->ExceptionClear (p_env);
+        return 0;
+    }
+    jmethodID method = (*p_env)->GetStaticMethodID (p_env, cls, "getNativeOutputSampleRate", "(I)I");
+    int sample_rate = (*p_env)->CallStaticIntMethod (p_env, cls, method, 3); // AudioManager.STREAM_MUSIC
+    if ((*p_env)->ExceptionCheck (p_env))
+    {
+        (*p_env)->ExceptionClear (p_env);
+        sample_rate = 0;
+    }
+    (*p_env)->DeleteLocalRef (p_env, cls);
+    return sample_rate;
+}
+
+static bool java_format_supported (JNIEnv *p_env, jobject j_libVlc,
+                                   unsigned rate, unsigned channels, bool is_float)
+{
+    jboolean supported = (*p_env)->CallBooleanMethod (p_env, j_libVlc,
+                                                      fields.LibVLC.isAoutFormatSupportedID,
+                                                      (jint) rate, (jint) channels,
+                                                      (jboolean) is_float);
+    if ((*p_env)->ExceptionCheck (p_env))
+    {
+        (*p_env)->ExceptionClear (p_env);
+        return false;
+    }
+    return supported;
+}
+
+static void probe_caps (JNIEnv *p_env, jobject j_libVlc)
+{
+    pthread_mutex_lock (&caps.lock);
+    if (!caps.probed)
+    {
+        int native_rate = get_native_sample_rate (p_env);
+        caps.native_rate = native_rate > 0 ? native_rate : 0;
+
+        for (unsigned i = 0; i < sizeof (probe_rates) / sizeof (*probe_rates); ++i)
+            if (java_format_supported (p_env, j_libVlc, probe_rates[i], 2, false))
+                caps.rates |= 1 << i;
+
+        unsigned rate = caps.native_rate ? caps.native_rate : 44100;
+        for (unsigned channels = 1; channels <= AOUT_CONVERT_MAX_CHANNELS; ++channels)
+        {
+            if (!aout_convert_has_layout (channels))
+                continue;
+            for (unsigned is_float = 0; is_float < 2; ++is_float)
+                if (java_format_supported (p_env, j_libVlc, rate, channels, is_float))
+                    caps.formats[is_float] |= 1 << channels;
+        }
+
+        caps.probed = true;
+        LOGI ("AudioTrack capabilities: native rate %uHz, rates 0x%x, "
+              "channels 0x%x (s16) 0x%x (float)", caps.native_rate, caps.rates,
+              caps.formats[0], caps.formats[1]);
+    }
+    pthread_mutex_unlock (&caps.lock);
+}
+
+static bool is_format_supported (aout_sys_t *p_sys, unsigned channels, bool is_float)
+{
+    /* The AudioTrack only takes float samples from direct buffers */
+    if (is_float && !p_sys->direct)
+        return false;
+    return caps.formats[is_float] & (1 << channels);
+}
+
+/**
+ * Pick the output rate: the rate of the Android mixer if known, so that
+ * libvlc resamples once and AudioFlinger does not resample again.
+ **/
+static unsigned pick_rate (unsigned rate)
+{
+    if (caps.native_rate > 0)
+        return caps.native_rate;
+    for (unsigned i = 0; i < sizeof (probe_rates) / sizeof (*probe_rates); ++i)
+        if (probe_rates[i] == rate && (caps.rates & (1 << i)))
+            return rate;
+    return 44100;
+}
 
 int aout_open(void **opaque, char *format, unsigned *rate, unsigned *nb_channels)
 {
@@ -59,55 +570,87 @@ int aout_open(void **opaque, char *format, unsigned *rate, unsigned *nb_channels
     LOGI ("Parameters: %u channels, FOURCC '%4.4s',  sample rate: %uHz",
           *nb_channels, format, *rate);
 
-    JNIEnv *p_env;
-    if ((*myVm)->AttachCurrentThread (myVm, &p_env, NULL) != 0)
+    JNIEnv *p_env = jni_get_env (THREAD_NAME);
+    if (p_env == NULL)
     {
-        LOGE("Could not attach the display thread to the JVM !");
+        LOGE("Could not attach the audio thread to the JVM !");
         goto eattach;
     }
 
-    // Call the init function.
-    jclass cls = (*p_env)->GetObjectClass (p_env, p_sys->j_libVlc);
-    jmethodID methodIdInitAout = (*p_env)->GetMethodID (p_env, cls,
-                                                        "initAout", "(III)V");
-    if (!methodIdInitAout)
+    p_sys->direct = (*p_env)->CallBooleanMethod (p_env, p_sys->j_libVlc,
+                                                 fields.LibVLC.useDirectAudioBuffersID);
+
+    /* Always take float samples from libvlc, as its decoders and mixer
+     * work in float, and keep its channel layout. The AudioTrack gets the
+     * same format if it supports it. Otherwise we convert to 16 bits and
+     * downmix to stereo ourselves. */
+    strcpy (format, "FL32");
+    unsigned in_channels = *nb_channels;
+    if (in_channels == 0 || in_channels > AOUT_CONVERT_MAX_CHANNELS)
+        in_channels = 2;
+    *nb_channels = in_channels;
+
+    probe_caps (p_env, p_sys->j_libVlc);
+
+    unsigned out_channels = aout_convert_has_layout (in_channels) ? in_channels : 2;
+    bool out_float = false;
+    if (is_format_supported (p_sys, out_channels, true))
+        out_float = true;
+    else if (!is_format_supported (p_sys, out_channels, false))
     {
-        LOGE ("Method initAout() could not be found!");
-        goto error;
+        out_channels = 2;
+        out_float = is_format_supported (p_sys, out_channels, true);
     }
+    LOGI ("AudioTrack format: %u channels, %s", out_channels, out_float ? "float" : "s16");
 
-    LOGV ("Number of channels forced to 2, number of samples to %d", FRAME_SIZE);
-    *nb_channels = 2;
-
-    int aout_rate = *rate;
-    while (1) {
-        (*p_env)->CallVoidMethod (p_env, p_sys->j_libVlc, methodIdInitAout,
-                                  aout_rate, *nb_channels, FRAME_SIZE);
-        if ((*p_env)->ExceptionCheck (p_env) == 0) {
-            *rate = aout_rate;
-            break;
+    if (aout_convert_init (&p_sys->conv, in_channels, out_channels, out_float, FRAME_SIZE))
+    {
+        LOGE ("Unsupported audio conversion from %u channels", in_channels);
+        goto error;
+    }
+    LOGV ("Audio conversion: %s", p_sys->conv.name);
+
+    /* Take back the output of the previous track if it matches */
+    pthread_mutex_lock (&parked.lock);
+    aout_sys_t *p_parked = parked.sys;
+    parked.sys = NULL;
+    pthread_mutex_unlock (&parked.lock);
+    if (p_parked != NULL)
+    {
+        if (p_parked->conv.in_channels == in_channels
+         && p_parked->conv.out_channels == out_channels
+         && p_parked->conv.out_float == out_float
+         && p_parked->rate == pick_rate (*rate)
+         && (*p_env)->IsSameObject (p_env, p_parked->j_libVlc, p_sys->j_libVlc))
+        {
+            LOGI ("Reusing the audio output of the previous track");
+            aout_convert_clean (&p_sys->conv);
+            free (p_sys);
+            *opaque = p_parked;
+            *rate = p_parked->rate;
+            aout_stats.reused++;
+            return 0;
         }
+        aout_destroy (p_parked);
+    }
 
-        if (aout_rate <= 0) {
-            LOGE ("initAout failed, invalid sample rate %dHz", aout_rate);
-        } else if (aout_rate != 44100) {
-            if (aout_rate < 4000) {
-                do {
-                    aout_rate *= 2;
-                } while (aout_rate < 4000);
-            } else if (aout_rate > 48000) {
-                do {
-                    aout_rate /= 2;
-                } while (aout_rate > 48000);
-            } else {
-                aout_rate = 44100;
-            }
-
-            LOGE ("initAout failed, try next sample rate %dHz", aout_rate);
-            (*p_env)->ExceptionClear (p_env);
-            continue;
-        }
+    p_sys->in_frame_size = in_channels * sizeof (float);
+    p_sys->out_frame_size = out_channels * (out_float ? sizeof (float) : sizeof (int16_t));
 
+    /* libvlc resamples to the rate we return */
+    unsigned aout_rate = pick_rate (*rate);
+    (*p_env)->CallVoidMethod (p_env, p_sys->j_libVlc, fields.LibVLC.initAoutID,
+                              aout_rate, out_channels, FRAME_SIZE, (jboolean) out_float);
+    if ((*p_env)->ExceptionCheck (p_env) && aout_rate != 44100)
+    {
+        LOGE ("initAout failed at %uHz, falling back to 44100Hz", aout_rate);
+        (*p_env)->ExceptionClear (p_env);
+        aout_rate = 44100;
+        (*p_env)->CallVoidMethod (p_env, p_sys->j_libVlc, fields.LibVLC.initAoutID,
+                                  aout_rate, out_channels, FRAME_SIZE, (jboolean) out_float);
+    }
+    if ((*p_env)->ExceptionCheck (p_env))
+    {
         LOGE ("Unable to create audio player!");
 #ifndef NDEBUG
         (*p_env)->ExceptionDescribe (p_env);
@@ -115,37 +658,84 @@ int aout_open(void **opaque, char *format, unsigned *rate, unsigned *nb_channels
         (*p_env)->ExceptionClear (p_env);
         goto error;
     }
+    if (aout_rate != *rate)
+        LOGV ("Resampling from %uHz to %uHz", *rate, aout_rate);
+    *rate = aout_rate;
+    p_sys->rate = aout_rate;
+
+    p_sys->buffer_size = FRAME_SIZE * p_sys->out_frame_size;
 
-    /* Create a new byte array to store the audio data. */
-    jbyteArray buffer = (*p_env)->NewByteArray (p_env,
-                                                   *nb_channels *
-                                                   FRAME_SIZE *
-                                                   sizeof (uint16_t) /* =2 */);
-    if (buffer == NULL)
+    if (p_sys->direct)
     {
-        LOGE ("Could not allocate the Java byte array to store the audio data!");
-        goto error;
+        if (create_direct_buffers (p_env, p_sys) == 0)
+            LOGI ("Using direct audio buffers");
+        else
+        {
+            LOGE ("Could not create the direct audio buffers, using a byte array");
+            p_sys->direct = false;
+        }
     }
 
-    /* Use a global reference to not reallocate memory each time we run
-       the play function. */
-    p_sys->buffer = (*p_env)->NewGlobalRef (p_env, buffer);
-    /* The local reference is no longer useful. */
-    (*p_env)->DeleteLocalRef (p_env, buffer);
-    if (p_sys->buffer == NULL)
+    if (!p_sys->direct)
     {
-        LOGE ("Could not create the global reference!");
+        /* Create a new byte array to store the audio data. */
+        jbyteArray buffer = (*p_env)->NewByteArray (p_env, p_sys->buffer_size);
+        if (buffer == NULL)
+        {
+            LOGE ("Could not allocate the Java byte array to store the audio data!");
+            goto error;
+        }
+
+        /* Use a global reference to not reallocate memory each time we run
+           the play function. */
+        p_sys->buffer = (*p_env)->NewGlobalRef (p_env, buffer);
+        /* The local reference is no longer useful. */
+        (*p_env)->DeleteLocalRef (p_env, buffer);
+        if (p_sys->buffer == NULL)
+        {
+            LOGE ("Could not create the global reference!");
+            goto error;
+        }
+    }
+
+    /* The ring holds the target latency plus one full frame, so that
+     * aout_play can always queue a frame once below the target. */
+    int latency = (*p_env)->CallIntMethod (p_env, p_sys->j_libVlc,
+                                           fields.LibVLC.getAudioLatencyID);
+    if (latency <= 0)
+        latency = DEFAULT_LATENCY;
+    else if (latency < MIN_LATENCY)
+        latency = MIN_LATENCY;
+    else if (latency > MAX_LATENCY)
+        latency = MAX_LATENCY;
+    p_sys->latency = latency;
+    p_sys->byte_rate = *rate * p_sys->out_frame_size;
+    p_sys->target = (uint64_t) p_sys->byte_rate * latency / 1000;
+    if (p_sys->target < p_sys->buffer_size)
+        p_sys->target = p_sys->buffer_size;
+    p_sys->ring_size = 1;
+    while (p_sys->ring_size < p_sys->target + p_sys->buffer_size)
+        p_sys->ring_size <<= 1;
+    p_sys->ring = malloc (p_sys->ring_size);
+    p_sys->convert_buffer = malloc (p_sys->buffer_size);
+    if (p_sys->ring == NULL || p_sys->convert_buffer == NULL)
+        goto error;
+    LOGI ("Audio latency: %d ms, ring of %u bytes", latency, p_sys->ring_size);
+
+    pthread_mutex_init (&p_sys->lock, NULL);
+    pthread_cond_init (&p_sys->cond, NULL);
+    if (pthread_create (&p_sys->thread, NULL, writer_thread, p_sys) != 0)
+    {
+        LOGE ("Could not create the audio writer thread!");
+        pthread_cond_destroy (&p_sys->cond);
+        pthread_mutex_destroy (&p_sys->lock);
         goto error;
     }
 
-    // Get the play methodId
-    p_sys->play = (*p_env)->GetMethodID (p_env, cls, "playAudio", "([BI)V");
-    assert (p_sys->play != NULL);
-    (*myVm)->DetachCurrentThread (myVm);
     return 0;
 
 error:
-    (*myVm)->DetachCurrentThread (myVm);
+    release_buffers (p_env, p_sys);
 eattach:
     *opaque = NULL;
     free (p_sys);
@@ -154,39 +744,74 @@ enomem:
 }
 
 /**
- * Play an audio frame
+ * Queue an audio frame
  **/
 void aout_play(void *opaque, const void *samples, unsigned count, int64_t pts)
 {
     aout_sys_t *p_sys = opaque;
-    JNIEnv *p_env;
 
-    /* How ugly: we constantly attach/detach this thread to/from the JVM
-     * because it will be killed before aout_close is called.
-     * aout_close will actually be called in an different thread!
-     */
-    (*myVm)->AttachCurrentThread (myVm, &p_env, NULL);
+    if (count > FRAME_SIZE)
+    {
+        LOGE ("Audio buffer too large: %u > %d samples", count, FRAME_SIZE);
+        count = FRAME_SIZE;
+    }
+    uint32_t size = count * p_sys->out_frame_size;
 
-    (*p_env)->SetByteArrayRegion (p_env, p_sys->buffer, 0,
-                                  2 /*nb_channels*/ * count * sizeof (uint16_t),
-                                  (jbyte*) samples);
-    if ((*p_env)->ExceptionCheck (p_env))
+    /* Wait for the writer thread to bring the ring below the target. If
+     * the sink is stuck for too long, drop the frame instead of stalling
+     * the decoder forever. */
+    if (ring_fill (p_sys) + size > p_sys->target)
     {
-        // This can happen if for some reason the size of the input buffer
-        // is larger than the size of the output buffer
-        LOGE ("An exception occurred while calling SetByteArrayRegion");
-        (*p_env)->ExceptionDescribe (p_env);
-        (*p_env)->ExceptionClear (p_env);
-        return;
+        struct timespec deadline;
+        deadline_after (&deadline, 2 * p_sys->latency + 100);
+
+        pthread_mutex_lock (&p_sys->lock);
+        p_sys->player_waiting = true;
+        __sync_synchronize ();
+        int ret = 0;
+        while (ret == 0 && ring_fill (p_sys) + size > p_sys->target)
+            ret = pthread_cond_timedwait (&p_sys->cond, &p_sys->lock, &deadline);
+        p_sys->player_waiting = false;
+        pthread_mutex_unlock (&p_sys->lock);
+
+        if (ret != 0)
+        {
+            aout_stats.overruns++;
+            LOGW ("Audio sink stalled, dropping %u bytes", size);
+            return;
+        }
+    }
+
+    if (aout_convert_is_identity (&p_sys->conv))
+        ring_write (p_sys, samples, size);
+    else
+    {
+        /* Convert straight into the ring unless it wraps */
+        int64_t start = monotonic_ns ();
+        uint8_t *dst = ring_write_ptr (p_sys, size);
+        aout_convert (&p_sys->conv, dst ? dst : p_sys->convert_buffer, samples, count);
+        if (dst == NULL)
+            ring_write (p_sys, p_sys->convert_buffer, size);
+        aout_stats.convert_time += monotonic_ns () - start;
+        aout_stats.converted += count;
     }
+    /* Publish the samples before moving the write position */
+    __sync_synchronize ();
+    p_sys->write_pos += size;
 
-    (*p_env)->CallVoidMethod (p_env, p_sys->j_libVlc, p_sys->play,
-                              p_sys->buffer,
-                              2 /*nb_channels*/ * count * sizeof (uint16_t),
-                              FRAME_SIZE);
-    // FIXME: check for errors
+    uint32_t mark_write = p_sys->mark_write;
+    if (mark_write - p_sys->mark_read < MARK_COUNT)
+    {
+        aout_mark_t *mark = &p_sys->marks[mark_write & (MARK_COUNT - 1)];
+        mark->end = p_sys->write_pos;
+        mark->date = monotonic_us ();
+        __sync_synchronize ();
+        p_sys->mark_write = mark_write + 1;
+    }
 
-    (*myVm)->DetachCurrentThread (myVm);
+    __sync_synchronize ();
+    if (p_sys->writer_waiting)
+        wake_up (p_sys);
 }
 
 void aout_pause(void *opaque, int64_t pts)
@@ -195,25 +820,15 @@ void aout_pause(void *opaque, int64_t pts)
     aout_sys_t *p_sys = opaque;
     assert(p_sys);
 
-    JNIEnv *p_env;
-    (*myVm)->AttachCurrentThread (myVm, &p_env, NULL);
+    aout_flush_ring (p_sys, true);
+}
 
-    // Call the pause function.
-    jclass cls = (*p_env)->GetObjectClass (p_env, p_sys->j_libVlc);
-    jmethodID methodIdPauseAout = (*p_env)->GetMethodID (p_env, cls, "pauseAout", "()V");
-    if (!methodIdPauseAout)
-        LOGE ("Method pauseAout() could not be found!");
-    (*p_env)->CallVoidMethod (p_env, p_sys->j_libVlc, methodIdPauseAout);
-    if ((*p_env)->ExceptionCheck (p_env))
-    {
-        LOGE ("Unable to pause audio player!");
-#ifndef NDEBUG
-        (*p_env)->ExceptionDescribe (p_env);
-#endif
-        (*p_env)->ExceptionClear (p_env);
-    }
+void aout_flush(void *opaque, int64_t pts)
+{
+    aout_sys_t *p_sys = opaque;
+    assert(p_sys);
 
-    (*myVm)->DetachCurrentThread (myVm);
+    aout_flush_ring (p_sys, false);
 }
 
 void aout_close(void *opaque)
@@ -221,38 +836,81 @@ void aout_close(void *opaque)
     LOGI ("Closing audio output");
     aout_sys_t *p_sys = opaque;
     assert(p_sys);
-    assert(p_sys->buffer);
 
-    JNIEnv *p_env;
-    (*myVm)->AttachCurrentThread (myVm, &p_env, NULL);
+    pthread_mutex_lock (&parked.lock);
+    aout_sys_t *p_old = parked.sys;
+    parked.sys = p_sys;
+    pthread_mutex_unlock (&parked.lock);
 
-    // Call the close function.
-    jclass cls = (*p_env)->GetObjectClass (p_env, p_sys->j_libVlc);
-    jmethodID methodIdCloseAout = (*p_env)->GetMethodID (p_env, cls, "closeAout", "()V");
-    if (!methodIdCloseAout)
-        LOGE ("Method closeAout() could not be found!");
-    (*p_env)->CallVoidMethod (p_env, p_sys->j_libVlc, methodIdCloseAout);
-    if ((*p_env)->ExceptionCheck (p_env))
+    if (p_old != NULL)
+        aout_destroy (p_old);
+}
+
+void aout_release_parked(void)
+{
+    pthread_mutex_lock (&parked.lock);
+    aout_sys_t *p_sys = parked.sys;
+    parked.sys = NULL;
+    pthread_mutex_unlock (&parked.lock);
+
+    if (p_sys != NULL)
+        aout_destroy (p_sys);
+}
+
+static void aout_destroy(aout_sys_t *p_sys)
+{
+    pthread_mutex_lock (&p_sys->lock);
+    p_sys->exit_request = true;
+    pthread_cond_broadcast (&p_sys->cond);
+    pthread_mutex_unlock (&p_sys->lock);
+    pthread_join (p_sys->thread, NULL);
+    pthread_cond_destroy (&p_sys->cond);
+    pthread_mutex_destroy (&p_sys->lock);
+
+    JNIEnv *p_env = jni_get_env (THREAD_NAME);
+    if (p_env == NULL)
     {
-        LOGE ("Unable to close audio player!");
-#ifndef NDEBUG
-        (*p_env)->ExceptionDescribe (p_env);
-#endif
-        (*p_env)->ExceptionClear (p_env);
+        aout_convert_clean (&p_sys->conv);
+        free (p_sys->convert_buffer);
+        free (p_sys->ring);
+        free (p_sys);
+        return;
     }
 
-    (*p_env)->DeleteGlobalRef (p_env, p_sys->buffer);
-    (*myVm)->DetachCurrentThread (myVm);
+    // Call the close function.
+    call_java_void (p_env, p_sys, fields.LibVLC.closeAoutID,
+                    "Unable to close audio player!");
+
+    release_buffers (p_env, p_sys);
     free (p_sys);
 }
 
+void Java_org_videolan_libvlc_LibVLC_nativeGetAudioStats(JNIEnv *env, jobject thiz,
+                                                         jlongArray stats)
+{
+    jlong values[7] = {
+        aout_stats.underruns,
+        aout_stats.overruns,
+        aout_stats.latency,
+        aout_stats.avg_latency,
+        aout_stats.converted,
+        aout_stats.convert_time,
+        aout_stats.reused,
+    };
+    (*env)->SetLongArrayRegion(env, stats, 0, 7, values);
+}
+
 int aout_get_native_sample_rate(void)
 {
-    JNIEnv *p_env;
-    (*myVm)->AttachCurrentThread (myVm, &p_env, NULL);
-    jclass cls = (*p_env)->FindClass (p_env, "android/media/AudioTrack");
-    jmethodID method = (*p_env)->GetStaticMethodID (p_env, cls, "getNativeOutputSampleRate", "(I)I");
-    int sample_rate = (*p_env)->CallStaticIntMethod (p_env, cls, method, 3); // AudioManager.STREAM_MUSIC
-    (*myVm)->DetachCurrentThread (myVm);
-    return sample_rate;
+    pthread_mutex_lock (&caps.lock);
+    bool probed = caps.probed;
+    unsigned native_rate = caps.native_rate;
+    pthread_mutex_unlock (&caps.lock);
+    if (probed)
+        return native_rate;
+
+    JNIEnv *p_env = jni_get_env (THREAD_NAME);
+    if (p_env == NULL)
+        return 0;
+    return get_native_sample_rate (p_env);
 }
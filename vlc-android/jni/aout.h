@@ -30,6 +30,8 @@
 int aout_open(void **opaque, char *format, unsigned *rate, unsigned *nb_channels);
 void aout_play(void *opaque, const void *samples, unsigned count, int64_t pts);
 void aout_pause(void *opaque, int64_t pts);
+void aout_flush(void *opaque, int64_t pts);
 void aout_close(void *opaque);
+void aout_release_parked(void);
 
 #endif // LIBVLCJNI_AOUT_H
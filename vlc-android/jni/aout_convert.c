@@ -0,0 +1,274 @@
+/*****************************************************************************
+ * aout_convert.c
+ *****************************************************************************
+ * Copyright © 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+#ifdef HAVE_ARMEABI_V7A
+# include <cpu-features.h>
+#endif
+
+#include "aout_convert.h"
+
+#define LOG_TAG "VLC/JNI/aout"
+#include "log.h"
+
+/* Channel positions */
+enum { L, R, ML, MR, RL, RR, RC, C, LFE };
+
+/* Order of the channels given by libvlc (amem), per number of channels */
+static const unsigned char vlc_layouts[AOUT_CONVERT_MAX_CHANNELS + 1][AOUT_CONVERT_MAX_CHANNELS] = {
+    [1] = { C },
+    [2] = { L, R },
+    [3] = { L, R, C },
+    [4] = { L, R, RL, RR },
+    [5] = { L, R, RL, RR, C },
+    [6] = { L, R, RL, RR, C, LFE },
+    [7] = { L, R, ML, MR, RL, RR, C },
+    [8] = { L, R, ML, MR, RL, RR, C, LFE },
+    [9] = { L, R, ML, MR, RL, RR, RC, C, LFE },
+};
+
+/* Order of the channels expected by the AudioTrack, 0 when the number of
+ * channels is not supported (mono, stereo, quad, 5.1 and 7.1) */
+static const unsigned char android_layouts[AOUT_CONVERT_MAX_CHANNELS + 1][AOUT_CONVERT_MAX_CHANNELS] = {
+    [1] = { C },
+    [2] = { L, R },
+    [4] = { L, R, RL, RR },
+    [6] = { L, R, C, LFE, RL, RR },
+    [8] = { L, R, C, LFE, RL, RR, ML, MR },
+};
+
+/* Stereo downmix coefficients, per channel position (LFE is dropped) */
+static const float downmix_left[]  = { [L] = 1.f, [ML] = .7071f, [RL] = .7071f,
+                                       [RC] = .5f, [C] = .7071f, [LFE] = 0.f };
+static const float downmix_right[] = { [R] = 1.f, [MR] = .7071f, [RR] = .7071f,
+                                       [RC] = .5f, [C] = .7071f, [LFE] = 0.f };
+
+static void (*f32_to_s16)(int16_t *dst, const float *src, unsigned count);
+
+static void f32_to_s16_c(int16_t *dst, const float *src, unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i)
+    {
+        float s = src[i] * 32768.f;
+        if (s >= 32767.f)
+            dst[i] = 32767;
+        else if (s <= -32768.f)
+            dst[i] = -32768;
+        else
+            dst[i] = (int16_t) s;
+    }
+}
+
+#ifdef __SSE2__
+static void f32_to_s16_sse2(int16_t *dst, const float *src, unsigned count)
+{
+    const __m128 scale = _mm_set1_ps(32768.f);
+    const __m128 max = _mm_set1_ps(32767.f);
+    const __m128 min = _mm_set1_ps(-32768.f);
+    unsigned i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+        /* cvttps returns INT_MIN on overflow, clamp before */
+        a = _mm_max_ps(_mm_min_ps(a, max), min);
+        b = _mm_max_ps(_mm_min_ps(b, max), min);
+        __m128i s = _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+        _mm_storeu_si128((__m128i *)(dst + i), s);
+    }
+    f32_to_s16_c(dst + i, src + i, count - i);
+}
+#endif
+
+static void select_kernels(void)
+{
+    if (f32_to_s16 != NULL)
+        return;
+#if defined(HAVE_ARMEABI_V7A)
+    if (aout_convert_has_neon())
+    {
+        f32_to_s16 = aout_convert_f32_s16_neon;
+        LOGI("Using NEON audio conversion");
+        return;
+    }
+#elif defined(__SSE2__)
+    f32_to_s16 = f32_to_s16_sse2;
+    LOGI("Using SSE2 audio conversion");
+    return;
+#endif
+    f32_to_s16 = f32_to_s16_c;
+}
+
+#ifdef HAVE_ARMEABI_V7A
+bool aout_convert_has_neon(void)
+{
+    return android_getCpuFamily() == ANDROID_CPU_FAMILY_ARM
+        && (android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON);
+}
+#endif
+
+bool aout_convert_has_layout(unsigned channels)
+{
+    /* Every layout but mono has R as second channel */
+    return channels == 1
+        || (channels > 1 && channels <= AOUT_CONVERT_MAX_CHANNELS
+            && android_layouts[channels][1] == R);
+}
+
+int aout_convert_init(aout_convert_t *conv, unsigned in_channels,
+                      unsigned out_channels, bool out_float, unsigned max_frames)
+{
+    memset(conv, 0, sizeof(*conv));
+    if (in_channels == 0 || in_channels > AOUT_CONVERT_MAX_CHANNELS)
+        return -1;
+
+    select_kernels();
+
+    conv->in_channels = in_channels;
+    conv->out_channels = out_channels;
+    conv->out_float = out_float;
+    conv->max_frames = max_frames;
+
+    const unsigned char *in_layout = vlc_layouts[in_channels];
+    if (out_channels == in_channels)
+    {
+        if (!aout_convert_has_layout(out_channels))
+            return -1;
+        const unsigned char *out_layout = android_layouts[out_channels];
+        for (unsigned i = 0; i < out_channels; ++i)
+        {
+            unsigned j = 0;
+            while (in_layout[j] != out_layout[i])
+                j++;
+            conv->map[i] = j;
+            if (j != i)
+                conv->reorder = true;
+        }
+    }
+    else if (out_channels == 2)
+    {
+        /* Normalize the coefficients so that the downmix never clips */
+        float sum = 0.f;
+        for (unsigned i = 0; i < in_channels; ++i)
+        {
+            conv->matrix[0][i] = downmix_left[in_layout[i]];
+            conv->matrix[1][i] = downmix_right[in_layout[i]];
+            sum += conv->matrix[0][i];
+        }
+        if (in_channels == 1)
+        {
+            /* Mono is played on both sides */
+            conv->matrix[0][0] = conv->matrix[1][0] = 1.f;
+            sum = 1.f;
+        }
+        if (sum > 1.f)
+            for (unsigned i = 0; i < in_channels; ++i)
+            {
+                conv->matrix[0][i] /= sum;
+                conv->matrix[1][i] /= sum;
+            }
+        conv->downmix = true;
+    }
+    else
+        return -1;
+
+    if ((conv->reorder || conv->downmix) && !out_float)
+    {
+        conv->scratch = malloc(max_frames * out_channels * sizeof(float));
+        if (conv->scratch == NULL)
+            return -1;
+    }
+
+    conv->name = conv->downmix ? (out_float ? "downmix" : "downmix+s16")
+               : conv->reorder ? (out_float ? "reorder" : "reorder+s16")
+               : (out_float ? "copy" : "s16");
+    return 0;
+}
+
+void aout_convert_clean(aout_convert_t *conv)
+{
+    free(conv->scratch);
+    conv->scratch = NULL;
+}
+
+bool aout_convert_is_identity(const aout_convert_t *conv)
+{
+    return conv->out_float && !conv->reorder && !conv->downmix;
+}
+
+static void reorder(float *dst, const float *src, unsigned frames,
+                    const unsigned char *map, unsigned channels)
+{
+    for (unsigned f = 0; f < frames; ++f)
+    {
+        for (unsigned i = 0; i < channels; ++i)
+            dst[i] = src[map[i]];
+        dst += channels;
+        src += channels;
+    }
+}
+
+static void downmix(float *dst, const float *src, unsigned frames,
+                    const float (*matrix)[AOUT_CONVERT_MAX_CHANNELS], unsigned channels)
+{
+    for (unsigned f = 0; f < frames; ++f)
+    {
+        float left = 0.f, right = 0.f;
+        for (unsigned i = 0; i < channels; ++i)
+        {
+            left += matrix[0][i] * src[i];
+            right += matrix[1][i] * src[i];
+        }
+        dst[0] = left;
+        dst[1] = right;
+        dst += 2;
+        src += channels;
+    }
+}
+
+void aout_convert(aout_convert_t *conv, void *dst, const float *src, unsigned frames)
+{
+    if (frames > conv->max_frames)
+        frames = conv->max_frames;
+
+    if (conv->reorder || conv->downmix)
+    {
+        float *out = conv->out_float ? dst : conv->scratch;
+        if (conv->downmix)
+            downmix(out, src, frames, conv->matrix, conv->in_channels);
+        else
+            reorder(out, src, frames, conv->map, conv->in_channels);
+        if (conv->out_float)
+            return;
+        src = out;
+    }
+    else if (conv->out_float)
+    {
+        memcpy(dst, src, frames * conv->in_channels * sizeof(float));
+        return;
+    }
+    f32_to_s16(dst, src, frames * conv->out_channels);
+}
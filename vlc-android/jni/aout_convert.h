@@ -0,0 +1,81 @@
+/*****************************************************************************
+ * aout_convert.h
+ *****************************************************************************
+ * Copyright © 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef LIBVLCJNI_AOUT_CONVERT_H
+#define LIBVLCJNI_AOUT_CONVERT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Conversion of the float samples produced by libvlc to the format of the
+ * AudioTrack: channel reordering, downmix to stereo and conversion to
+ * signed 16 bits.
+ */
+
+#define AOUT_CONVERT_MAX_CHANNELS 9
+
+typedef struct aout_convert
+{
+    unsigned in_channels;
+    unsigned out_channels;
+    bool out_float;
+
+    bool reorder;                               /// apply map
+    unsigned char map[AOUT_CONVERT_MAX_CHANNELS]; /// output channel -> input channel
+    bool downmix;                               /// apply matrix
+    float matrix[2][AOUT_CONVERT_MAX_CHANNELS];
+
+    float *scratch;                             /// float output of the first pass
+    unsigned max_frames;
+
+    const char *name;                           /// for the logs
+} aout_convert_t;
+
+/**
+ * Prepare the conversion of float samples with in_channels channels, in
+ * the libvlc order, to out_channels channels (1, 2, 4, 6 or 8, in the
+ * Android order) of float or 16 bits samples.
+ * Returns 0 on success, -1 if the conversion is not possible.
+ */
+int aout_convert_init(aout_convert_t *conv, unsigned in_channels,
+                      unsigned out_channels, bool out_float, unsigned max_frames);
+void aout_convert_clean(aout_convert_t *conv);
+
+/**
+ * Whether aout_convert would only copy the samples
+ */
+bool aout_convert_is_identity(const aout_convert_t *conv);
+
+/**
+ * Whether the Android channel order of this number of channels is known
+ */
+bool aout_convert_has_layout(unsigned channels);
+
+/**
+ * Convert frames frames (at most max_frames) from src to dst
+ */
+void aout_convert(aout_convert_t *conv, void *dst, const float *src, unsigned frames);
+
+/* SIMD kernels */
+void aout_convert_f32_s16_neon(int16_t *dst, const float *src, unsigned count);
+bool aout_convert_has_neon(void);
+
+#endif // LIBVLCJNI_AOUT_CONVERT_H
@@ -0,0 +1,48 @@
+/*****************************************************************************
+ * aout_convert_neon.c
+ *****************************************************************************
+ * Copyright © 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/* Built with -mfpu=neon for armeabi-v7a only (see Android.mk), and only
+ * called when the CPU has NEON. */
+#ifdef __ARM_NEON__
+
+#include <arm_neon.h>
+
+#include "aout_convert.h"
+
+void aout_convert_f32_s16_neon(int16_t *dst, const float *src, unsigned count)
+{
+    const float32x4_t scale = vdupq_n_f32(32768.f);
+    unsigned i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        /* vcvt and vqmovn both saturate */
+        int32x4_t a = vcvtq_s32_f32(vmulq_f32(vld1q_f32(src + i), scale));
+        int32x4_t b = vcvtq_s32_f32(vmulq_f32(vld1q_f32(src + i + 4), scale));
+        vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+    }
+    for (; i < count; ++i)
+    {
+        float s = src[i] * 32768.f;
+        dst[i] = s >= 32767.f ? 32767 : s <= -32768.f ? -32768 : (int16_t) s;
+    }
+}
+
+#endif
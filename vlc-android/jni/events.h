@@ -0,0 +1,40 @@
+/*****************************************************************************
+ * events.h
+ *****************************************************************************
+ * Copyright © 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef LIBVLCJNI_EVENTS_H
+#define LIBVLCJNI_EVENTS_H
+
+#include <stdbool.h>
+
+/**
+ * Queue a libvlc event for the EventHandler dispatch thread.
+ * Returns false if the event queue is not running or if the event can't be
+ * stored as a plain structure, in which case the caller has to deliver it.
+ */
+bool events_queue_push(const libvlc_event_t *ev);
+
+/**
+ * Returns false if the event was disabled from Java, or if it is a time
+ * or position update coming too soon after the previous one. Such events
+ * must be dropped before any JNI call.
+ */
+bool events_filter(const libvlc_event_t *ev);
+
+#endif // LIBVLCJNI_EVENTS_H
@@ -0,0 +1,366 @@
+/*****************************************************************************
+ * libvlcjni-events.c
+ *****************************************************************************
+ * Copyright © 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <jni.h>
+
+#include <vlc/vlc.h>
+
+#include "events.h"
+
+#define LOG_TAG "VLC/JNI/events"
+#include "log.h"
+
+/*
+ * libvlc events are stored as plain structures in a fixed size ring and
+ * drained in batches by a single Java thread (see EventHandler.java).
+ *
+ * The consumer side is lock-free. libvlc may emit events from several of
+ * its threads, so producers are serialized by producer_lock; they never
+ * wait for the consumer. The consumer only sleeps on wait_cond when the
+ * ring is empty, and producers only signal it when it does.
+ */
+
+#define EVENT_RING_SIZE 512 /* must be a power of 2 */
+#define EVENT_BATCH_MAX 64
+
+typedef struct
+{
+    int type;
+    int64_t time;       /// TimeChanged: new time in ms
+    float position;     /// PositionChanged: new position
+    int value;          /// Vout: new vout count
+    int64_t date;       /// Enqueue date, CLOCK_MONOTONIC in ns
+} jni_event_t;
+
+static struct
+{
+    jni_event_t events[EVENT_RING_SIZE];
+    volatile unsigned head; /// written by the producers only
+    volatile unsigned tail; /// written by the consumer only
+
+    pthread_mutex_t producer_lock;
+    pthread_mutex_t wait_lock;
+    pthread_cond_t wait_cond;
+    volatile bool waiting;
+    volatile bool running;
+
+    /* Source filter, see events_filter() */
+    volatile unsigned disabled;         /// bit i set to drop filterable_events[i]
+    volatile int64_t progress_interval; /// minimum time/position period, in ns
+    int64_t last_progress[2];           /// last time and position event dates
+
+    /* Statistics */
+    unsigned received;
+    unsigned filtered;
+    unsigned throttled;
+    unsigned pushed;
+    unsigned delivered;
+    unsigned coalesced;
+    unsigned overflows;
+} queue = {
+    .producer_lock = PTHREAD_MUTEX_INITIALIZER,
+    .wait_lock = PTHREAD_MUTEX_INITIALIZER,
+    .wait_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline bool is_progress_event(int type)
+{
+    return type == libvlc_MediaPlayerTimeChanged
+        || type == libvlc_MediaPlayerPositionChanged;
+}
+
+/* Events that Java can disable, see EventHandler.setEventEnabled() */
+static const int filterable_events[] = {
+    libvlc_MediaPlayerPlaying,
+    libvlc_MediaPlayerPaused,
+    libvlc_MediaPlayerEndReached,
+    libvlc_MediaPlayerStopped,
+    libvlc_MediaPlayerVout,
+    libvlc_MediaPlayerPositionChanged,
+    libvlc_MediaPlayerTimeChanged,
+    libvlc_MediaPlayerEncounteredError,
+    libvlc_MediaParsedChanged,
+};
+
+static int filterable_index(int type)
+{
+    for (unsigned i = 0; i < sizeof(filterable_events) / sizeof(*filterable_events); ++i)
+        if (filterable_events[i] == type)
+            return i;
+    return -1;
+}
+
+bool events_filter(const libvlc_event_t *ev)
+{
+    /* The counters are only approximate, as libvlc calls us from several
+     * threads, but this keeps the common path free of locks. */
+    queue.received++;
+
+    int index = filterable_index(ev->type);
+    if (index >= 0 && (queue.disabled & (1 << index)))
+    {
+        queue.filtered++;
+        return false;
+    }
+
+    int64_t interval = queue.progress_interval;
+    if (interval > 0 && is_progress_event(ev->type))
+    {
+        int64_t *last = &queue.last_progress[ev->type == libvlc_MediaPlayerPositionChanged];
+        int64_t now = monotonic_ns();
+        if (now - *last < interval)
+        {
+            queue.throttled++;
+            return false;
+        }
+        *last = now;
+    }
+    return true;
+}
+
+bool events_queue_push(const libvlc_event_t *ev)
+{
+    if (!queue.running)
+        return false;
+
+    jni_event_t event = {
+        .type = ev->type,
+        .date = monotonic_ns(),
+    };
+
+    switch (ev->type)
+    {
+    case libvlc_MediaPlayerTimeChanged:
+        event.time = ev->u.media_player_time_changed.new_time;
+        break;
+    case libvlc_MediaPlayerPositionChanged:
+        event.position = ev->u.media_player_position_changed.new_position;
+        break;
+    case libvlc_MediaPlayerVout:
+        event.value = ev->u.media_player_vout.new_count;
+        break;
+    case libvlc_MediaListItemAdded:
+    case libvlc_MediaListItemDeleted:
+        /* These carry a string, let the caller deliver them */
+        return false;
+    default:
+        break;
+    }
+
+    pthread_mutex_lock(&queue.producer_lock);
+    unsigned head = queue.head;
+    if (head - queue.tail >= EVENT_RING_SIZE)
+    {
+        queue.overflows++;
+        pthread_mutex_unlock(&queue.producer_lock);
+        LOGW("Event queue full, dropping event %d", ev->type);
+        return true;
+    }
+    queue.events[head & (EVENT_RING_SIZE - 1)] = event;
+    queue.pushed++;
+    /* Publish the event before moving the head */
+    __sync_synchronize();
+    queue.head = head + 1;
+    pthread_mutex_unlock(&queue.producer_lock);
+
+    __sync_synchronize();
+    if (queue.waiting)
+    {
+        pthread_mutex_lock(&queue.wait_lock);
+        pthread_cond_signal(&queue.wait_cond);
+        pthread_mutex_unlock(&queue.wait_lock);
+    }
+    return true;
+}
+
+static unsigned events_queue_pop(jni_event_t *events, unsigned max)
+{
+    unsigned tail = queue.tail;
+    unsigned head = queue.head;
+    /* Read the events only after having read the head */
+    __sync_synchronize();
+
+    unsigned count = head - tail;
+    if (count > max)
+        count = max;
+    for (unsigned i = 0; i < count; ++i)
+        events[i] = queue.events[(tail + i) & (EVENT_RING_SIZE - 1)];
+
+    /* Release the slots only once they have been copied */
+    __sync_synchronize();
+    queue.tail = tail + count;
+    return count;
+}
+
+/**
+ * Drop the time and position updates that are superseded by a newer update
+ * of the same kind before any other event.
+ */
+static unsigned events_coalesce(jni_event_t *events, unsigned count)
+{
+    unsigned out = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (is_progress_event(events[i].type))
+        {
+            bool superseded = false;
+            for (unsigned j = i + 1; j < count && is_progress_event(events[j].type); ++j)
+                if (events[j].type == events[i].type)
+                {
+                    superseded = true;
+                    break;
+                }
+            if (superseded)
+            {
+                queue.coalesced++;
+                continue;
+            }
+        }
+        events[out++] = events[i];
+    }
+    return out;
+}
+
+void Java_org_videolan_libvlc_EventHandler_nativeStartEvents(JNIEnv *env, jobject thiz)
+{
+    pthread_mutex_lock(&queue.producer_lock);
+    queue.tail = queue.head;
+    queue.running = true;
+    pthread_mutex_unlock(&queue.producer_lock);
+}
+
+void Java_org_videolan_libvlc_EventHandler_nativeStopEvents(JNIEnv *env, jobject thiz)
+{
+    pthread_mutex_lock(&queue.producer_lock);
+    queue.running = false;
+    pthread_mutex_unlock(&queue.producer_lock);
+
+    pthread_mutex_lock(&queue.wait_lock);
+    pthread_cond_signal(&queue.wait_cond);
+    pthread_mutex_unlock(&queue.wait_lock);
+}
+
+/**
+ * Wait up to timeout ms for events and copy a batch of them in the given
+ * arrays. Returns the number of events, or -1 if the queue is stopped.
+ */
+jint Java_org_videolan_libvlc_EventHandler_nativeWaitEvents(JNIEnv *env, jobject thiz,
+                                                            jintArray types, jlongArray times,
+                                                            jfloatArray positions, jintArray values,
+                                                            jlongArray dates, jint timeout)
+{
+    jni_event_t events[EVENT_BATCH_MAX];
+    unsigned max = (*env)->GetArrayLength(env, types);
+    if (max > EVENT_BATCH_MAX)
+        max = EVENT_BATCH_MAX;
+
+    if (queue.running && queue.head == queue.tail)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (timeout % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&queue.wait_lock);
+        queue.waiting = true;
+        __sync_synchronize();
+        while (queue.running && queue.head == queue.tail)
+            if (pthread_cond_timedwait(&queue.wait_cond, &queue.wait_lock, &deadline) == ETIMEDOUT)
+                break;
+        queue.waiting = false;
+        pthread_mutex_unlock(&queue.wait_lock);
+    }
+
+    if (!queue.running)
+        return -1;
+
+    unsigned count = events_coalesce(events, events_queue_pop(events, max));
+    queue.delivered += count;
+
+    jint j_types[EVENT_BATCH_MAX], j_values[EVENT_BATCH_MAX];
+    jlong j_times[EVENT_BATCH_MAX], j_dates[EVENT_BATCH_MAX];
+    jfloat j_positions[EVENT_BATCH_MAX];
+    for (unsigned i = 0; i < count; ++i)
+    {
+        j_types[i] = events[i].type;
+        j_times[i] = events[i].time;
+        j_positions[i] = events[i].position;
+        j_values[i] = events[i].value;
+        j_dates[i] = events[i].date;
+    }
+    (*env)->SetIntArrayRegion(env, types, 0, count, j_types);
+    (*env)->SetLongArrayRegion(env, times, 0, count, j_times);
+    (*env)->SetFloatArrayRegion(env, positions, 0, count, j_positions);
+    (*env)->SetIntArrayRegion(env, values, 0, count, j_values);
+    (*env)->SetLongArrayRegion(env, dates, 0, count, j_dates);
+    return count;
+}
+
+void Java_org_videolan_libvlc_EventHandler_nativeSetEventEnabled(JNIEnv *env, jobject thiz,
+                                                                 jint type, jboolean enabled)
+{
+    int index = filterable_index(type);
+    if (index < 0)
+        return;
+
+    pthread_mutex_lock(&queue.producer_lock);
+    if (enabled)
+        queue.disabled &= ~(1 << index);
+    else
+        queue.disabled |= 1 << index;
+    pthread_mutex_unlock(&queue.producer_lock);
+}
+
+void Java_org_videolan_libvlc_EventHandler_nativeSetProgressInterval(JNIEnv *env, jobject thiz,
+                                                                     jint interval)
+{
+    queue.progress_interval = interval > 0 ? (int64_t)interval * 1000000 : 0;
+}
+
+/**
+ * Fill stats with: pushed, delivered, coalesced, dropped, received,
+ * filtered and throttled event counts
+ */
+void Java_org_videolan_libvlc_EventHandler_nativeGetEventStats(JNIEnv *env, jobject thiz,
+                                                               jintArray stats)
+{
+    jint values[7] = {
+        queue.pushed, queue.delivered, queue.coalesced, queue.overflows,
+        queue.received, queue.filtered, queue.throttled
+    };
+    (*env)->SetIntArrayRegion(env, stats, 0, 7, values);
+}
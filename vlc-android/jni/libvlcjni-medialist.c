@@ -25,6 +25,7 @@
 #include <pthread.h>
 
 #include "utils.h"
+#include "mpool.h"
 #define LOG_TAG "VLC/JNI/MediaList"
 #include "log.h"
 
@@ -80,16 +81,16 @@ static int expand_media_internal(JNIEnv *env, libvlc_instance_t* p_instance, job
 
 jint Java_org_videolan_libvlc_MediaList_expandMedia(JNIEnv *env, jobject thiz, jobject libvlcJava, jint position, jobject children) {
     return (jint)expand_media_internal(env,
-        (libvlc_instance_t*)(intptr_t)getLong(env, libvlcJava, "mLibVlcInstance"),
+        (libvlc_instance_t*)(intptr_t)(*env)->GetLongField(env, libvlcJava, fields.LibVLC.mLibVlcInstanceID),
         children,
-        (libvlc_media_t*)libvlc_media_player_get_media((libvlc_media_player_t*)(intptr_t)getLong(env, libvlcJava, "mInternalMediaPlayerInstance"))
+        (libvlc_media_t*)libvlc_media_player_get_media((libvlc_media_player_t*)(intptr_t)(*env)->GetLongField(env, libvlcJava, fields.LibVLC.mInternalMediaPlayerInstanceID))
         );
 }
 
 void Java_org_videolan_libvlc_MediaList_loadPlaylist(JNIEnv *env, jobject thiz, jobject libvlcJava, jstring mrl, jobject items) {
     const char* p_mrl = (*env)->GetStringUTFChars(env, mrl, NULL);
 
-    libvlc_media_t *p_md = libvlc_media_new_location((libvlc_instance_t*)(intptr_t)getLong(env, libvlcJava, "mLibVlcInstance"), p_mrl);
+    libvlc_media_t *p_md = libvlc_media_new_location((libvlc_instance_t*)(intptr_t)(*env)->GetLongField(env, libvlcJava, fields.LibVLC.mLibVlcInstanceID), p_mrl);
     libvlc_media_add_option(p_md, ":demux=playlist,none");
     libvlc_media_add_option(p_md, ":run-time=1");
 
@@ -99,8 +100,9 @@ void Java_org_videolan_libvlc_MediaList_loadPlaylist(JNIEnv *env, jobject thiz,
     monitor->stopped = false;
     pthread_mutex_lock(&monitor->doneMutex);
 
-    libvlc_media_player_t* p_mp = libvlc_media_player_new((libvlc_instance_t*)(intptr_t)getLong(env, libvlcJava, "mLibVlcInstance"));
-    libvlc_media_player_set_video_title_display(p_mp, libvlc_position_disable, 0);
+    libvlc_instance_t *p_instance = (libvlc_instance_t*)(intptr_t)(*env)->GetLongField(env, libvlcJava, fields.LibVLC.mLibVlcInstanceID);
+    bool created;
+    libvlc_media_player_t* p_mp = mp_pool_get(p_instance, MP_ROLE_PROBE, 0, &created);
     libvlc_event_manager_t* ev = libvlc_media_player_event_manager(p_mp);
     libvlc_event_attach(ev, libvlc_MediaPlayerEndReached, stopped_callback, monitor);
     libvlc_media_player_set_media(p_mp, p_md);
@@ -115,13 +117,15 @@ void Java_org_videolan_libvlc_MediaList_loadPlaylist(JNIEnv *env, jobject thiz,
         mp_alive = libvlc_media_player_will_play(p_mp);
     }
     pthread_mutex_unlock(&monitor->doneMutex);
+
+    libvlc_event_detach(ev, libvlc_MediaPlayerEndReached, stopped_callback, monitor);
+    mp_pool_put(p_instance, p_mp, MP_ROLE_PROBE, 0);
+
     pthread_mutex_destroy(&monitor->doneMutex);
     pthread_cond_destroy(&monitor->doneCondVar);
     free(monitor);
 
-    libvlc_media_player_release(p_mp);
-
-    expand_media_internal(env, (libvlc_instance_t*)(intptr_t)getLong(env, libvlcJava, "mLibVlcInstance"), items, p_md);
+    expand_media_internal(env, (libvlc_instance_t*)(intptr_t)(*env)->GetLongField(env, libvlcJava, fields.LibVLC.mLibVlcInstanceID), items, p_md);
 
     (*env)->ReleaseStringUTFChars(env, mrl, p_mrl);
 }
@@ -0,0 +1,197 @@
+/*****************************************************************************
+ * libvlcjni-mpool.c
+ *****************************************************************************
+ * Copyright © 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <jni.h>
+
+#include <vlc/vlc.h>
+
+#include "mpool.h"
+
+#define LOG_TAG "VLC/JNI/mpool"
+#include "log.h"
+
+/*
+ * Creating a media player creates its audio output object and its input
+ * resources, and releasing it waits for all its threads. Players used for
+ * short tasks (thumbnails, probing) are kept here instead, stopped and
+ * without media, and handed again to the next task of the same role.
+ */
+
+#define MP_POOL_SIZE 8 /* per role, BATCH_MAX_THREADS in thumbnailer.c */
+
+typedef struct
+{
+    libvlc_media_player_t *mp;
+    int variant;
+} pooled_mp_t;
+
+static struct
+{
+    pthread_mutex_t lock;
+    libvlc_instance_t *libvlc;  /// instance of the pooled players
+    pooled_mp_t players[MP_ROLE_COUNT][MP_POOL_SIZE];
+    unsigned count[MP_ROLE_COUNT];
+
+    /* Statistics */
+    unsigned created;
+    unsigned released;
+    unsigned reused;
+    int64_t create_time;        /// in ns
+    int64_t release_time;       /// in ns
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void release_player(libvlc_media_player_t *mp)
+{
+    int64_t start = monotonic_ns();
+    libvlc_media_player_release(mp);
+    int64_t duration = monotonic_ns() - start;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.released++;
+    pool.release_time += duration;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/* Called with the lock held, returns the number of players to release */
+static unsigned take_all(libvlc_media_player_t **mps)
+{
+    unsigned n = 0;
+    for (unsigned role = 0; role < MP_ROLE_COUNT; ++role)
+    {
+        for (unsigned i = 0; i < pool.count[role]; ++i)
+            mps[n++] = pool.players[role][i].mp;
+        pool.count[role] = 0;
+    }
+    pool.libvlc = NULL;
+    return n;
+}
+
+static void release_all(libvlc_media_player_t **mps, unsigned n)
+{
+    for (unsigned i = 0; i < n; ++i)
+        release_player(mps[i]);
+}
+
+libvlc_media_player_t *mp_pool_get(libvlc_instance_t *libvlc, mp_role_t role,
+                                   int variant, bool *created)
+{
+    libvlc_media_player_t *stale[MP_ROLE_COUNT * MP_POOL_SIZE];
+    unsigned stale_count = 0;
+    libvlc_media_player_t *mp = NULL;
+
+    pthread_mutex_lock(&pool.lock);
+    if (pool.libvlc != libvlc)
+        /* The players belong to another libvlc instance */
+        stale_count = take_all(stale);
+    for (unsigned i = pool.count[role]; i-- > 0;)
+        if (pool.players[role][i].variant == variant)
+        {
+            mp = pool.players[role][i].mp;
+            pool.players[role][i] = pool.players[role][--pool.count[role]];
+            pool.reused++;
+            break;
+        }
+    pthread_mutex_unlock(&pool.lock);
+
+    release_all(stale, stale_count);
+
+    if (mp != NULL)
+    {
+        *created = false;
+        return mp;
+    }
+
+    int64_t start = monotonic_ns();
+    mp = libvlc_media_player_new(libvlc);
+    int64_t duration = monotonic_ns() - start;
+    if (mp == NULL)
+        return NULL;
+    libvlc_media_player_set_video_title_display(mp, libvlc_position_disable, 0);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.created++;
+    pool.create_time += duration;
+    pthread_mutex_unlock(&pool.lock);
+
+    *created = true;
+    return mp;
+}
+
+void mp_pool_put(libvlc_instance_t *libvlc, libvlc_media_player_t *mp,
+                 mp_role_t role, int variant)
+{
+    /* Reset the state left by the previous use */
+    libvlc_media_player_stop(mp);
+    libvlc_media_player_set_media(mp, NULL);
+    libvlc_media_player_set_rate(mp, 1.f);
+
+    pthread_mutex_lock(&pool.lock);
+    if (pool.libvlc == NULL)
+        pool.libvlc = libvlc;
+    if (pool.count[role] < MP_POOL_SIZE && pool.libvlc == libvlc)
+    {
+        pool.players[role][pool.count[role]++] = (pooled_mp_t) { mp, variant };
+        mp = NULL;
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    if (mp != NULL)
+        release_player(mp);
+}
+
+void mp_pool_clear(void)
+{
+    libvlc_media_player_t *mps[MP_ROLE_COUNT * MP_POOL_SIZE];
+
+    pthread_mutex_lock(&pool.lock);
+    unsigned n = take_all(mps);
+    pthread_mutex_unlock(&pool.lock);
+
+    release_all(mps, n);
+}
+
+void Java_org_videolan_libvlc_LibVLC_nativeGetMediaPlayerPoolStats(JNIEnv *env, jobject thiz,
+                                                                   jlongArray stats)
+{
+    pthread_mutex_lock(&pool.lock);
+    jlong values[5] = {
+        pool.created,
+        pool.released,
+        pool.reused,
+        pool.create_time,
+        pool.release_time,
+    };
+    pthread_mutex_unlock(&pool.lock);
+    (*env)->SetLongArrayRegion(env, stats, 0, 5, values);
+}
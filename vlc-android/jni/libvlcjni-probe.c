@@ -0,0 +1,285 @@
+/*****************************************************************************
+ * libvlcjni-probe.c
+ *****************************************************************************
+ * Copyright © 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "probe.h"
+
+#define LOG_TAG "VLC/JNI/probe"
+#include "log.h"
+
+#define PROBE_CACHE_SIZE 512
+
+/* A cached description, freed with its last reference */
+typedef struct
+{
+    probe_t probe;              /// first, see probe_release()
+    unsigned refs;
+} probe_entry_t;
+
+static struct
+{
+    pthread_mutex_t lock;
+    struct
+    {
+        uint64_t hash;
+        off_t size;
+        time_t mtime;
+        probe_entry_t *entry;
+    } slots[PROBE_CACHE_SIZE];
+    unsigned count;
+    unsigned next;              /// oldest slot, replaced first
+    unsigned hits;
+    unsigned misses;
+} cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+uint64_t mrl_hash(const char *mrl)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)mrl; *p; ++p)
+        hash = (hash ^ *p) * 1099511628211ULL;
+    return hash;
+}
+
+bool mrl_stat(const char *mrl, struct stat *st)
+{
+    if (strncmp(mrl, "file://", 7))
+        return false;
+
+    /* Decode the URI */
+    char *path = malloc(strlen(mrl) + 1), *out = path;
+    if (path == NULL)
+        return false;
+    for (const char *in = mrl + 7; *in; ++in)
+    {
+        unsigned c;
+        if (*in == '%' && sscanf(in + 1, "%2x", &c) == 1)
+        {
+            *out++ = c;
+            in += 2;
+        }
+        else
+            *out++ = *in;
+    }
+    *out = '\0';
+
+    bool ret = stat(path, st) == 0;
+    free(path);
+    return ret;
+}
+
+bool probe_fill(probe_t *probe, libvlc_media_t *m)
+{
+    memset(probe, 0, sizeof(*probe));
+    probe->length = libvlc_media_get_duration(m);
+    /* The meta are copies */
+    probe->title = libvlc_media_get_meta(m, libvlc_meta_Title);
+    probe->artist = libvlc_media_get_meta(m, libvlc_meta_Artist);
+    probe->album = libvlc_media_get_meta(m, libvlc_meta_Album);
+    probe->genre = libvlc_media_get_meta(m, libvlc_meta_Genre);
+    probe->artwork_url = libvlc_media_get_meta(m, libvlc_meta_ArtworkURL);
+
+    libvlc_media_track_t **tracks;
+    int count = libvlc_media_tracks_get(m, &tracks);
+    if (count <= 0)
+        return true;
+
+    probe->tracks = calloc(count, sizeof(*probe->tracks));
+    if (probe->tracks == NULL)
+    {
+        libvlc_media_tracks_release(tracks, count);
+        return false;
+    }
+    probe->track_count = count;
+
+    for (int i = 0; i < count; ++i)
+    {
+        probe_track_t *track = &probe->tracks[i];
+        track->id = tracks[i]->i_id;
+        track->type = tracks[i]->i_type;
+        track->codec = tracks[i]->i_codec;
+        track->language = tracks[i]->psz_language ? strdup(tracks[i]->psz_language) : NULL;
+        track->bitrate = tracks[i]->i_bitrate;
+
+        switch (tracks[i]->i_type)
+        {
+        case libvlc_track_video:
+            track->width = tracks[i]->video->i_width;
+            track->height = tracks[i]->video->i_height;
+            track->framerate = tracks[i]->video->i_frame_rate_den
+                ? (float)tracks[i]->video->i_frame_rate_num / tracks[i]->video->i_frame_rate_den
+                : 0.f;
+            if (probe->kind != PROBE_VIDEO)
+            {
+                probe->kind = PROBE_VIDEO;
+                probe->width = track->width;
+                probe->height = track->height;
+            }
+            break;
+        case libvlc_track_audio:
+            track->channels = tracks[i]->audio->i_channels;
+            track->rate = tracks[i]->audio->i_rate;
+            if (probe->kind == PROBE_UNKNOWN)
+                probe->kind = PROBE_AUDIO;
+            break;
+        default:
+            break;
+        }
+    }
+
+    libvlc_media_tracks_release(tracks, count);
+    return true;
+}
+
+void probe_clean(probe_t *probe)
+{
+    for (unsigned i = 0; i < probe->track_count; ++i)
+        free(probe->tracks[i].language);
+    free(probe->tracks);
+    free(probe->title);
+    free(probe->artist);
+    free(probe->album);
+    free(probe->genre);
+    free(probe->artwork_url);
+}
+
+/* Called with the cache lock */
+static void entry_unref(probe_entry_t *entry)
+{
+    if (--entry->refs > 0)
+        return;
+    probe_clean(&entry->probe);
+    free(entry);
+}
+
+typedef struct
+{
+    uint64_t hash;
+    off_t size;
+    time_t mtime;
+} identity_t;
+
+static identity_t mrl_identity(const char *mrl)
+{
+    identity_t id = { .hash = mrl_hash(mrl) };
+    struct stat st;
+    if (mrl_stat(mrl, &st))
+    {
+        id.size = st.st_size;
+        id.mtime = st.st_mtime;
+    }
+    return id;
+}
+
+const probe_t *probe_lookup(const char *mrl)
+{
+    const identity_t id = mrl_identity(mrl);
+    probe_entry_t *entry = NULL;
+
+    pthread_mutex_lock(&cache.lock);
+    for (unsigned i = 0; i < cache.count && entry == NULL; ++i)
+        if (cache.slots[i].hash == id.hash && cache.slots[i].size == id.size
+         && cache.slots[i].mtime == id.mtime)
+        {
+            entry = cache.slots[i].entry;
+            entry->refs++;
+        }
+    if (entry != NULL)
+        cache.hits++;
+    else
+        cache.misses++;
+    pthread_mutex_unlock(&cache.lock);
+    return entry != NULL ? &entry->probe : NULL;
+}
+
+const probe_t *probe_add(const char *mrl, libvlc_media_t *m)
+{
+    probe_entry_t *entry = malloc(sizeof(*entry));
+    if (entry == NULL)
+        return NULL;
+    if (!probe_fill(&entry->probe, m))
+    {
+        probe_clean(&entry->probe);
+        free(entry);
+        return NULL;
+    }
+    entry->refs = 1;
+
+    /* Do not keep the media without tracks, they may be unreachable for
+     * now only */
+    if (entry->probe.track_count == 0)
+        return &entry->probe;
+
+    const identity_t id = mrl_identity(mrl);
+    pthread_mutex_lock(&cache.lock);
+    if (cache.count == PROBE_CACHE_SIZE)
+        entry_unref(cache.slots[cache.next].entry);
+    else
+        cache.count++;
+    cache.slots[cache.next].hash = id.hash;
+    cache.slots[cache.next].size = id.size;
+    cache.slots[cache.next].mtime = id.mtime;
+    cache.slots[cache.next].entry = entry;
+    cache.next = (cache.next + 1) % PROBE_CACHE_SIZE;
+    entry->refs++;
+    pthread_mutex_unlock(&cache.lock);
+
+    return &entry->probe;
+}
+
+const probe_t *probe_get(libvlc_instance_t *libvlc, const char *mrl)
+{
+    const probe_t *probe = probe_lookup(mrl);
+    if (probe != NULL)
+        return probe;
+
+    libvlc_media_t *m = libvlc_media_new_location(libvlc, mrl);
+    if (m == NULL)
+    {
+        LOGE("Could not create the media to probe!");
+        return NULL;
+    }
+    libvlc_media_parse(m);
+    probe = probe_add(mrl, m);
+    libvlc_media_release(m);
+    return probe;
+}
+
+void probe_release(const probe_t *probe)
+{
+    pthread_mutex_lock(&cache.lock);
+    entry_unref((probe_entry_t *)probe);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+void probe_cache_clear(void)
+{
+    pthread_mutex_lock(&cache.lock);
+    for (unsigned i = 0; i < cache.count; ++i)
+        entry_unref(cache.slots[i].entry);
+    cache.count = cache.next = 0;
+    LOGD("Probe cache: %u hits, %u misses", cache.hits, cache.misses);
+    pthread_mutex_unlock(&cache.lock);
+}
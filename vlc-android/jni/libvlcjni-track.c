@@ -18,6 +18,12 @@
  * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
  *****************************************************************************/
 
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 #include <vlc/vlc.h>
 #include <vlc_common.h>
 #include <vlc_fourcc.h>
@@ -25,6 +31,8 @@
 #include <jni.h>
 
 #include "utils.h"
+#include "mpool.h"
+#include "probe.h"
 
 #define LOG_TAG "VLC/JNI/track"
 #include "log.h"
@@ -47,6 +55,22 @@ static void length_changed_callback(const libvlc_event_t *ev, void *data)
 jboolean Java_org_videolan_libvlc_LibVLC_hasVideoTrack(JNIEnv *env, jobject thiz,
                                                        jlong i_instance, jstring fileLocation)
 {
+    /* The parsed description is enough, unless it has no track: then
+     * play the media to find them. */
+    const char *psz_location = (*env)->GetStringUTFChars(env, fileLocation, NULL);
+    if (psz_location != NULL)
+    {
+        const probe_t *probe = probe_get((libvlc_instance_t*)(intptr_t)i_instance, psz_location);
+        (*env)->ReleaseStringUTFChars(env, fileLocation, psz_location);
+        if (probe != NULL)
+        {
+            probe_kind_t kind = probe->kind;
+            probe_release(probe);
+            if (kind != PROBE_UNKNOWN)
+                return kind == PROBE_VIDEO;
+        }
+    }
+
     /* Create a new item and assign it to the media player. */
     libvlc_media_t *p_m = new_media(i_instance, env, thiz, fileLocation, false, false);
     if (p_m == NULL)
@@ -58,12 +82,23 @@ jboolean Java_org_videolan_libvlc_LibVLC_hasVideoTrack(JNIEnv *env, jobject thiz
     /* Get the tracks information of the media. */
     libvlc_media_parse(p_m);
 
-    libvlc_media_player_t* p_mp = libvlc_media_player_new_from_media(p_m);
-    libvlc_media_player_set_video_title_display(p_mp, libvlc_position_disable, 0);
+    bool created;
+    libvlc_media_player_t* p_mp = mp_pool_get((libvlc_instance_t*)(intptr_t)i_instance,
+                                              MP_ROLE_PROBE, 0, &created);
+    if (p_mp == NULL)
+    {
+        libvlc_media_release(p_m);
+        return JNI_FALSE;
+    }
+    libvlc_media_player_set_media(p_mp, p_m);
 
     struct length_change_monitor* monitor;
     monitor = malloc(sizeof(struct length_change_monitor));
-    if (!monitor) return 0;
+    if (!monitor) {
+        mp_pool_put((libvlc_instance_t*)(intptr_t)i_instance, p_mp, MP_ROLE_PROBE, 0);
+        libvlc_media_release(p_m);
+        return 0;
+    }
 
     /* Initialize pthread variables. */
     pthread_mutex_init(&monitor->doneMutex, NULL);
@@ -94,8 +129,7 @@ jboolean Java_org_videolan_libvlc_LibVLC_hasVideoTrack(JNIEnv *env, jobject thiz
     LOGI("Number of video tracks: %d",i_nbTracks);
 
     libvlc_event_detach(ev, libvlc_MediaPlayerLengthChanged, length_changed_callback, monitor);
-    libvlc_media_player_stop(p_mp);
-    libvlc_media_player_release(p_mp);
+    mp_pool_put((libvlc_instance_t*)(intptr_t)i_instance, p_mp, MP_ROLE_PROBE, 0);
     libvlc_media_release(p_m);
 
     pthread_mutex_destroy(&monitor->doneMutex);
@@ -110,92 +144,379 @@ jboolean Java_org_videolan_libvlc_LibVLC_hasVideoTrack(JNIEnv *env, jobject thiz
         return JNI_FALSE;
 }
 
-jobjectArray read_track_info_internal(JNIEnv *env, jobject thiz, libvlc_media_t* p_m)
+/**
+ * Convert a media description to the TrackInfo array of readTracksInfo():
+ * the tracks, then the meta data.
+ */
+static jobjectArray probe_to_tracks(JNIEnv *env, const probe_t *probe)
 {
-    /* get java class */
-    jclass cls = (*env)->FindClass( env, "org/videolan/libvlc/TrackInfo" );
-    if ( !cls )
-    {
-        LOGE("Failed to load class (org/videolan/libvlc/TrackInfo)" );
+    jclass cls = fields.TrackInfo.clazz;
+    jobjectArray array = (*env)->NewObjectArray(env, probe->track_count + 1, cls, NULL);
+    if (array == NULL)
         return NULL;
+
+    for (unsigned i = 0; i <= probe->track_count; ++i)
+    {
+        jobject item = (*env)->NewObject(env, cls, fields.TrackInfo.ctorID);
+        if (item == NULL)
+            continue;
+        (*env)->SetObjectArrayElement(env, array, i, item);
+
+        // use last track for metadata
+        if (i == probe->track_count)
+        {
+            (*env)->SetIntField(env, item, fields.TrackInfo.TypeID, 3 /* TYPE_META */);
+            (*env)->SetLongField(env, item, fields.TrackInfo.LengthID, probe->length);
+            setStringField(env, item, fields.TrackInfo.TitleID, probe->title);
+            setStringField(env, item, fields.TrackInfo.ArtistID, probe->artist);
+            setStringField(env, item, fields.TrackInfo.AlbumID, probe->album);
+            setStringField(env, item, fields.TrackInfo.GenreID, probe->genre);
+            setStringField(env, item, fields.TrackInfo.ArtworkURLID, probe->artwork_url);
+            (*env)->DeleteLocalRef(env, item);
+            continue;
+        }
+
+        const probe_track_t *track = &probe->tracks[i];
+        (*env)->SetIntField(env, item, fields.TrackInfo.IdID, track->id);
+        (*env)->SetIntField(env, item, fields.TrackInfo.TypeID, track->type);
+        setStringField(env, item, fields.TrackInfo.CodecID, (const char*)vlc_fourcc_GetDescription(0, track->codec));
+        setStringField(env, item, fields.TrackInfo.LanguageID, track->language);
+        (*env)->SetIntField(env, item, fields.TrackInfo.BitrateID, track->bitrate);
+
+        if (track->type == libvlc_track_video)
+        {
+            (*env)->SetIntField(env, item, fields.TrackInfo.HeightID, track->height);
+            (*env)->SetIntField(env, item, fields.TrackInfo.WidthID, track->width);
+            (*env)->SetFloatField(env, item, fields.TrackInfo.FramerateID, track->framerate);
+        }
+        if (track->type == libvlc_track_audio)
+        {
+            (*env)->SetIntField(env, item, fields.TrackInfo.ChannelsID, track->channels);
+            (*env)->SetIntField(env, item, fields.TrackInfo.SamplerateID, track->rate);
+        }
+        (*env)->DeleteLocalRef(env, item);
     }
+    return array;
+}
 
-    /* get java class contructor */
-    jmethodID clsCtor = (*env)->GetMethodID( env, cls, "<init>", "()V" );
-    if ( !clsCtor )
+jobjectArray Java_org_videolan_libvlc_LibVLC_readTracksInfo(JNIEnv *env, jobject thiz,
+                                                            jlong instance, jstring mrl)
+{
+    const char *psz_mrl = (*env)->GetStringUTFChars(env, mrl, NULL);
+    if (psz_mrl == NULL)
+        return NULL;
+    const probe_t *probe = probe_get((libvlc_instance_t*)(intptr_t)instance, psz_mrl);
+    (*env)->ReleaseStringUTFChars(env, mrl, psz_mrl);
+    if (probe == NULL)
     {
-        LOGE("Failed to find class constructor (org/videolan/libvlc/TrackInfo)" );
+        LOGE("Could not create the media!");
         return NULL;
     }
 
-    /* Get the tracks information of the media. */
-    libvlc_media_track_t **p_tracks;
+    jobjectArray jar = probe_to_tracks(env, probe);
+    probe_release(probe);
+    return jar;
+}
 
-    int i_nbTracks = libvlc_media_tracks_get(p_m, &p_tracks);
-    jobjectArray array = (*env)->NewObjectArray(env, i_nbTracks + 1, cls, NULL);
 
-    unsigned i;
-    if (array != NULL)
+/*
+ * Asynchronous parsing: the media are parsed by the libvlc preparser, and
+ * a dispatcher thread hands their description to the Java callbacks, or
+ * null once their timeout expired or they were cancelled.
+ */
+
+#define PARSE_MAX_TIMEOUT 60000 /* ms */
+
+typedef struct parse_job
+{
+    struct parse_job *next;
+    jint id;
+    char *mrl;
+    libvlc_media_t *m;          /// NULL if the description was cached
+    const probe_t *probe;       /// cached description
+    jobject callback;           /// global reference
+    int64_t deadline;           /// CLOCK_REALTIME, in ns
+    bool parsed;
+    bool cancelled;
+} parse_job_t;
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wait;
+    parse_job_t *jobs;          /// in flight
+    jint last_id;
+    pthread_t thread;
+    bool starting;              /// the thread is not attached yet
+    bool started;               /// the thread is attached and running
+    bool stopping;
+} parser = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wait = PTHREAD_COND_INITIALIZER,
+};
+
+static int64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void parse_event(const libvlc_event_t *ev, void *opaque)
+{
+    parse_job_t *job = opaque;
+
+    pthread_mutex_lock(&parser.lock);
+    job->parsed = true;
+    pthread_cond_signal(&parser.wait);
+    pthread_mutex_unlock(&parser.lock);
+}
+
+/**
+ * Deliver the result of a job taken off the list, and free it.
+ */
+static void parse_job_finish(JNIEnv *env, parse_job_t *job)
+{
+    if (job->m != NULL)
+        libvlc_event_detach(libvlc_media_event_manager(job->m), libvlc_MediaParsedChanged,
+                            parse_event, job);
+
+    /* No event can come anymore */
+    pthread_mutex_lock(&parser.lock);
+    bool parsed = job->parsed && !job->cancelled;
+    pthread_mutex_unlock(&parser.lock);
+
+    const probe_t *probe = job->probe;
+    if (probe == NULL && parsed)
+        probe = probe_add(job->mrl, job->m);
+    else if (!parsed)
+        LOGD("Parsing of %s %s", job->mrl, job->cancelled ? "cancelled" : "timed out");
+    /* A timed out media may still be parsed by libvlc: its observers are
+     * removed with the last reference. */
+    if (job->m != NULL)
+        libvlc_media_release(job->m);
+
+    jobjectArray tracks = parsed && probe != NULL ? probe_to_tracks(env, probe) : NULL;
+    (*env)->CallVoidMethod(env, job->callback, fields.ParseCallback.onParsedID,
+                           job->id, tracks);
+    if ((*env)->ExceptionCheck(env))
     {
-        for (i = 0; i <= i_nbTracks; ++i)
-        {
-            jobject item = (*env)->NewObject(env, cls, clsCtor);
-            if (item == NULL)
-                continue;
-            (*env)->SetObjectArrayElement(env, array, i, item);
+        LOGE("Exception in the parse callback of %s", job->mrl);
+        (*env)->ExceptionClear(env);
+    }
+    if (tracks != NULL)
+        (*env)->DeleteLocalRef(env, tracks);
+    (*env)->DeleteGlobalRef(env, job->callback);
+
+    if (probe != NULL)
+        probe_release(probe);
+    free(job->mrl);
+    free(job);
+}
 
-            // use last track for metadata
-            if (i == i_nbTracks)
+static void *parse_thread(void *data)
+{
+    JNIEnv *env = jni_get_env("MediaParser");
+
+    /* Without the JVM, no callback could be called: refuse the jobs */
+    pthread_mutex_lock(&parser.lock);
+    parser.starting = false;
+    parser.started = env != NULL;
+    pthread_cond_broadcast(&parser.wait);
+    if (env == NULL)
+    {
+        pthread_mutex_unlock(&parser.lock);
+        pthread_detach(pthread_self());
+        return NULL;
+    }
+    while (!parser.stopping)
+    {
+        /* Take the jobs that are parsed, cancelled or too late */
+        const int64_t now = realtime_ns();
+        int64_t next = INT64_MAX;
+        parse_job_t *done = NULL, **pp = &parser.jobs;
+        while (*pp != NULL)
+        {
+            parse_job_t *job = *pp;
+            if (job->parsed || job->cancelled || job->deadline <= now)
             {
-                setInt(env, item, "Type", 3 /* TYPE_META */);
-                setLong(env, item, "Length", libvlc_media_get_duration(p_m));
-                setString(env, item, "Title", libvlc_media_get_meta(p_m, libvlc_meta_Title));
-                setString(env, item, "Artist", libvlc_media_get_meta(p_m, libvlc_meta_Artist));
-                setString(env, item, "Album", libvlc_media_get_meta(p_m, libvlc_meta_Album));
-                setString(env, item, "Genre", libvlc_media_get_meta(p_m, libvlc_meta_Genre));
-                setString(env, item, "ArtworkURL", libvlc_media_get_meta(p_m, libvlc_meta_ArtworkURL));
-                continue;
+                *pp = job->next;
+                job->next = done;
+                done = job;
             }
-
-            setInt(env, item, "Id", p_tracks[i]->i_id);
-            setInt(env, item, "Type", p_tracks[i]->i_type);
-            setString(env, item, "Codec", (const char*)vlc_fourcc_GetDescription(0,p_tracks[i]->i_codec));
-            setString(env, item, "Language", p_tracks[i]->psz_language);
-            setInt(env, item, "Bitrate", p_tracks[i]->i_bitrate);
-
-            if (p_tracks[i]->i_type == libvlc_track_video)
+            else
             {
-                setInt(env, item, "Height", p_tracks[i]->video->i_height);
-                setInt(env, item, "Width", p_tracks[i]->video->i_width);
-                setFloat(env, item, "Framerate", (float)p_tracks[i]->video->i_frame_rate_num / p_tracks[i]->video->i_frame_rate_den);
+                if (job->deadline < next)
+                    next = job->deadline;
+                pp = &job->next;
             }
-            if (p_tracks[i]->i_type == libvlc_track_audio)
+        }
+
+        if (done == NULL)
+        {
+            if (parser.jobs == NULL)
+                pthread_cond_wait(&parser.wait, &parser.lock);
+            else
             {
-                setInt(env, item, "Channels", p_tracks[i]->audio->i_channels);
-                setInt(env, item, "Samplerate", p_tracks[i]->audio->i_rate);
+                struct timespec deadline = {
+                    .tv_sec = next / 1000000000LL,
+                    .tv_nsec = next % 1000000000LL,
+                };
+                pthread_cond_timedwait(&parser.wait, &parser.lock, &deadline);
             }
+            continue;
         }
-    }
 
-    libvlc_media_tracks_release(p_tracks, i_nbTracks);
-    return array;
+        pthread_mutex_unlock(&parser.lock);
+        while (done != NULL)
+        {
+            parse_job_t *job = done;
+            done = job->next;
+            parse_job_finish(env, job);
+        }
+        pthread_mutex_lock(&parser.lock);
+    }
+    pthread_mutex_unlock(&parser.lock);
+    return NULL;
 }
 
-jobjectArray Java_org_videolan_libvlc_LibVLC_readTracksInfo(JNIEnv *env, jobject thiz,
-                                                            jlong instance, jstring mrl)
+/**
+ * Parse a media in the background. The callback is called once, from a
+ * native thread, with the tracks of the media, or null if it could not be
+ * parsed within timeout ms or was cancelled.
+ * Return the id of the job, for cancelParse(), or -1 on error.
+ */
+jint Java_org_videolan_libvlc_LibVLC_parseAsync(JNIEnv *env, jobject thiz, jlong instance,
+                                                jstring mrl, jint timeout, jobject callback)
 {
-    /* Create a new item and assign it to the media player. */
-    libvlc_media_t *p_m = new_media(instance, env, thiz, mrl, false, false);
-    if (p_m == NULL)
+    parse_job_t *job = calloc(1, sizeof(*job));
+    if (job == NULL)
+        return -1;
+
+    const char *psz_mrl = (*env)->GetStringUTFChars(env, mrl, NULL);
+    if (psz_mrl == NULL)
     {
-        LOGE("Could not create the media!");
-        return NULL;
+        free(job);
+        return -1;
+    }
+    job->mrl = strdup(psz_mrl);
+    (*env)->ReleaseStringUTFChars(env, mrl, psz_mrl);
+    job->callback = (*env)->NewGlobalRef(env, callback);
+    if (job->mrl == NULL || job->callback == NULL)
+        goto error;
+    if (timeout <= 0 || timeout > PARSE_MAX_TIMEOUT)
+        timeout = PARSE_MAX_TIMEOUT;
+    job->deadline = realtime_ns() + (int64_t)timeout * 1000000;
+
+    /* Start the parsing before the job is visible: the dispatcher may
+     * free it as soon as it is. */
+    job->probe = probe_lookup(job->mrl);
+    if (job->probe != NULL)
+        job->parsed = true;
+    else
+    {
+        job->m = libvlc_media_new_location((libvlc_instance_t*)(intptr_t)instance, job->mrl);
+        if (job->m == NULL)
+            goto error;
+        libvlc_event_attach(libvlc_media_event_manager(job->m), libvlc_MediaParsedChanged,
+                            parse_event, job);
+        libvlc_media_parse_async(job->m);
     }
 
-    libvlc_media_parse(p_m);
-    jobjectArray jar = read_track_info_internal(env, thiz, p_m);
-    libvlc_media_release(p_m);
-    return jar;
+    /* Every job accepted gets its callback: the parser thread must be
+     * running and attached to the JVM first */
+    pthread_mutex_lock(&parser.lock);
+    if (!parser.started && !parser.starting)
+    {
+        if (pthread_create(&parser.thread, NULL, parse_thread, NULL) != 0)
+        {
+            pthread_mutex_unlock(&parser.lock);
+            LOGE("Could not start the parser thread");
+            goto error;
+        }
+        parser.starting = true;
+    }
+    while (parser.starting)
+        pthread_cond_wait(&parser.wait, &parser.lock);
+    if (!parser.started)
+    {
+        pthread_mutex_unlock(&parser.lock);
+        LOGE("Could not attach the parser thread");
+        goto error;
+    }
+    jint id = job->id = ++parser.last_id;
+    job->next = parser.jobs;
+    parser.jobs = job;
+    pthread_cond_signal(&parser.wait);
+    pthread_mutex_unlock(&parser.lock);
+    return id;
+
+error:
+    if (job->m != NULL)
+    {
+        libvlc_event_detach(libvlc_media_event_manager(job->m), libvlc_MediaParsedChanged,
+                            parse_event, job);
+        libvlc_media_release(job->m);
+    }
+    if (job->probe != NULL)
+        probe_release(job->probe);
+    if (job->callback != NULL)
+        (*env)->DeleteGlobalRef(env, job->callback);
+    free(job->mrl);
+    free(job);
+    return -1;
+}
+
+/**
+ * Cancel a job of parseAsync(): its callback is called with null soon.
+ * Return false if the job is already finished.
+ */
+jboolean Java_org_videolan_libvlc_LibVLC_cancelParse(JNIEnv *env, jobject thiz, jint id)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&parser.lock);
+    for (parse_job_t *job = parser.jobs; job != NULL && !found; job = job->next)
+        if (job->id == id)
+        {
+            job->cancelled = true;
+            found = true;
+        }
+    pthread_cond_signal(&parser.wait);
+    pthread_mutex_unlock(&parser.lock);
+    return found;
+}
+
+void parse_async_stop(JNIEnv *env)
+{
+    pthread_mutex_lock(&parser.lock);
+    while (parser.starting)
+        pthread_cond_wait(&parser.wait, &parser.lock);
+    if (!parser.started)
+    {
+        pthread_mutex_unlock(&parser.lock);
+        return;
+    }
+    parser.stopping = true;
+    pthread_cond_signal(&parser.wait);
+    pthread_mutex_unlock(&parser.lock);
+    pthread_join(parser.thread, NULL);
+
+    /* Cancel the remaining jobs, from the calling thread */
+    pthread_mutex_lock(&parser.lock);
+    parse_job_t *jobs = parser.jobs;
+    for (parse_job_t *job = jobs; job != NULL; job = job->next)
+        job->cancelled = true;
+    parser.jobs = NULL;
+    parser.started = parser.stopping = false;
+    pthread_mutex_unlock(&parser.lock);
+
+    while (jobs != NULL)
+    {
+        parse_job_t *job = jobs;
+        jobs = job->next;
+        parse_job_finish(env, job);
+    }
 }
 
 
@@ -210,8 +531,13 @@ jobjectArray Java_org_videolan_libvlc_LibVLC_readTracksInfoInternal(JNIEnv *env,
     if (p_m == NULL) {
         LOGE("Could not load internal media!");
         return NULL;
-    } else
-        return read_track_info_internal(env, thiz, p_m);
+    }
+
+    probe_t probe;
+    jobjectArray jar = probe_fill(&probe, p_m) ? probe_to_tracks(env, &probe) : NULL;
+    probe_clean(&probe);
+    libvlc_media_release(p_m);
+    return jar;
 }
 
 jint Java_org_videolan_libvlc_LibVLC_getAudioTracksCount(JNIEnv *env, jobject thiz)
@@ -28,6 +28,8 @@
 
 #include <jni.h>
 
+#include "utils.h"
+
 #define LOG_TAG "VLC/JNI/Util"
 #include "log.h"
 
@@ -36,9 +38,6 @@ static jobject debugBufferInstance = NULL;
 // FIXME: use atomics
 static bool buffer_logging;
 
-/** Unique Java VM instance, as defined in libvlcjni.c */
-extern JavaVM *myVm;
-
 jint getInt(JNIEnv *env, jobject thiz, const char* field) {
     jclass clazz = (*env)->GetObjectClass(env, thiz);
     jfieldID fieldMP = (*env)->GetFieldID(env, clazz,
@@ -115,12 +114,23 @@ void setString(JNIEnv *env, jobject item, const char* field, const char* text) {
     (*env)->SetObjectField(env, item, fieldId, jstr);
 }
 
+void setStringField(JNIEnv *env, jobject item, jfieldID fieldID, const char* text) {
+    if (text == NULL)
+        return;
+
+    jstring jstr = (*env)->NewStringUTF(env, text);
+    if (jstr == NULL)
+        return;
+    (*env)->SetObjectField(env, item, fieldID, jstr);
+    (*env)->DeleteLocalRef(env, jstr);
+}
+
 void arrayListGetIDs(JNIEnv *env, jclass* p_class, jmethodID* p_add, jmethodID* p_remove) {
-    *p_class = (*env)->FindClass(env, "java/util/ArrayList");
+    *p_class = fields.ArrayList.clazz;
     if(p_add)
-        *p_add = (*env)->GetMethodID(env, *p_class, "add", "(Ljava/lang/Object;)Z");
+        *p_add = fields.ArrayList.addID;
     if(p_remove)
-        *p_remove = (*env)->GetMethodID(env, *p_class, "remove", "(I)Ljava/lang/Object;");
+        *p_remove = fields.ArrayList.removeID;
 }
 
 void arrayListStringAdd(JNIEnv *env, jclass class, jmethodID methodID, jobject arrayList, const char* str) {
@@ -131,15 +141,8 @@ void arrayListStringAdd(JNIEnv *env, jclass class, jmethodID methodID, jobject a
 
 jobject getEventHandlerReference(JNIEnv *env, jobject thiz, jobject eventHandler)
 {
-    jclass cls = (*env)->GetObjectClass(env, eventHandler);
-    if (!cls) {
-        LOGE("setEventHandler: failed to get class reference");
-        return NULL;
-    }
-
-    jmethodID methodID = (*env)->GetMethodID(env, cls, "callback", "(ILandroid/os/Bundle;)V");
-    if (!methodID) {
-        LOGE("setEventHandler: failed to get the callback method");
+    if (!(*env)->IsInstanceOf(env, eventHandler, fields.EventHandler.clazz)) {
+        LOGE("setEventHandler: not an EventHandler instance");
         return NULL;
     }
 
@@ -148,14 +151,9 @@ jobject getEventHandlerReference(JNIEnv *env, jobject thiz, jobject eventHandler
 
 static void debug_buffer_log(void *data, int level, const char *fmt, va_list ap)
 {
-    bool isAttached = false;
-    JNIEnv *env = NULL;
-
-    if ((*myVm)->GetEnv(myVm, (void**) &env, JNI_VERSION_1_2) < 0) {
-        if ((*myVm)->AttachCurrentThread(myVm, &env, NULL) < 0)
-            return;
-        isAttached = true;
-    }
+    JNIEnv *env = jni_get_env("jni_log");
+    if (env == NULL)
+        return;
 
     /* Prepare message string */
     char* psz_fmt_newline = malloc(strlen(fmt) + 2);
@@ -170,16 +168,12 @@ static void debug_buffer_log(void *data, int level, const char *fmt, va_list ap)
         return;
 
     jobject buffer = debugBufferInstance;
-    jclass buffer_class = (*env)->FindClass(env, "java/lang/StringBuffer");
-    jmethodID bufferAppendID = (*env)->GetMethodID(env, buffer_class, "append", "(Ljava/lang/String;)Ljava/lang/StringBuffer;");
 
     jstring message = (*env)->NewStringUTF(env, psz_msg);
-    (*env)->CallObjectMethod(env, buffer, bufferAppendID, message);
+    jobject ret = (*env)->CallObjectMethod(env, buffer, fields.StringBuffer.appendID, message);
+    (*env)->DeleteLocalRef(env, ret);
     (*env)->DeleteLocalRef(env, message);
     free(psz_msg);
-
-    if (isAttached)
-        (*myVm)->DetachCurrentThread(myVm);
 }
 
 void debug_log(void *data, int level, const libvlc_log_t *ctx, const char *fmt, va_list ap)
@@ -284,8 +278,7 @@ void Java_org_videolan_libvlc_LibVLC_nativeReadDirectory(JNIEnv *env, jobject th
     if(!p_dir)
         return;
 
-    jclass arrayClass = (*env)->FindClass(env, "java/util/ArrayList");
-    jmethodID methodID = (*env)->GetMethodID(env, arrayClass, "add", "(Ljava/lang/Object;)Z");
+    jmethodID methodID = fields.ArrayList.addID;
 
     struct dirent* p_dirent;
     jstring str;
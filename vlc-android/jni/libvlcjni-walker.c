@@ -0,0 +1,468 @@
+/*****************************************************************************
+ * libvlcjni-walker.c
+ *****************************************************************************
+ * Copyright © 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/*
+ * Recursive walk of the media directories for the media library scanner.
+ *
+ * The walk is depth first, like the Java one it replaces. The entries are
+ * read with readdir(), and only the media files, the links and the entries
+ * of unknown type are stat'ed: the extensions are filtered first, with a
+ * hash set built once per walk. The directories are identified by device
+ * and inode, so that the symbolic link cycles are only walked once.
+ *
+ * The results are packed in a direct buffer, as records of:
+ *   int32 kind, int32 name length, int64 size, int64 modification date in
+ *   ms, UTF-8 name (not terminated)
+ * A WALK_DIR record, with the full path of a directory, is followed by the
+ * records of its sub directories and media files, with their names only.
+ * A directory which modification date is the one given by the caller is
+ * not read: a WALK_DIR_UNCHANGED record is written instead, and the caller
+ * pushes back its sub directories, as it knows them.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <jni.h>
+
+#include "probe.h"
+
+#define LOG_TAG "VLC/JNI/walker"
+#include "log.h"
+
+/* Record kinds, see MediaWalker.java */
+#define WALK_DIR            0
+#define WALK_DIR_UNCHANGED  1
+#define WALK_SUBDIR         2
+#define WALK_VIDEO          3
+#define WALK_AUDIO          4
+
+#define RECORD_HEADER_SIZE  (4 + 4 + 8 + 8)
+#define RECORD_MAX_SIZE     (RECORD_HEADER_SIZE + PATH_MAX)
+
+#define EXT_MAX_LENGTH      16
+#define EXT_SLOTS           512     /// power of 2, > 2 * extensions
+
+/* Open addressing set of pairs of 64 bits keys, with a value */
+typedef struct
+{
+    struct
+    {
+        uint64_t a, b;
+        int64_t value;
+        bool used;
+    } *slots;
+    size_t size;                /// power of 2
+    size_t count;
+} pair_table_t;
+
+static size_t pair_hash(uint64_t a, uint64_t b)
+{
+    uint64_t h = (a ^ (b * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+    return (size_t)(h ^ (h >> 32));
+}
+
+static bool pair_table_init(pair_table_t *t, size_t count)
+{
+    t->size = 64;
+    while (t->size < 2 * count)
+        t->size *= 2;
+    t->count = 0;
+    t->slots = calloc(t->size, sizeof(*t->slots));
+    return t->slots != NULL;
+}
+
+static bool pair_table_find(const pair_table_t *t, uint64_t a, uint64_t b, int64_t *value)
+{
+    for (size_t i = pair_hash(a, b) & (t->size - 1); t->slots[i].used; i = (i + 1) & (t->size - 1))
+        if (t->slots[i].a == a && t->slots[i].b == b)
+        {
+            if (value != NULL)
+                *value = t->slots[i].value;
+            return true;
+        }
+    return false;
+}
+
+/* Add a pair, return false if it was already in the table or if out of
+ * memory */
+static bool pair_table_add(pair_table_t *t, uint64_t a, uint64_t b, int64_t value)
+{
+    if (pair_table_find(t, a, b, NULL))
+        return false;
+
+    if (2 * (t->count + 1) > t->size)
+    {
+        pair_table_t grown;
+        if (!pair_table_init(&grown, t->count + 1))
+            return false;
+        for (size_t i = 0; i < t->size; ++i)
+            if (t->slots[i].used)
+                pair_table_add(&grown, t->slots[i].a, t->slots[i].b, t->slots[i].value);
+        free(t->slots);
+        *t = grown;
+    }
+
+    size_t i = pair_hash(a, b) & (t->size - 1);
+    while (t->slots[i].used)
+        i = (i + 1) & (t->size - 1);
+    t->slots[i].a = a;
+    t->slots[i].b = b;
+    t->slots[i].value = value;
+    t->slots[i].used = true;
+    t->count++;
+    return true;
+}
+
+typedef struct
+{
+    /* Extensions, lower case with the dot, to record kinds */
+    struct
+    {
+        char ext[EXT_MAX_LENGTH];
+        int kind;
+    } exts[EXT_SLOTS];
+    char **blacklist;
+    unsigned blacklist_count;
+    /* Modification dates of the directories known by the caller, by path
+     * hash and length */
+    pair_table_t known;
+    /* Directories walked, by device and inode */
+    pair_table_t visited;
+
+    /* Directories to walk */
+    char **stack;
+    size_t stack_count;
+    size_t stack_size;
+
+    /* Directory being read */
+    DIR *dir;
+    char path[PATH_MAX];
+    size_t path_length;
+} walker_t;
+
+static unsigned ext_hash(const char *ext)
+{
+    return (unsigned)mrl_hash(ext) & (EXT_SLOTS - 1);
+}
+
+static void ext_add(walker_t *w, const char *ext, int kind)
+{
+    if (strlen(ext) >= EXT_MAX_LENGTH)
+        return;
+    unsigned i = ext_hash(ext);
+    while (w->exts[i].ext[0] != '\0')
+    {
+        if (!strcmp(w->exts[i].ext, ext))
+            return;
+        i = (i + 1) & (EXT_SLOTS - 1);
+    }
+    strcpy(w->exts[i].ext, ext);
+    w->exts[i].kind = kind;
+}
+
+/* Return the record kind of a file name, or -1 if it is not a media */
+static int ext_kind(const walker_t *w, const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    if (dot == NULL)
+        return -1;
+    char ext[EXT_MAX_LENGTH];
+    size_t i;
+    for (i = 0; dot[i] != '\0'; ++i)
+    {
+        if (i == EXT_MAX_LENGTH - 1)
+            return -1;
+        ext[i] = (dot[i] >= 'A' && dot[i] <= 'Z') ? dot[i] - 'A' + 'a' : dot[i];
+    }
+    ext[i] = '\0';
+
+    for (unsigned j = ext_hash(ext); w->exts[j].ext[0] != '\0'; j = (j + 1) & (EXT_SLOTS - 1))
+        if (!strcmp(w->exts[j].ext, ext))
+            return w->exts[j].kind;
+    return -1;
+}
+
+static bool is_blacklisted(const walker_t *w, const char *path)
+{
+    if (!strncmp(path, "/proc/", 6) || !strncmp(path, "/sys/", 5) || !strncmp(path, "/dev/", 5))
+        return true;
+    for (unsigned i = 0; i < w->blacklist_count; ++i)
+        if (!strcasecmp(path, w->blacklist[i]))
+            return true;
+    return false;
+}
+
+static bool push(walker_t *w, const char *path)
+{
+    if (w->stack_count == w->stack_size)
+    {
+        size_t size = w->stack_size ? 2 * w->stack_size : 64;
+        char **stack = realloc(w->stack, size * sizeof(*stack));
+        if (stack == NULL)
+            return false;
+        w->stack = stack;
+        w->stack_size = size;
+    }
+    char *copy = strdup(path);
+    if (copy == NULL)
+        return false;
+    w->stack[w->stack_count++] = copy;
+    return true;
+}
+
+static size_t write_record(char *buffer, int32_t kind, const char *name, size_t length,
+                           int64_t size, int64_t mtime)
+{
+    int32_t header[2] = { kind, length };
+    int64_t stat[2] = { size, mtime };
+    memcpy(buffer, header, sizeof(header));
+    memcpy(buffer + sizeof(header), stat, sizeof(stat));
+    memcpy(buffer + RECORD_HEADER_SIZE, name, length);
+    return RECORD_HEADER_SIZE + length;
+}
+
+/* Start walking the next directory of the stack. Return the size of its
+ * record, 0 if it is skipped. */
+static size_t open_next(walker_t *w, char *buffer)
+{
+    char *path = w->stack[--w->stack_count];
+    size_t length = strlen(path);
+    size_t ret = 0;
+    struct stat st;
+
+    /* The sub directories may be links */
+    if (length >= PATH_MAX || stat(path, &st) != 0 || !S_ISDIR(st.st_mode)
+     || !pair_table_add(&w->visited, st.st_dev, st.st_ino, 0))
+        goto end;
+
+    const int64_t mtime = (int64_t)st.st_mtime * 1000;
+    int64_t known;
+    if (pair_table_find(&w->known, mrl_hash(path), length, &known) && known == mtime)
+    {
+        ret = write_record(buffer, WALK_DIR_UNCHANGED, path, length, 0, mtime);
+        goto end;
+    }
+
+    /* Do not read the .nomedia folders, and do not report the ones that
+     * cannot be read: they are tried again by the next walk */
+    if (length + sizeof("/.nomedia") > PATH_MAX)
+        goto end;
+    memcpy(w->path, path, length);
+    strcpy(w->path + length, "/.nomedia");
+    bool nomedia = access(w->path, F_OK) == 0;
+    w->path[length] = '\0';
+    w->path_length = length;
+    if (!nomedia && (w->dir = opendir(path)) == NULL)
+        goto end;
+    ret = write_record(buffer, WALK_DIR, path, length, 0, mtime);
+end:
+    free(path);
+    return ret;
+}
+
+/* Read the next entry of the current directory. Return the size of its
+ * record, 0 if it is skipped. */
+static size_t read_next(walker_t *w, char *buffer)
+{
+    struct dirent *d = readdir(w->dir);
+    if (d == NULL) /* end of stream, or error reading the directory */
+    {
+        closedir(w->dir);
+        w->dir = NULL;
+        return 0;
+    }
+    /* Skip the hidden entries, like . and .. */
+    if (d->d_name[0] == '.')
+        return 0;
+
+    const size_t name_length = strlen(d->d_name);
+    if (w->path_length + 1 + name_length >= PATH_MAX)
+        return 0;
+
+    struct stat st;
+    bool has_stat = false;
+    unsigned char type = d->d_type;
+    if (type == DT_LNK || type == DT_UNKNOWN)
+    {
+        if (fstatat(dirfd(w->dir), d->d_name, &st, 0) != 0)
+            return 0;
+        has_stat = true;
+        type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+    }
+
+    if (type == DT_DIR)
+    {
+        char path[PATH_MAX];
+        memcpy(path, w->path, w->path_length);
+        path[w->path_length] = '/';
+        memcpy(path + w->path_length + 1, d->d_name, name_length + 1);
+        if (is_blacklisted(w, path) || !push(w, path))
+            return 0;
+        return write_record(buffer, WALK_SUBDIR, d->d_name, name_length, 0, 0);
+    }
+    if (type != DT_REG)
+        return 0;
+
+    int kind = ext_kind(w, d->d_name);
+    if (kind < 0)
+        return 0;
+    if (!has_stat && fstatat(dirfd(w->dir), d->d_name, &st, 0) != 0)
+        return 0;
+    return write_record(buffer, kind, d->d_name, name_length,
+                        st.st_size, (int64_t)st.st_mtime * 1000);
+}
+
+static void walker_release(walker_t *w)
+{
+    if (w->dir != NULL)
+        closedir(w->dir);
+    while (w->stack_count > 0)
+        free(w->stack[--w->stack_count]);
+    free(w->stack);
+    for (unsigned i = 0; i < w->blacklist_count; ++i)
+        free(w->blacklist[i]);
+    free(w->blacklist);
+    free(w->known.slots);
+    free(w->visited.slots);
+    free(w);
+}
+
+static void add_extensions(JNIEnv *env, walker_t *w, jobjectArray extensions, int kind)
+{
+    jsize count = (*env)->GetArrayLength(env, extensions);
+    for (jsize i = 0; i < count; ++i)
+    {
+        jstring ext = (*env)->GetObjectArrayElement(env, extensions, i);
+        const char *psz_ext = (*env)->GetStringUTFChars(env, ext, NULL);
+        ext_add(w, psz_ext, kind);
+        (*env)->ReleaseStringUTFChars(env, ext, psz_ext);
+        (*env)->DeleteLocalRef(env, ext);
+    }
+}
+
+jlong Java_org_videolan_libvlc_LibVLC_nativeWalkerNew(JNIEnv *env, jclass clazz,
+        jobjectArray roots, jobjectArray videoExtensions, jobjectArray audioExtensions,
+        jobjectArray blacklist, jobjectArray knownPaths, jlongArray knownDates)
+{
+    walker_t *w = calloc(1, sizeof(*w));
+    if (w == NULL)
+        return 0;
+
+    jsize known_count = knownPaths != NULL ? (*env)->GetArrayLength(env, knownPaths) : 0;
+    jsize blacklist_count = (*env)->GetArrayLength(env, blacklist);
+    w->blacklist = calloc(blacklist_count > 0 ? blacklist_count : 1, sizeof(*w->blacklist));
+    if (w->blacklist == NULL || !pair_table_init(&w->known, known_count)
+     || !pair_table_init(&w->visited, 1024))
+    {
+        walker_release(w);
+        return 0;
+    }
+
+    add_extensions(env, w, videoExtensions, WALK_VIDEO);
+    add_extensions(env, w, audioExtensions, WALK_AUDIO);
+
+    for (jsize i = 0; i < blacklist_count; ++i)
+    {
+        jstring path = (*env)->GetObjectArrayElement(env, blacklist, i);
+        const char *psz_path = (*env)->GetStringUTFChars(env, path, NULL);
+        if ((w->blacklist[w->blacklist_count] = strdup(psz_path)) != NULL)
+            w->blacklist_count++;
+        (*env)->ReleaseStringUTFChars(env, path, psz_path);
+        (*env)->DeleteLocalRef(env, path);
+    }
+
+    if (known_count > 0)
+    {
+        jlong *dates = (*env)->GetLongArrayElements(env, knownDates, NULL);
+        for (jsize i = 0; i < known_count; ++i)
+        {
+            jstring path = (*env)->GetObjectArrayElement(env, knownPaths, i);
+            const char *psz_path = (*env)->GetStringUTFChars(env, path, NULL);
+            pair_table_add(&w->known, mrl_hash(psz_path), strlen(psz_path), dates[i]);
+            (*env)->ReleaseStringUTFChars(env, path, psz_path);
+            (*env)->DeleteLocalRef(env, path);
+        }
+        (*env)->ReleaseLongArrayElements(env, knownDates, dates, JNI_ABORT);
+    }
+
+    /* The first root is walked first */
+    for (jsize i = (*env)->GetArrayLength(env, roots) - 1; i >= 0; --i)
+    {
+        jstring path = (*env)->GetObjectArrayElement(env, roots, i);
+        const char *psz_path = (*env)->GetStringUTFChars(env, path, NULL);
+        if (!is_blacklisted(w, psz_path))
+            push(w, psz_path);
+        (*env)->ReleaseStringUTFChars(env, path, psz_path);
+        (*env)->DeleteLocalRef(env, path);
+    }
+
+    return (jlong)(intptr_t)w;
+}
+
+void Java_org_videolan_libvlc_LibVLC_nativeWalkerPush(JNIEnv *env, jclass clazz,
+                                                      jlong handle, jstring path)
+{
+    walker_t *w = (walker_t *)(intptr_t)handle;
+    const char *psz_path = (*env)->GetStringUTFChars(env, path, NULL);
+    if (!is_blacklisted(w, psz_path))
+        push(w, psz_path);
+    (*env)->ReleaseStringUTFChars(env, path, psz_path);
+}
+
+jint Java_org_videolan_libvlc_LibVLC_nativeWalkerNext(JNIEnv *env, jclass clazz,
+                                                      jlong handle, jobject buffer)
+{
+    walker_t *w = (walker_t *)(intptr_t)handle;
+    char *data = (*env)->GetDirectBufferAddress(env, buffer);
+    jlong capacity = (*env)->GetDirectBufferCapacity(env, buffer);
+    if (data == NULL || capacity < RECORD_MAX_SIZE)
+    {
+        LOGE("The walker buffer is too small!");
+        return -1;
+    }
+
+    /* Fill the buffer while any record fits */
+    jlong size = 0;
+    while (capacity - size >= RECORD_MAX_SIZE)
+    {
+        if (w->dir != NULL)
+            size += read_next(w, data + size);
+        else if (w->stack_count > 0)
+            size += open_next(w, data + size);
+        else
+            break;
+    }
+    return size;
+}
+
+void Java_org_videolan_libvlc_LibVLC_nativeWalkerRelease(JNIEnv *env, jclass clazz,
+                                                         jlong handle)
+{
+    walker_release((walker_t *)(intptr_t)handle);
+}
@@ -0,0 +1,485 @@
+/*****************************************************************************
+ * libvlcjni-watcher.c
+ *****************************************************************************
+ * Copyright © 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/*
+ * Watch of the media directories with inotify, for the live updates of the
+ * media library.
+ *
+ * inotify is not recursive: each directory of the trees has its own watch,
+ * added when the watch starts or when the directory appears. The changes
+ * are gathered in a batch, where the last change of a path overrides the
+ * previous ones, and the batch is given to the Java callback once the trees
+ * are quiet for WATCH_QUIET ms, or WATCH_LATENCY ms after its first change.
+ * The thread sleeps in poll() the rest of the time.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vlc/vlc.h>
+
+#include <jni.h>
+
+#include "utils.h"
+
+#define LOG_TAG "VLC/JNI/watcher"
+#include "log.h"
+
+/* Changes, see LibVLC.java */
+#define WATCH_ADDED         0
+#define WATCH_REMOVED       1
+#define WATCH_DIR_ADDED     2
+#define WATCH_DIR_REMOVED   3
+#define WATCH_OVERFLOW      4
+
+#define WATCH_QUIET         300     /// ms
+#define WATCH_LATENCY       1000    /// ms
+/* Past this, the changes are reported as an overflow: a rescan is cheaper */
+#define WATCH_MAX_CHANGES   4096
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+                    | IN_ONLYDIR)
+
+typedef struct
+{
+    int wd;
+    char *path;
+} watch_t;
+
+typedef struct
+{
+    char *path;
+    int event;
+} change_t;
+
+typedef struct
+{
+    int fd;
+    int stop_pipe[2];
+    pthread_t thread;
+    jobject callback;
+
+    char **blacklist;
+    unsigned blacklist_count;
+
+    watch_t *watches;
+    size_t watch_count;
+    size_t watch_size;
+    bool watch_full;
+
+    change_t *changes;
+    size_t change_count;
+    int64_t first_change;
+    int64_t last_change;
+} watcher_t;
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool is_blacklisted(const watcher_t *w, const char *path)
+{
+    for (unsigned i = 0; i < w->blacklist_count; ++i)
+        if (!strcasecmp(path, w->blacklist[i]))
+            return true;
+    return false;
+}
+
+static watch_t *find_watch(watcher_t *w, int wd)
+{
+    for (size_t i = 0; i < w->watch_count; ++i)
+        if (w->watches[i].wd == wd)
+            return &w->watches[i];
+    return NULL;
+}
+
+static void remove_watch_at(watcher_t *w, size_t i)
+{
+    free(w->watches[i].path);
+    w->watches[i] = w->watches[--w->watch_count];
+}
+
+/* Stop watching a directory and its sub directories, after it was moved
+ * away */
+static void unwatch_tree(watcher_t *w, const char *path)
+{
+    size_t length = strlen(path);
+    for (size_t i = 0; i < w->watch_count; )
+    {
+        const char *p = w->watches[i].path;
+        if (!strncmp(p, path, length) && (p[length] == '\0' || p[length] == '/'))
+        {
+            inotify_rm_watch(w->fd, w->watches[i].wd);
+            remove_watch_at(w, i);
+        }
+        else
+            ++i;
+    }
+}
+
+/* Watch a directory and its sub directories, without following the links
+ * inside the trees */
+static void watch_tree(watcher_t *w, const char *path)
+{
+    int wd = inotify_add_watch(w->fd, path, WATCH_MASK);
+    if (wd < 0)
+    {
+        if (errno == ENOSPC && !w->watch_full)
+        {
+            LOGW("Too many directories to watch, some changes will be missed");
+            w->watch_full = true;
+        }
+        return;
+    }
+    /* Same inode as a watched directory */
+    if (find_watch(w, wd) != NULL)
+        return;
+
+    if (w->watch_count == w->watch_size)
+    {
+        size_t size = w->watch_size ? 2 * w->watch_size : 64;
+        watch_t *watches = realloc(w->watches, size * sizeof(*watches));
+        if (watches == NULL)
+            return;
+        w->watches = watches;
+        w->watch_size = size;
+    }
+    char *copy = strdup(path);
+    if (copy == NULL)
+        return;
+    w->watches[w->watch_count].wd = wd;
+    w->watches[w->watch_count].path = copy;
+    w->watch_count++;
+
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return;
+    size_t length = strlen(path);
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL)
+    {
+        if (d->d_name[0] == '.' || length + 1 + strlen(d->d_name) >= PATH_MAX)
+            continue;
+        char sub[PATH_MAX];
+        memcpy(sub, path, length);
+        sub[length] = '/';
+        strcpy(sub + length + 1, d->d_name);
+
+        if (d->d_type == DT_UNKNOWN)
+        {
+            struct stat st;
+            if (lstat(sub, &st) != 0 || !S_ISDIR(st.st_mode))
+                continue;
+        }
+        else if (d->d_type != DT_DIR)
+            continue;
+        if (!is_blacklisted(w, sub))
+            watch_tree(w, sub);
+    }
+    closedir(dir);
+}
+
+static void add_change(watcher_t *w, const char *path, int event)
+{
+    const int64_t now = now_ms();
+    if (w->change_count == 0)
+        w->first_change = now;
+    w->last_change = now;
+
+    if (w->change_count > 0 && w->changes[0].event == WATCH_OVERFLOW)
+        return;
+
+    /* The last change of a path overrides the previous ones */
+    for (size_t i = 0; i < w->change_count; ++i)
+        if (!strcmp(w->changes[i].path, path))
+        {
+            w->changes[i].event = event;
+            return;
+        }
+
+    char *copy;
+    if (event == WATCH_OVERFLOW || w->change_count == WATCH_MAX_CHANGES
+     || (copy = strdup(path)) == NULL)
+    {
+        /* Forget the batch, everything has to be scanned again */
+        for (size_t i = 0; i < w->change_count; ++i)
+            free(w->changes[i].path);
+        w->changes[0].path = strdup("");
+        w->changes[0].event = WATCH_OVERFLOW;
+        w->change_count = w->changes[0].path != NULL ? 1 : 0;
+        return;
+    }
+    w->changes[w->change_count].path = copy;
+    w->changes[w->change_count].event = event;
+    w->change_count++;
+}
+
+static void handle_event(watcher_t *w, const struct inotify_event *ev)
+{
+    if (ev->mask & IN_Q_OVERFLOW)
+    {
+        add_change(w, "", WATCH_OVERFLOW);
+        return;
+    }
+
+    watch_t *watch = find_watch(w, ev->wd);
+    if (watch == NULL)
+        return;
+    if (ev->mask & (IN_UNMOUNT | IN_IGNORED))
+    {
+        /* The directory was deleted without the event of its parent, or
+         * its file system unmounted: its changes are not seen anymore, and
+         * those of a file system mounted again later will not be either */
+        if (ev->mask & IN_IGNORED)
+            remove_watch_at(w, watch - w->watches);
+        add_change(w, "", WATCH_OVERFLOW);
+        return;
+    }
+    /* Skip the events of the directory itself, and the hidden entries,
+     * such as the temporary files of the downloads */
+    if (ev->len == 0 || ev->name[0] == '.' || ev->name[0] == '\0')
+        return;
+
+    char path[PATH_MAX];
+    size_t length = strlen(watch->path);
+    if (length + 1 + strlen(ev->name) >= PATH_MAX)
+        return;
+    memcpy(path, watch->path, length);
+    path[length] = '/';
+    strcpy(path + length + 1, ev->name);
+
+    if (ev->mask & IN_ISDIR)
+    {
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+        {
+            if (is_blacklisted(w, path))
+                return;
+            watch_tree(w, path);
+            add_change(w, path, WATCH_DIR_ADDED);
+        }
+        else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+            unwatch_tree(w, path);
+            add_change(w, path, WATCH_DIR_REMOVED);
+        }
+    }
+    /* The created files are reported once written */
+    else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+        add_change(w, path, WATCH_ADDED);
+    else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+        add_change(w, path, WATCH_REMOVED);
+}
+
+static void flush_changes(JNIEnv *env, watcher_t *w)
+{
+    jobjectArray paths = (*env)->NewObjectArray(env, w->change_count,
+                                                fields.String.clazz, NULL);
+    jintArray events = (*env)->NewIntArray(env, w->change_count);
+    if (paths != NULL && events != NULL)
+    {
+        for (size_t i = 0; i < w->change_count; ++i)
+        {
+            jstring path = (*env)->NewStringUTF(env, w->changes[i].path);
+            (*env)->SetObjectArrayElement(env, paths, i, path);
+            (*env)->DeleteLocalRef(env, path);
+            jint event = w->changes[i].event;
+            (*env)->SetIntArrayRegion(env, events, i, 1, &event);
+        }
+        (*env)->CallVoidMethod(env, w->callback, fields.WatchCallback.onChangesID,
+                               paths, events);
+        if ((*env)->ExceptionCheck(env))
+        {
+            (*env)->ExceptionDescribe(env);
+            (*env)->ExceptionClear(env);
+        }
+    }
+    if (paths != NULL)
+        (*env)->DeleteLocalRef(env, paths);
+    if (events != NULL)
+        (*env)->DeleteLocalRef(env, events);
+
+    for (size_t i = 0; i < w->change_count; ++i)
+        free(w->changes[i].path);
+    w->change_count = 0;
+}
+
+static void *watcher_thread(void *data)
+{
+    watcher_t *w = data;
+    JNIEnv *env = jni_get_env("MediaWatcher");
+    if (env == NULL)
+        return NULL;
+
+    /* inotify_event is followed by its name */
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;)
+    {
+        int timeout = -1;
+        if (w->change_count > 0)
+        {
+            int64_t deadline = w->last_change + WATCH_QUIET;
+            if (deadline > w->first_change + WATCH_LATENCY)
+                deadline = w->first_change + WATCH_LATENCY;
+            int64_t delay = deadline - now_ms();
+            if (delay <= 0)
+            {
+                flush_changes(env, w);
+                continue;
+            }
+            timeout = delay;
+        }
+
+        struct pollfd fds[2] = {
+            { .fd = w->fd, .events = POLLIN },
+            { .fd = w->stop_pipe[0], .events = POLLIN },
+        };
+        if (poll(fds, 2, timeout) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOGE("Could not poll the media watches");
+            break;
+        }
+        if (fds[1].revents)
+            break;
+        if (!fds[0].revents)
+            continue;
+
+        ssize_t size;
+        while ((size = read(w->fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (char *p = buffer; p < buffer + size; )
+            {
+                const struct inotify_event *ev = (const struct inotify_event *)p;
+                handle_event(w, ev);
+                p += sizeof(*ev) + ev->len;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void watcher_release(JNIEnv *env, watcher_t *w)
+{
+    if (w->fd >= 0)
+        close(w->fd);
+    if (w->stop_pipe[0] >= 0)
+    {
+        close(w->stop_pipe[0]);
+        close(w->stop_pipe[1]);
+    }
+    for (size_t i = 0; i < w->watch_count; ++i)
+        free(w->watches[i].path);
+    free(w->watches);
+    for (size_t i = 0; i < w->change_count; ++i)
+        free(w->changes[i].path);
+    free(w->changes);
+    for (unsigned i = 0; i < w->blacklist_count; ++i)
+        free(w->blacklist[i]);
+    free(w->blacklist);
+    if (w->callback != NULL)
+        (*env)->DeleteGlobalRef(env, w->callback);
+    free(w);
+}
+
+jlong Java_org_videolan_libvlc_LibVLC_nativeWatcherStart(JNIEnv *env, jclass clazz,
+        jobjectArray dirs, jobjectArray blacklist, jobject callback)
+{
+    watcher_t *w = calloc(1, sizeof(*w));
+    if (w == NULL)
+        return 0;
+    w->stop_pipe[0] = w->stop_pipe[1] = -1;
+
+    jsize blacklist_count = (*env)->GetArrayLength(env, blacklist);
+    w->fd = inotify_init();
+    w->blacklist = calloc(blacklist_count > 0 ? blacklist_count : 1, sizeof(*w->blacklist));
+    w->changes = malloc(WATCH_MAX_CHANGES * sizeof(*w->changes));
+    w->callback = (*env)->NewGlobalRef(env, callback);
+    if (w->fd < 0 || w->blacklist == NULL || w->changes == NULL || w->callback == NULL
+     || pipe(w->stop_pipe) != 0)
+    {
+        LOGE("Could not create the media watcher");
+        watcher_release(env, w);
+        return 0;
+    }
+    fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) | O_NONBLOCK);
+    fcntl(w->fd, F_SETFD, FD_CLOEXEC);
+    fcntl(w->stop_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(w->stop_pipe[1], F_SETFD, FD_CLOEXEC);
+
+    for (jsize i = 0; i < blacklist_count; ++i)
+    {
+        jstring path = (*env)->GetObjectArrayElement(env, blacklist, i);
+        const char *psz_path = (*env)->GetStringUTFChars(env, path, NULL);
+        if ((w->blacklist[w->blacklist_count] = strdup(psz_path)) != NULL)
+            w->blacklist_count++;
+        (*env)->ReleaseStringUTFChars(env, path, psz_path);
+        (*env)->DeleteLocalRef(env, path);
+    }
+
+    int64_t start = now_ms();
+    jsize count = (*env)->GetArrayLength(env, dirs);
+    for (jsize i = 0; i < count; ++i)
+    {
+        jstring path = (*env)->GetObjectArrayElement(env, dirs, i);
+        const char *psz_path = (*env)->GetStringUTFChars(env, path, NULL);
+        if (strlen(psz_path) < PATH_MAX)
+            watch_tree(w, psz_path);
+        (*env)->ReleaseStringUTFChars(env, path, psz_path);
+        (*env)->DeleteLocalRef(env, path);
+    }
+    LOGD("Watching %zu directories, set up in %lld ms", w->watch_count,
+         (long long)(now_ms() - start));
+
+    if (pthread_create(&w->thread, NULL, watcher_thread, w) != 0)
+    {
+        watcher_release(env, w);
+        return 0;
+    }
+    return (jlong)(intptr_t)w;
+}
+
+void Java_org_videolan_libvlc_LibVLC_nativeWatcherStop(JNIEnv *env, jclass clazz,
+                                                       jlong handle)
+{
+    watcher_t *w = (watcher_t *)(intptr_t)handle;
+    /* Wake up the thread, it may be in the callback: the pending changes
+     * are dropped */
+    char c = 0;
+    while (write(w->stop_pipe[1], &c, 1) < 0 && errno == EINTR);
+    pthread_join(w->thread, NULL);
+    watcher_release(env, w);
+}
@@ -24,6 +24,7 @@
 #include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <vlc/vlc.h>
@@ -37,6 +38,9 @@
 #include "libvlcjni.h"
 #include "aout.h"
 #include "vout.h"
+#include "events.h"
+#include "mpool.h"
+#include "probe.h"
 #include "utils.h"
 #include "native_crash_handler.h"
 
@@ -67,9 +71,7 @@ libvlc_media_t *new_media(jlong instance, JNIEnv *env, jobject thiz, jstring fil
         return NULL;
 
     if (!noOmx) {
-        jclass cls = (*env)->GetObjectClass(env, thiz);
-        jmethodID methodId = (*env)->GetMethodID(env, cls, "getHardwareAcceleration", "()I");
-        int hardwareAcceleration = (*env)->CallIntMethod(env, thiz, methodId);
+        int hardwareAcceleration = (*env)->CallIntMethod(env, thiz, fields.LibVLC.getHardwareAccelerationID);
         if (hardwareAcceleration == HW_ACCELERATION_DECODING || hardwareAcceleration == HW_ACCELERATION_FULL) {
             /*
              * Set higher caching values if using iomx decoding, since some omx
@@ -92,18 +94,64 @@ libvlc_media_t *new_media(jlong instance, JNIEnv *env, jobject thiz, jstring fil
 
 libvlc_media_player_t *getMediaPlayer(JNIEnv *env, jobject thiz)
 {
-    return (libvlc_media_player_t*)(intptr_t)getLong(env, thiz, "mInternalMediaPlayerInstance");
+    return (libvlc_media_player_t*)(intptr_t)(*env)->GetLongField(env, thiz,
+                                        fields.LibVLC.mInternalMediaPlayerInstanceID);
 }
 
+/* Audio output type of the current media player */
+static int mp_aout = -1;
+
 static void releaseMediaPlayer(JNIEnv *env, jobject thiz)
 {
     libvlc_media_player_t* p_mp = getMediaPlayer(env, thiz);
     if (p_mp)
     {
-        libvlc_media_player_stop(p_mp);
-        libvlc_media_player_release(p_mp);
-        setLong(env, thiz, "mInternalMediaPlayerInstance", 0);
+        libvlc_instance_t *p_instance = (libvlc_instance_t*)(intptr_t)
+            (*env)->GetLongField(env, thiz, fields.LibVLC.mLibVlcInstanceID);
+        mp_pool_put(p_instance, p_mp, MP_ROLE_PLAYBACK, mp_aout);
+        (*env)->SetLongField(env, thiz, fields.LibVLC.mInternalMediaPlayerInstanceID, 0);
     }
+    aout_release_parked();
+}
+
+/* Next media of the playlist, created and parsed ahead by preloadMRL */
+static struct
+{
+    pthread_mutex_t lock;
+    libvlc_media_t *media;
+    char *mrl;
+} preload = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+/* Track switches, from playMRL to the Playing event of the new media.
+ * Written by the JNI and the libvlc event threads: 64-bit accesses are not
+ * atomic on ARMv5/v7, so only use the __sync builtins on them. */
+static int64_t switch_start = 0; /// in µs, 0 if no switch pending
+static int64_t switch_latency = -1;
+
+static inline void store_int64(int64_t *p, int64_t value)
+{
+    int64_t old = __sync_fetch_and_add(p, 0);
+    while (!__sync_bool_compare_and_swap(p, old, value))
+        old = __sync_fetch_and_add(p, 0);
+}
+
+static int64_t monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void release_preload(void)
+{
+    if (preload.media)
+        libvlc_media_release(preload.media);
+    free(preload.mrl);
+    preload.media = NULL;
+    preload.mrl = NULL;
 }
 
 /* Pointer to the Java virtual machine
@@ -112,53 +160,104 @@ static void releaseMediaPlayer(JNIEnv *env, jobject thiz)
  */
 JavaVM *myVm;
 
+struct fields fields;
+
+/* Native threads calling into Java are attached once, and detached by the
+ * destructor of this key when they exit. */
+static pthread_key_t jni_env_key;
+static unsigned jni_attach_count = 0;
+static unsigned jni_detach_count = 0;
+
+static void jni_detach_thread(void *data)
+{
+    __sync_fetch_and_add(&jni_detach_count, 1);
+    (*myVm)->DetachCurrentThread(myVm);
+}
+
+JNIEnv *jni_get_env(const char *name)
+{
+    JNIEnv *env = pthread_getspecific(jni_env_key);
+    if (env != NULL)
+        return env;
+
+    /* Java threads, or threads attached by someone else */
+    if ((*myVm)->GetEnv(myVm, (void**) &env, JNI_VERSION_1_2) == JNI_OK)
+        return env;
+
+    JavaVMAttachArgs args = {
+        .version = JNI_VERSION_1_2,
+        .name = (char *) name,
+        .group = NULL,
+    };
+    if ((*myVm)->AttachCurrentThread(myVm, &env, &args) != JNI_OK)
+    {
+        LOGE("Could not attach the %s thread to the JVM", name);
+        return NULL;
+    }
+    if (pthread_setspecific(jni_env_key, env) != 0)
+    {
+        (*myVm)->DetachCurrentThread(myVm);
+        return NULL;
+    }
+    __sync_fetch_and_add(&jni_attach_count, 1);
+    return env;
+}
+
+void Java_org_videolan_libvlc_LibVLC_nativeGetAttachStats(JNIEnv *env, jobject thiz, jintArray stats)
+{
+    jint values[2] = {
+        __sync_fetch_and_add(&jni_attach_count, 0),
+        __sync_fetch_and_add(&jni_detach_count, 0),
+    };
+    (*env)->SetIntArrayRegion(env, stats, 0, 2, values);
+}
+
 static jobject eventHandlerInstance = NULL;
 
 static void vlc_event_callback(const libvlc_event_t *ev, void *data)
 {
-    JNIEnv *env;
+    if (ev->type == libvlc_MediaPlayerPlaying)
+    {
+        /* Take the pending switch, if any */
+        int64_t start = __sync_fetch_and_and(&switch_start, 0);
+        if (start != 0)
+            store_int64(&switch_latency, monotonic_us() - start);
+    }
 
-    bool isAttached = false;
+    if (eventHandlerInstance == NULL || !events_filter(ev))
+        return;
 
-    if (eventHandlerInstance == NULL)
+    /* Most events are delivered in batches by the EventHandler thread */
+    if (events_queue_push(ev))
         return;
 
-    if ((*myVm)->GetEnv(myVm, (void**) &env, JNI_VERSION_1_2) < 0) {
-        if ((*myVm)->AttachCurrentThread(myVm, &env, NULL) < 0)
-            return;
-        isAttached = true;
-    }
+    JNIEnv *env = jni_get_env("jni_event");
+    if (env == NULL)
+        return;
 
     /* Creating the bundle in C allows us to subscribe to more events
      * and get better flexibility for each event. For example, we can
      * have totally different types of data for each event, instead of,
      * for example, only an integer and/or string.
      */
-    jclass clsBundle = (*env)->FindClass(env, "android/os/Bundle");
-    jmethodID clsCtor = (*env)->GetMethodID(env, clsBundle, "<init>", "()V" );
-    jobject bundle = (*env)->NewObject(env, clsBundle, clsCtor);
-
-    jmethodID putInt = (*env)->GetMethodID(env, clsBundle, "putInt", "(Ljava/lang/String;I)V" );
-    jmethodID putFloat = (*env)->GetMethodID(env, clsBundle, "putFloat", "(Ljava/lang/String;F)V" );
-    jmethodID putString = (*env)->GetMethodID(env, clsBundle, "putString", "(Ljava/lang/String;Ljava/lang/String;)V" );
+    jobject bundle = (*env)->NewObject(env, fields.Bundle.clazz, fields.Bundle.ctorID);
+    if (!bundle) {
+        LOGE("EventHandler: failed to create the bundle");
+        return;
+    }
 
     if (ev->type == libvlc_MediaPlayerPositionChanged) {
-        jstring sData = (*env)->NewStringUTF(env, "data");
-        (*env)->CallVoidMethod(env, bundle, putFloat, sData, ev->u.media_player_position_changed.new_position);
-        (*env)->DeleteLocalRef(env, sData);
+        (*env)->CallVoidMethod(env, bundle, fields.Bundle.putFloatID, fields.dataKey,
+                               ev->u.media_player_position_changed.new_position);
     } else if (ev->type == libvlc_MediaPlayerTimeChanged) {
-        jstring sData = (*env)->NewStringUTF(env, "data");
-        (*env)->CallVoidMethod(env, bundle, putInt, sData, (int) ev->u.media_player_time_changed.new_time);
-        (*env)->DeleteLocalRef(env, sData);
+        (*env)->CallVoidMethod(env, bundle, fields.Bundle.putIntID, fields.dataKey,
+                               (int) ev->u.media_player_time_changed.new_time);
     } else if(ev->type == libvlc_MediaPlayerVout) {
         /* For determining the vout/ES track change */
-        jstring sData = (*env)->NewStringUTF(env, "data");
-        (*env)->CallVoidMethod(env, bundle, putInt, sData, ev->u.media_player_vout.new_count);
-        (*env)->DeleteLocalRef(env, sData);
+        (*env)->CallVoidMethod(env, bundle, fields.Bundle.putIntID, fields.dataKey,
+                               ev->u.media_player_vout.new_count);
     } else if(ev->type == libvlc_MediaListItemAdded ||
               ev->type == libvlc_MediaListItemDeleted ) {
-        jstring item_uri = (*env)->NewStringUTF(env, "item_uri");
-        jstring item_index = (*env)->NewStringUTF(env, "item_index");
         char* mrl = libvlc_media_get_mrl(
             ev->type == libvlc_MediaListItemAdded ?
             ev->u.media_list_item_added.item :
@@ -171,41 +270,204 @@ static void vlc_event_callback(const libvlc_event_t *ev, void *data)
         else
             item_index_value = ev->u.media_list_item_deleted.index;
 
-        (*env)->CallVoidMethod(env, bundle, putString, item_uri, item_uri_value);
-        (*env)->CallVoidMethod(env, bundle, putInt, item_index, item_index_value);
+        (*env)->CallVoidMethod(env, bundle, fields.Bundle.putStringID, fields.itemUriKey, item_uri_value);
+        (*env)->CallVoidMethod(env, bundle, fields.Bundle.putIntID, fields.itemIndexKey, item_index_value);
 
-        (*env)->DeleteLocalRef(env, item_uri);
         (*env)->DeleteLocalRef(env, item_uri_value);
-        (*env)->DeleteLocalRef(env, item_index);
         free(mrl);
     }
 
-    /* Get the object class */
-    jclass cls = (*env)->GetObjectClass(env, eventHandlerInstance);
-    if (!cls) {
-        LOGE("EventHandler: failed to get class reference");
-        goto end;
-    }
+    (*env)->CallVoidMethod(env, eventHandlerInstance, fields.EventHandler.callbackID, ev->type, bundle);
+    (*env)->DeleteLocalRef(env, bundle);
+}
 
-    /* Find the callback ID */
-    jmethodID methodID = (*env)->GetMethodID(env, cls, "callback", "(ILandroid/os/Bundle;)V");
-    if (methodID) {
-        (*env)->CallVoidMethod(env, eventHandlerInstance, methodID, ev->type, bundle);
-    } else {
-        LOGE("EventHandler: failed to get the callback method");
-    }
+#define GET_CLASS(clazz, str) do { \
+    jclass local = (*env)->FindClass(env, (str)); \
+    if (!local) { \
+        LOGE("FindClass(%s) failed", (str)); \
+        return -1; \
+    } \
+    (clazz) = (jclass) (*env)->NewGlobalRef(env, local); \
+    (*env)->DeleteLocalRef(env, local); \
+    if (!(clazz)) \
+        return -1; \
+} while (0)
+
+#define GET_ID(get, id, clazz, str, args) do { \
+    (id) = (*env)->get(env, (clazz), (str), (args)); \
+    if (!(id)) { \
+        LOGE(#get"(%s) failed", (str)); \
+        return -1; \
+    } \
+} while (0)
+
+#define GET_STRING(jstr, str) do { \
+    jstring local = (*env)->NewStringUTF(env, (str)); \
+    if (!local) \
+        return -1; \
+    (jstr) = (jstring) (*env)->NewGlobalRef(env, local); \
+    (*env)->DeleteLocalRef(env, local); \
+    if (!(jstr)) \
+        return -1; \
+} while (0)
+
+static int init_fields(JNIEnv *env)
+{
+    GET_CLASS(fields.LibVLC.clazz, "org/videolan/libvlc/LibVLC");
+    GET_ID(GetFieldID, fields.LibVLC.mLibVlcInstanceID,
+           fields.LibVLC.clazz, "mLibVlcInstance", "J");
+    GET_ID(GetFieldID, fields.LibVLC.mInternalMediaPlayerInstanceID,
+           fields.LibVLC.clazz, "mInternalMediaPlayerInstance", "J");
+    GET_ID(GetMethodID, fields.LibVLC.getAoutID,
+           fields.LibVLC.clazz, "getAout", "()I");
+    GET_ID(GetMethodID, fields.LibVLC.getVoutID,
+           fields.LibVLC.clazz, "getVout", "()I");
+    GET_ID(GetMethodID, fields.LibVLC.timeStretchingEnabledID,
+           fields.LibVLC.clazz, "timeStretchingEnabled", "()Z");
+    GET_ID(GetMethodID, fields.LibVLC.frameSkipEnabledID,
+           fields.LibVLC.clazz, "frameSkipEnabled", "()Z");
+    GET_ID(GetMethodID, fields.LibVLC.getDeblockingID,
+           fields.LibVLC.clazz, "getDeblocking", "()I");
+    GET_ID(GetMethodID, fields.LibVLC.getNetworkCachingID,
+           fields.LibVLC.clazz, "getNetworkCaching", "()I");
+    GET_ID(GetMethodID, fields.LibVLC.getChromaID,
+           fields.LibVLC.clazz, "getChroma", "()Ljava/lang/String;");
+    GET_ID(GetMethodID, fields.LibVLC.getSubtitlesEncodingID,
+           fields.LibVLC.clazz, "getSubtitlesEncoding", "()Ljava/lang/String;");
+    GET_ID(GetMethodID, fields.LibVLC.isVerboseModeID,
+           fields.LibVLC.clazz, "isVerboseMode", "()Z");
+    GET_ID(GetMethodID, fields.LibVLC.getCachePathID,
+           fields.LibVLC.clazz, "getCachePath", "()Ljava/lang/String;");
+    GET_ID(GetMethodID, fields.LibVLC.getHardwareAccelerationID,
+           fields.LibVLC.clazz, "getHardwareAcceleration", "()I");
+    GET_ID(GetMethodID, fields.LibVLC.applyEqualizerID,
+           fields.LibVLC.clazz, "applyEqualizer", "()V");
+    GET_ID(GetMethodID, fields.LibVLC.initAoutID,
+           fields.LibVLC.clazz, "initAout", "(IIIZ)V");
+    GET_ID(GetMethodID, fields.LibVLC.isAoutFormatSupportedID,
+           fields.LibVLC.clazz, "isAoutFormatSupported", "(IIZ)Z");
+    GET_ID(GetMethodID, fields.LibVLC.playAudioID,
+           fields.LibVLC.clazz, "playAudio", "([BI)V");
+    GET_ID(GetMethodID, fields.LibVLC.useDirectAudioBuffersID,
+           fields.LibVLC.clazz, "useDirectAudioBuffers", "()Z");
+    GET_ID(GetMethodID, fields.LibVLC.playAudioDirectID,
+           fields.LibVLC.clazz, "playAudioDirect", "(Ljava/nio/ByteBuffer;I)V");
+    GET_ID(GetMethodID, fields.LibVLC.getAudioLatencyID,
+           fields.LibVLC.clazz, "getAudioLatency", "()I");
+    GET_ID(GetMethodID, fields.LibVLC.pauseAoutID,
+           fields.LibVLC.clazz, "pauseAout", "()V");
+    GET_ID(GetMethodID, fields.LibVLC.closeAoutID,
+           fields.LibVLC.clazz, "closeAout", "()V");
+    GET_ID(GetMethodID, fields.LibVLC.onNativeCrashID,
+           fields.LibVLC.clazz, "onNativeCrash", "()V");
+
+    GET_CLASS(fields.EventHandler.clazz, "org/videolan/libvlc/EventHandler");
+    GET_ID(GetMethodID, fields.EventHandler.callbackID,
+           fields.EventHandler.clazz, "callback", "(ILandroid/os/Bundle;)V");
+
+    GET_CLASS(fields.IVideoPlayer.clazz, "org/videolan/libvlc/IVideoPlayer");
+    GET_ID(GetMethodID, fields.IVideoPlayer.setSurfaceSizeID,
+           fields.IVideoPlayer.clazz, "setSurfaceSize", "(IIIIII)V");
+
+    GET_CLASS(fields.ThumbnailCallback.clazz, "org/videolan/libvlc/LibVLC$ThumbnailCallback");
+    GET_ID(GetMethodID, fields.ThumbnailCallback.onThumbnailID,
+           fields.ThumbnailCallback.clazz, "onThumbnail", "(ILjava/nio/ByteBuffer;J)Z");
+
+    GET_CLASS(fields.ParseCallback.clazz, "org/videolan/libvlc/LibVLC$ParseCallback");
+    GET_ID(GetMethodID, fields.ParseCallback.onParsedID,
+           fields.ParseCallback.clazz, "onParsed", "(I[Lorg/videolan/libvlc/TrackInfo;)V");
+
+    GET_CLASS(fields.WatchCallback.clazz, "org/videolan/libvlc/LibVLC$WatchCallback");
+    GET_ID(GetMethodID, fields.WatchCallback.onChangesID,
+           fields.WatchCallback.clazz, "onChanges", "([Ljava/lang/String;[I)V");
+
+    GET_CLASS(fields.TrackInfo.clazz, "org/videolan/libvlc/TrackInfo");
+    GET_ID(GetMethodID, fields.TrackInfo.ctorID,
+           fields.TrackInfo.clazz, "<init>", "()V");
+    GET_ID(GetFieldID, fields.TrackInfo.TypeID,
+           fields.TrackInfo.clazz, "Type", "I");
+    GET_ID(GetFieldID, fields.TrackInfo.IdID,
+           fields.TrackInfo.clazz, "Id", "I");
+    GET_ID(GetFieldID, fields.TrackInfo.CodecID,
+           fields.TrackInfo.clazz, "Codec", "Ljava/lang/String;");
+    GET_ID(GetFieldID, fields.TrackInfo.LanguageID,
+           fields.TrackInfo.clazz, "Language", "Ljava/lang/String;");
+    GET_ID(GetFieldID, fields.TrackInfo.BitrateID,
+           fields.TrackInfo.clazz, "Bitrate", "I");
+    GET_ID(GetFieldID, fields.TrackInfo.HeightID,
+           fields.TrackInfo.clazz, "Height", "I");
+    GET_ID(GetFieldID, fields.TrackInfo.WidthID,
+           fields.TrackInfo.clazz, "Width", "I");
+    GET_ID(GetFieldID, fields.TrackInfo.FramerateID,
+           fields.TrackInfo.clazz, "Framerate", "F");
+    GET_ID(GetFieldID, fields.TrackInfo.ChannelsID,
+           fields.TrackInfo.clazz, "Channels", "I");
+    GET_ID(GetFieldID, fields.TrackInfo.SamplerateID,
+           fields.TrackInfo.clazz, "Samplerate", "I");
+    GET_ID(GetFieldID, fields.TrackInfo.LengthID,
+           fields.TrackInfo.clazz, "Length", "J");
+    GET_ID(GetFieldID, fields.TrackInfo.TitleID,
+           fields.TrackInfo.clazz, "Title", "Ljava/lang/String;");
+    GET_ID(GetFieldID, fields.TrackInfo.ArtistID,
+           fields.TrackInfo.clazz, "Artist", "Ljava/lang/String;");
+    GET_ID(GetFieldID, fields.TrackInfo.AlbumID,
+           fields.TrackInfo.clazz, "Album", "Ljava/lang/String;");
+    GET_ID(GetFieldID, fields.TrackInfo.GenreID,
+           fields.TrackInfo.clazz, "Genre", "Ljava/lang/String;");
+    GET_ID(GetFieldID, fields.TrackInfo.ArtworkURLID,
+           fields.TrackInfo.clazz, "ArtworkURL", "Ljava/lang/String;");
+
+    GET_CLASS(fields.Bundle.clazz, "android/os/Bundle");
+    GET_ID(GetMethodID, fields.Bundle.ctorID,
+           fields.Bundle.clazz, "<init>", "()V");
+    GET_ID(GetMethodID, fields.Bundle.putIntID,
+           fields.Bundle.clazz, "putInt", "(Ljava/lang/String;I)V");
+    GET_ID(GetMethodID, fields.Bundle.putFloatID,
+           fields.Bundle.clazz, "putFloat", "(Ljava/lang/String;F)V");
+    GET_ID(GetMethodID, fields.Bundle.putStringID,
+           fields.Bundle.clazz, "putString", "(Ljava/lang/String;Ljava/lang/String;)V");
+
+    GET_CLASS(fields.StringBuffer.clazz, "java/lang/StringBuffer");
+    GET_ID(GetMethodID, fields.StringBuffer.appendID,
+           fields.StringBuffer.clazz, "append", "(Ljava/lang/String;)Ljava/lang/StringBuffer;");
+
+    GET_CLASS(fields.ArrayList.clazz, "java/util/ArrayList");
+    GET_ID(GetMethodID, fields.ArrayList.addID,
+           fields.ArrayList.clazz, "add", "(Ljava/lang/Object;)Z");
+    GET_ID(GetMethodID, fields.ArrayList.removeID,
+           fields.ArrayList.clazz, "remove", "(I)Ljava/lang/Object;");
+
+    GET_CLASS(fields.String.clazz, "java/lang/String");
+
+    GET_STRING(fields.dataKey, "data");
+    GET_STRING(fields.itemUriKey, "item_uri");
+    GET_STRING(fields.itemIndexKey, "item_index");
 
-end:
-    (*env)->DeleteLocalRef(env, bundle);
-    if (isAttached)
-        (*myVm)->DetachCurrentThread(myVm);
+    return 0;
 }
 
+#undef GET_CLASS
+#undef GET_ID
+#undef GET_STRING
+
 jint JNI_OnLoad(JavaVM *vm, void *reserved)
 {
+    JNIEnv *env;
+
     // Keep a reference on the Java VM.
     myVm = vm;
 
+    if ((*vm)->GetEnv(vm, (void**) &env, JNI_VERSION_1_2) != JNI_OK)
+        return -1;
+
+    if (init_fields(env) != 0) {
+        LOGE("Unable to look up the JNI classes, fields and methods");
+        return -1;
+    }
+
+    if (pthread_key_create(&jni_env_key, jni_detach_thread) != 0)
+        return -1;
+
     pthread_mutex_init(&vout_android_lock, NULL);
     pthread_cond_init(&vout_android_surf_attached, NULL);
 
@@ -214,8 +476,29 @@ jint JNI_OnLoad(JavaVM *vm, void *reserved)
 }
 
 void JNI_OnUnload(JavaVM* vm, void* reserved) {
+    JNIEnv *env;
+
     pthread_mutex_destroy(&vout_android_lock);
     pthread_cond_destroy(&vout_android_surf_attached);
+    pthread_key_delete(jni_env_key);
+
+    if ((*vm)->GetEnv(vm, (void**) &env, JNI_VERSION_1_2) != JNI_OK)
+        return;
+
+    (*env)->DeleteGlobalRef(env, fields.LibVLC.clazz);
+    (*env)->DeleteGlobalRef(env, fields.EventHandler.clazz);
+    (*env)->DeleteGlobalRef(env, fields.IVideoPlayer.clazz);
+    (*env)->DeleteGlobalRef(env, fields.ThumbnailCallback.clazz);
+    (*env)->DeleteGlobalRef(env, fields.ParseCallback.clazz);
+    (*env)->DeleteGlobalRef(env, fields.WatchCallback.clazz);
+    (*env)->DeleteGlobalRef(env, fields.TrackInfo.clazz);
+    (*env)->DeleteGlobalRef(env, fields.Bundle.clazz);
+    (*env)->DeleteGlobalRef(env, fields.StringBuffer.clazz);
+    (*env)->DeleteGlobalRef(env, fields.ArrayList.clazz);
+    (*env)->DeleteGlobalRef(env, fields.String.clazz);
+    (*env)->DeleteGlobalRef(env, fields.dataKey);
+    (*env)->DeleteGlobalRef(env, fields.itemUriKey);
+    (*env)->DeleteGlobalRef(env, fields.itemIndexKey);
 }
 
 // FIXME: use atomics
@@ -224,54 +507,42 @@ static bool verbosity;
 void Java_org_videolan_libvlc_LibVLC_nativeInit(JNIEnv *env, jobject thiz)
 {
     //only use OpenSLES if java side says we can
-    jclass cls = (*env)->GetObjectClass(env, thiz);
-    jmethodID methodId = (*env)->GetMethodID(env, cls, "getAout", "()I");
-    bool use_opensles = (*env)->CallIntMethod(env, thiz, methodId) == AOUT_OPENSLES;
+    bool use_opensles = (*env)->CallIntMethod(env, thiz, fields.LibVLC.getAoutID) == AOUT_OPENSLES;
 
-    methodId = (*env)->GetMethodID(env, cls, "getVout", "()I");
-    bool use_opengles2 = (*env)->CallIntMethod(env, thiz, methodId) == VOUT_OPENGLES2;
+    bool use_opengles2 = (*env)->CallIntMethod(env, thiz, fields.LibVLC.getVoutID) == VOUT_OPENGLES2;
 
-    methodId = (*env)->GetMethodID(env, cls, "timeStretchingEnabled", "()Z");
-    bool enable_time_stretch = (*env)->CallBooleanMethod(env, thiz, methodId);
+    bool enable_time_stretch = (*env)->CallBooleanMethod(env, thiz, fields.LibVLC.timeStretchingEnabledID);
 
-    methodId = (*env)->GetMethodID(env, cls, "frameSkipEnabled", "()Z");
-    bool enable_frame_skip = (*env)->CallBooleanMethod(env, thiz, methodId);
+    bool enable_frame_skip = (*env)->CallBooleanMethod(env, thiz, fields.LibVLC.frameSkipEnabledID);
 
-    methodId = (*env)->GetMethodID(env, cls, "getDeblocking", "()I");
-    int deblocking = (*env)->CallIntMethod(env, thiz, methodId);
+    int deblocking = (*env)->CallIntMethod(env, thiz, fields.LibVLC.getDeblockingID);
     char deblockstr[2];
     snprintf(deblockstr, sizeof(deblockstr), "%d", deblocking);
     LOGD("Using deblocking level %d", deblocking);
 
-    methodId = (*env)->GetMethodID(env, cls, "getNetworkCaching", "()I");
-    int networkCaching = (*env)->CallIntMethod(env, thiz, methodId);
+    int networkCaching = (*env)->CallIntMethod(env, thiz, fields.LibVLC.getNetworkCachingID);
     char networkCachingstr[25];
     if(networkCaching > 0) {
         snprintf(networkCachingstr, sizeof(networkCachingstr), "--network-caching=%d", networkCaching);
         LOGD("Using network caching of %d ms", networkCaching);
     }
 
-    methodId = (*env)->GetMethodID(env, cls, "getChroma", "()Ljava/lang/String;");
-    jstring chroma = (*env)->CallObjectMethod(env, thiz, methodId);
+    jstring chroma = (*env)->CallObjectMethod(env, thiz, fields.LibVLC.getChromaID);
     const char *chromastr = (*env)->GetStringUTFChars(env, chroma, 0);
     LOGD("Chroma set to \"%s\"", chromastr);
 
-    methodId = (*env)->GetMethodID(env, cls, "getSubtitlesEncoding", "()Ljava/lang/String;");
-    jstring subsencoding = (*env)->CallObjectMethod(env, thiz, methodId);
+    jstring subsencoding = (*env)->CallObjectMethod(env, thiz, fields.LibVLC.getSubtitlesEncodingID);
     const char *subsencodingstr = (*env)->GetStringUTFChars(env, subsencoding, 0);
     LOGD("Subtitle encoding set to \"%s\"", subsencodingstr);
 
-    methodId = (*env)->GetMethodID(env, cls, "isVerboseMode", "()Z");
-    verbosity = (*env)->CallBooleanMethod(env, thiz, methodId);
+    verbosity = (*env)->CallBooleanMethod(env, thiz, fields.LibVLC.isVerboseModeID);
 
-    methodId = (*env)->GetMethodID(env, cls, "getHardwareAcceleration", "()I");
-    int hardwareAcceleration = (*env)->CallIntMethod(env, thiz, methodId);
+    int hardwareAcceleration = (*env)->CallIntMethod(env, thiz, fields.LibVLC.getHardwareAccelerationID);
     /* With the MediaCodec opaque mode we cannot use the OpenGL ES vout. */
     if (hardwareAcceleration == HW_ACCELERATION_FULL)
         use_opengles2 = false;
 
-    methodId = (*env)->GetMethodID(env, cls, "getCachePath", "()Ljava/lang/String;");
-    jstring cachePath = (*env)->CallObjectMethod(env, thiz, methodId);
+    jstring cachePath = (*env)->CallObjectMethod(env, thiz, fields.LibVLC.getCachePathID);
     if (cachePath) {
         const char *cache_path = (*env)->GetStringUTFChars(env, cachePath, 0);
         setenv("DVDCSS_CACHE", cache_path, 1);
@@ -310,7 +581,7 @@ void Java_org_videolan_libvlc_LibVLC_nativeInit(JNIEnv *env, jobject thiz)
     };
     libvlc_instance_t *instance = libvlc_new(sizeof(argv) / sizeof(*argv), argv);
 
-    setLong(env, thiz, "mLibVlcInstance", (jlong)(intptr_t) instance);
+    (*env)->SetLongField(env, thiz, fields.LibVLC.mLibVlcInstanceID, (jlong)(intptr_t) instance);
 
     (*env)->ReleaseStringUTFChars(env, chroma, chromastr);
     (*env)->ReleaseStringUTFChars(env, subsencoding, subsencodingstr);
@@ -332,8 +603,14 @@ void Java_org_videolan_libvlc_LibVLC_nativeDestroy(JNIEnv *env, jobject thiz)
 {
     destroy_native_crash_handler(env);
 
+    pthread_mutex_lock(&preload.lock);
+    release_preload();
+    pthread_mutex_unlock(&preload.lock);
     releaseMediaPlayer(env, thiz);
-    jlong libVlcInstance = getLong(env, thiz, "mLibVlcInstance");
+    parse_async_stop(env);
+    mp_pool_clear();
+    probe_cache_clear();
+    jlong libVlcInstance = (*env)->GetLongField(env, thiz, fields.LibVLC.mLibVlcInstanceID);
     if (!libVlcInstance)
         return; // Already destroyed
 
@@ -341,7 +618,7 @@ void Java_org_videolan_libvlc_LibVLC_nativeDestroy(JNIEnv *env, jobject thiz)
     libvlc_log_unset(instance);
     libvlc_release(instance);
 
-    setLong(env, thiz, "mLibVlcInstance", 0);
+    (*env)->SetLongField(env, thiz, fields.LibVLC.mLibVlcInstanceID, 0);
 }
 
 void Java_org_videolan_libvlc_LibVLC_detachEventHandler(JNIEnv *env, jobject thiz)
@@ -362,23 +639,26 @@ void Java_org_videolan_libvlc_LibVLC_setEventHandler(JNIEnv *env, jobject thiz,
     eventHandlerInstance = getEventHandlerReference(env, thiz, eventHandler);
 }
 
-void Java_org_videolan_libvlc_LibVLC_playMRL(JNIEnv *env, jobject thiz, jlong instance,
-                                             jstring mrl, jobjectArray mediaOptions)
+static libvlc_media_player_t *create_media_player(JNIEnv *env, jobject thiz, jlong instance)
 {
-    /* Release previous media player, if any */
-    releaseMediaPlayer(env, thiz);
+    /* Create a media player playing environment, or take one that was
+     * set up for the same audio output type from the pool */
+    bool created;
+    mp_aout = (*env)->CallIntMethod(env, thiz, fields.LibVLC.getAoutID);
+    libvlc_media_player_t *mp = mp_pool_get((libvlc_instance_t*)(intptr_t)instance,
+                                            MP_ROLE_PLAYBACK, mp_aout, &created);
+    if (!mp)
+        return NULL;
+    (*env)->SetLongField(env, thiz, fields.LibVLC.mInternalMediaPlayerInstanceID, (jlong)(intptr_t)mp);
+    if (!created)
+        return mp;
 
-    /* Create a media player playing environment */
-    libvlc_media_player_t *mp = libvlc_media_player_new((libvlc_instance_t*)(intptr_t)instance);
-    libvlc_media_player_set_video_title_display(mp, libvlc_position_disable, 0);
     jobject myJavaLibVLC = (*env)->NewGlobalRef(env, thiz);
 
     //if AOUT_AUDIOTRACK_JAVA, we use amem
-    jclass cls = (*env)->GetObjectClass(env, thiz);
-    jmethodID methodId = (*env)->GetMethodID(env, cls, "getAout", "()I");
-    if ( (*env)->CallIntMethod(env, thiz, methodId) == AOUT_AUDIOTRACK_JAVA )
+    if (mp_aout == AOUT_AUDIOTRACK_JAVA)
     {
-        libvlc_audio_set_callbacks(mp, aout_play, aout_pause, NULL, NULL, NULL,
+        libvlc_audio_set_callbacks(mp, aout_play, aout_pause, NULL, aout_flush, NULL,
                                    (void*) myJavaLibVLC);
         libvlc_audio_set_format_callbacks(mp, aout_open, aout_close);
     }
@@ -397,17 +677,16 @@ void Java_org_videolan_libvlc_LibVLC_playMRL(JNIEnv *env, jobject thiz, jlong in
     };
     for(int i = 0; i < (sizeof(mp_events) / sizeof(*mp_events)); i++)
         libvlc_event_attach(ev, mp_events[i], vlc_event_callback, myVm);
+    return mp;
+}
 
-    /* Keep a pointer to this media player */
-    setLong(env, thiz, "mInternalMediaPlayerInstance", (jlong)(intptr_t)mp);
-
-    cls = (*env)->GetObjectClass(env, thiz);
-    jmethodID methodID = (*env)->GetMethodID(env, cls, "applyEqualizer", "()V");
-    (*env)->CallVoidMethod(env, thiz, methodID);
-
-    const char* p_mrl = (*env)->GetStringUTFChars(env, mrl, 0);
-
+static libvlc_media_t *create_media(JNIEnv *env, jlong instance,
+                                    const char *p_mrl, jobjectArray mediaOptions)
+{
     libvlc_media_t* p_md = libvlc_media_new_location((libvlc_instance_t*)(intptr_t)instance, p_mrl);
+    if (!p_md)
+        return NULL;
+
     /* media options */
     if (mediaOptions != NULL)
     {
@@ -418,12 +697,19 @@ void Java_org_videolan_libvlc_LibVLC_playMRL(JNIEnv *env, jobject thiz, jlong in
             const char* p_st = (*env)->GetStringUTFChars(env, option, 0);
             libvlc_media_add_option(p_md, p_st); // option
             (*env)->ReleaseStringUTFChars(env, option, p_st);
+            (*env)->DeleteLocalRef(env, option);
         }
     }
+    return p_md;
+}
 
-    (*env)->ReleaseStringUTFChars(env, mrl, p_mrl);
-
-    /* Connect the media event manager. */
+/**
+ * Connect the media event manager of the media being played, not of the
+ * preloaded ones, whose events would be taken for the current media's.
+ * A preloaded media may have been parsed already: report it now.
+ **/
+static void attach_media_events(libvlc_media_t *p_md)
+{
     libvlc_event_manager_t *ev_media = libvlc_media_event_manager(p_md);
     static const libvlc_event_type_t mp_media_events[] = {
         libvlc_MediaParsedChanged
@@ -431,10 +717,103 @@ void Java_org_videolan_libvlc_LibVLC_playMRL(JNIEnv *env, jobject thiz, jlong in
     for(int i = 0; i < (sizeof(mp_media_events) / sizeof(*mp_media_events)); i++)
         libvlc_event_attach(ev_media, mp_media_events[i], vlc_event_callback, myVm);
 
+    if (libvlc_media_is_parsed(p_md))
+    {
+        libvlc_event_t ev = {
+            .type = libvlc_MediaParsedChanged,
+            .p_obj = p_md,
+        };
+        ev.u.media_parsed_changed.new_status = 1;
+        vlc_event_callback(&ev, myVm);
+    }
+}
+
+void Java_org_videolan_libvlc_LibVLC_playMRL(JNIEnv *env, jobject thiz, jlong instance,
+                                             jstring mrl, jobjectArray mediaOptions)
+{
+    store_int64(&switch_start, monotonic_us());
+
+    /* Keep the current media player, and thus its event callbacks and its
+     * audio output, unless the audio output type was changed. */
+    libvlc_media_player_t *mp = getMediaPlayer(env, thiz);
+    if (mp && (*env)->CallIntMethod(env, thiz, fields.LibVLC.getAoutID) != mp_aout)
+    {
+        releaseMediaPlayer(env, thiz);
+        mp = NULL;
+    }
+    if (mp)
+        libvlc_media_player_set_rate(mp, 1.f);
+    else
+        mp = create_media_player(env, thiz, instance);
+    if (!mp)
+    {
+        store_int64(&switch_start, 0);
+        return;
+    }
+
+    (*env)->CallVoidMethod(env, thiz, fields.LibVLC.applyEqualizerID);
+
+    const char* p_mrl = (*env)->GetStringUTFChars(env, mrl, 0);
+
+    /* Use the preloaded media if it is the one to play */
+    libvlc_media_t* p_md = NULL;
+    pthread_mutex_lock(&preload.lock);
+    if (preload.mrl && !strcmp(preload.mrl, p_mrl))
+    {
+        p_md = preload.media;
+        preload.media = NULL;
+    }
+    release_preload();
+    pthread_mutex_unlock(&preload.lock);
+
+    if (!p_md)
+        p_md = create_media(env, instance, p_mrl, mediaOptions);
+    (*env)->ReleaseStringUTFChars(env, mrl, p_mrl);
+    if (!p_md)
+    {
+        store_int64(&switch_start, 0);
+        return;
+    }
+
+    /* Replacing the media stops the previous one */
     libvlc_media_player_set_media(mp, p_md);
+    attach_media_events(p_md);
+    libvlc_media_release(p_md);
     libvlc_media_player_play(mp);
 }
 
+void Java_org_videolan_libvlc_LibVLC_preloadMRL(JNIEnv *env, jobject thiz, jlong instance,
+                                                jstring mrl, jobjectArray mediaOptions)
+{
+    const char* p_mrl = (*env)->GetStringUTFChars(env, mrl, 0);
+
+    pthread_mutex_lock(&preload.lock);
+    if (preload.mrl && !strcmp(preload.mrl, p_mrl))
+    {
+        /* Already preloaded */
+        pthread_mutex_unlock(&preload.lock);
+        (*env)->ReleaseStringUTFChars(env, mrl, p_mrl);
+        return;
+    }
+    release_preload();
+
+    preload.media = create_media(env, instance, p_mrl, mediaOptions);
+    if (preload.media)
+    {
+        preload.mrl = strdup(p_mrl);
+        /* Read the metadata and the tracks in the background */
+        libvlc_media_parse_async(preload.media);
+    }
+    pthread_mutex_unlock(&preload.lock);
+
+    (*env)->ReleaseStringUTFChars(env, mrl, p_mrl);
+}
+
+jlong Java_org_videolan_libvlc_LibVLC_getSwitchLatency(JNIEnv *env, jobject thiz)
+{
+    return __sync_fetch_and_add(&switch_latency, 0);
+}
+
 jfloat Java_org_videolan_libvlc_LibVLC_getRate(JNIEnv *env, jobject thiz) {
     libvlc_media_player_t* mp = getMediaPlayer(env, thiz);
     if(mp)
@@ -485,6 +864,7 @@ void Java_org_videolan_libvlc_LibVLC_stop(JNIEnv *env, jobject thiz)
     libvlc_media_player_t *mp = getMediaPlayer(env, thiz);
     if (mp)
         libvlc_media_player_stop(mp);
+    aout_release_parked();
 }
 
 jint Java_org_videolan_libvlc_LibVLC_getPlayerState(JNIEnv *env, jobject thiz)
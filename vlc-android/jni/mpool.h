@@ -0,0 +1,62 @@
+/*****************************************************************************
+ * mpool.h
+ *****************************************************************************
+ * Copyright © 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef LIBVLCJNI_MPOOL_H
+#define LIBVLCJNI_MPOOL_H
+
+#include <stdbool.h>
+
+#include <vlc/vlc.h>
+
+/* Roles of the pooled media players. Each role has its own pool, since
+ * the players are configured for their role when they are created. */
+typedef enum
+{
+    MP_ROLE_PLAYBACK,
+    MP_ROLE_THUMBNAIL,
+    MP_ROLE_PROBE,
+    MP_ROLE_COUNT
+} mp_role_t;
+
+/**
+ * Get a media player for this role, from the pool if possible.
+ * variant distinguishes players of the same role that were configured
+ * differently (the audio output type for playback).
+ * *created is set to true if the player was just created, and has to be
+ * configured by the caller.
+ */
+libvlc_media_player_t *mp_pool_get(libvlc_instance_t *libvlc, mp_role_t role,
+                                   int variant, bool *created);
+
+/**
+ * Stop a media player of this libvlc instance and give it back to the
+ * pool, or release it if the pool of its role is full. The caller must
+ * have detached the event callbacks it attached since getting the player;
+ * the ones attached at creation stay.
+ */
+void mp_pool_put(libvlc_instance_t *libvlc, libvlc_media_player_t *mp,
+                 mp_role_t role, int variant);
+
+/**
+ * Release all the pooled media players
+ */
+void mp_pool_clear(void);
+
+#endif // LIBVLCJNI_MPOOL_H
@@ -20,14 +20,14 @@
 
 #include <signal.h>
 
+#include <vlc/vlc.h>
+
 #include "native_crash_handler.h"
+#include "utils.h"
 
 static struct sigaction old_actions[NSIG];
 static jobject j_libVLC;
 
-/** Unique Java VM instance, as defined in libvlcjni.c */
-extern JavaVM *myVm;
-
 // Monitored signals.
 static const int monitored_signals[] = {
     SIGILL,
@@ -50,15 +50,9 @@ static const int monitored_signals[] = {
 void sigaction_callback(int signal, siginfo_t *info, void *reserved)
 {
     // Call the Java LibVLC method that handle the crash.
-    JNIEnv *env;
-    (*myVm)->AttachCurrentThread(myVm, &env, NULL);
-
-    jclass cls = (*env)->GetObjectClass(env, j_libVLC);
-    jmethodID methodId = (*env)->GetMethodID(env, cls, "onNativeCrash", "()V");
-    (*env)->CallVoidMethod(env, j_libVLC, methodId);
-
-    (*env)->DeleteLocalRef(env, cls);
-    (*myVm)->DetachCurrentThread(myVm);
+    JNIEnv *env = jni_get_env("jni_crash_handler");
+    if (env != NULL)
+        (*env)->CallVoidMethod(env, j_libVLC, fields.LibVLC.onNativeCrashID);
 
     // Call the old signal handler.
     old_actions[signal].sa_handler(signal);
@@ -0,0 +1,118 @@
+/*****************************************************************************
+ * probe.h
+ *****************************************************************************
+ * Copyright © 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef LIBVLCJNI_PROBE_H
+#define LIBVLCJNI_PROBE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include <vlc/vlc.h>
+
+/*
+ * Description of a media, read once by parsing it, and shared by the
+ * track information, the video track detection and the thumbnailer.
+ */
+
+typedef enum
+{
+    PROBE_UNKNOWN,      /// no track was found
+    PROBE_AUDIO,
+    PROBE_VIDEO,
+} probe_kind_t;
+
+typedef struct
+{
+    int id;
+    libvlc_track_type_t type;
+    uint32_t codec;
+    char *language;
+    unsigned bitrate;
+    /* Video */
+    unsigned width;
+    unsigned height;
+    float framerate;
+    /* Audio */
+    unsigned channels;
+    unsigned rate;
+} probe_track_t;
+
+typedef struct
+{
+    libvlc_time_t length;
+    char *title;
+    char *artist;
+    char *album;
+    char *genre;
+    char *artwork_url;
+
+    probe_track_t *tracks;
+    unsigned track_count;
+
+    probe_kind_t kind;
+    unsigned width;     /// of the first video track
+    unsigned height;
+} probe_t;
+
+/**
+ * Describe a parsed media in probe. Return false if out of memory.
+ */
+bool probe_fill(probe_t *probe, libvlc_media_t *m);
+void probe_clean(probe_t *probe);
+
+/**
+ * Get the description of a media, parsing it only if it is not cached
+ * yet. The cache is keyed by the MRL and, for local files, the size and
+ * modification date.
+ * Return NULL if the media could not be created, or a reference to
+ * release with probe_release().
+ */
+const probe_t *probe_get(libvlc_instance_t *libvlc, const char *mrl);
+void probe_release(const probe_t *probe);
+
+/**
+ * Get the cached description of a media, or NULL if it is not cached.
+ */
+const probe_t *probe_lookup(const char *mrl);
+
+/**
+ * Describe a media parsed by the caller, and cache its description.
+ * Return NULL if out of memory, or a reference to release with
+ * probe_release().
+ */
+const probe_t *probe_add(const char *mrl, libvlc_media_t *m);
+
+/**
+ * Release all the cached descriptions
+ */
+void probe_cache_clear(void);
+
+/**
+ * FNV-1a hash of a MRL
+ */
+uint64_t mrl_hash(const char *mrl);
+
+/**
+ * Get the status of a local media. Return false for remote media.
+ */
+bool mrl_stat(const char *mrl, struct stat *st);
+
+#endif // LIBVLCJNI_PROBE_H
@@ -26,11 +26,18 @@
 #include <time.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
 #define LOG_TAG "VLC/JNI/thumbnailer"
 #include "log.h"
 
 #include "utils.h"
+#include "mpool.h"
+#include "probe.h"
 
 #define THUMBNAIL_POSITION 0.5
 #define PIXEL_SIZE 4 /* RGBA */
@@ -39,6 +46,29 @@
 #define THUMBNAIL_MIN_HEIGHT 32
 #define THUMBNAIL_MAX_HEIGHT 2304
 
+/* Thumbnail modes, see LibVLC.java */
+#define THUMBNAIL_ACCURATE 0 /* seek and decode up to the exact position */
+#define THUMBNAIL_KEYFRAME 1 /* start at the keyframe before the position */
+#define THUMBNAIL_BEST 2     /* keep the most informative of a few keyframes */
+#define THUMBNAIL_MODES 3
+
+/* THUMBNAIL_BEST: the candidates are spread over this fraction of the
+ * media, around THUMBNAIL_POSITION, and the search stops early on a
+ * picture scoring at least THUMBNAIL_GOOD_SCORE, out of 6 bits of luma
+ * entropy. */
+#define THUMBNAIL_CANDIDATE_SPREAD 0.6
+#define THUMBNAIL_MAX_CANDIDATES 16
+#define THUMBNAIL_GOOD_SCORE 4.5f
+#define THUMBNAIL_SCORE_BINS 64
+
+/* Timeouts, in ms. Opening large files, or seeking in long ones, takes
+ * more time. */
+#define THUMBNAIL_OPEN_TIMEOUT 2000     /* plus 1 s per 64 MiB */
+#define THUMBNAIL_DECODE_TIMEOUT 2000   /* plus 1 s per hour of media */
+#define THUMBNAIL_MAX_TIMEOUT 10000     /* also used for remote media */
+
+#define FAILURE_CACHE_SIZE 256
+
 
 /*
    Frame is:   thumbnail + black borders
@@ -53,7 +83,7 @@
    │                 Thumbnail Data                     │
    │                                                    │
    │             thumbHeight x thumbWidth               │
-   │             thumbPitch = thumbWidth * 4            │
+   │             pitch = frameWidth * 4                 │
    │                                                    │
    ├————————————————————————————————————————————————————┤
    │                                                    │
@@ -65,21 +95,54 @@
 enum {
     THUMB_SEEKING,
     THUMB_SEEKED,
-    THUMB_DROP_FIRST_FRAME,
+    THUMB_DROP_FIRST_FRAME, /* the next frame is the thumbnail */
     THUMB_DONE,
 };
 
+/* Latency of the thumbnails, per mode */
+static struct
+{
+    pthread_mutex_t lock;
+    struct
+    {
+        unsigned created;
+        unsigned failed;
+        unsigned skipped;       /// known bad media
+        int64_t time;           /// in ns
+        int64_t max_time;       /// in ns
+    } modes[THUMBNAIL_MODES];
+} stats = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Cost allowed to THUMBNAIL_BEST, see setThumbnailBudget() */
+static struct
+{
+    pthread_mutex_t lock;
+    unsigned candidates;
+    unsigned time;              /// in ms
+} budget = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .candidates = 5,
+    .time = 3000,
+};
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
 typedef struct
 {
     int state;
+    bool playing;   /// the Playing event was received
+    bool error;     /// the media ended or failed before the thumbnail
+    libvlc_time_t seekTime; /// in strips, first time after the seek, or -1
 
-    char *thumbData;
-    char *frameData;
-
-    unsigned blackBorders;
-    unsigned frameWidth;
-    unsigned thumbHeight;
-    unsigned thumbPitch;
+    char *picture;  /// thumbnail part of the frame, where the decoder writes
+    char *scratch;  /// written instead of the frame by the other pictures
 
     pthread_mutex_t doneMutex;
     pthread_cond_t doneCondVar;
@@ -88,12 +151,19 @@ typedef struct
 
 /**
  * Thumbnailer vout lock
+ * The pictures are decoded directly in the frame, with the pitch of the
+ * frame, so the thumbnail does not need to be copied.
  **/
 static void *thumbnailer_lock(void *opaque, void **pixels)
 {
     thumbnailer_sys_t *sys = opaque;
-    *pixels = sys->thumbData;
-    return NULL;
+
+    /* Only the picture that may become the thumbnail is decoded in the
+     * frame, the ones before and after it must not overwrite it. */
+    pthread_mutex_lock(&sys->doneMutex);
+    *pixels = sys->state == THUMB_DROP_FIRST_FRAME ? sys->picture : sys->scratch;
+    pthread_mutex_unlock(&sys->doneMutex);
+    return *pixels;
 }
 
 
@@ -107,65 +177,190 @@ static void thumbnailer_unlock(void *opaque, void *picture, void *const *pixels)
     /* If we have already received a thumbnail, or we are still seeking,
      * we skip this frame. */
     pthread_mutex_lock(&sys->doneMutex);
-    int state = sys->state;
-    if (state == THUMB_SEEKED)
+    switch (sys->state)
+    {
+    case THUMB_SEEKED:
         sys->state = THUMB_DROP_FIRST_FRAME;
+        break;
+    case THUMB_DROP_FIRST_FRAME:
+        /* we have received our first thumbnail and we can exit, unless
+         * the picture was locked before and decoded elsewhere. */
+        if (picture != sys->picture)
+            break;
+        sys->state = THUMB_DONE;
+        pthread_cond_signal(&sys->doneCondVar);
+        break;
+    }
     pthread_mutex_unlock(&sys->doneMutex);
-    if (state != THUMB_DROP_FIRST_FRAME)
-        return;
+}
 
-    /* we have received our first thumbnail and we can exit. */
-    const char *dataSrc = sys->thumbData;
-    char *dataDest = sys->frameData + sys->blackBorders * PIXEL_SIZE;
 
-    /* Copy the thumbnail. */
-    for (unsigned i = 0; i < sys->thumbHeight; ++i)
-    {
-        memcpy(dataDest, dataSrc, sys->thumbPitch);
-        dataDest += sys->frameWidth * PIXEL_SIZE;
-        dataSrc += sys->thumbPitch;
-    }
+/**
+ * Thumbnailer media player events
+ **/
+static void thumbnailer_event(const libvlc_event_t *ev, void *opaque)
+{
+    thumbnailer_sys_t *sys = opaque;
 
-    /* Signal that the thumbnail was created. */
     pthread_mutex_lock(&sys->doneMutex);
-    sys->state = THUMB_DONE;
+    switch (ev->type)
+    {
+    case libvlc_MediaPlayerPlaying:
+        sys->playing = true;
+        break;
+    case libvlc_MediaPlayerPositionChanged:
+        if (sys->state == THUMB_SEEKING && sys->seekTime < 0
+         && ev->u.media_player_position_changed.new_position >= THUMBNAIL_POSITION)
+            sys->state = THUMB_SEEKED;
+        break;
+    case libvlc_MediaPlayerTimeChanged:
+        /* The keyframes are not dropped: the next picture is the one */
+        if (sys->state == THUMB_SEEKING && sys->seekTime >= 0
+         && ev->u.media_player_time_changed.new_time >= sys->seekTime)
+            sys->state = THUMB_DROP_FIRST_FRAME;
+        break;
+    case libvlc_MediaPlayerEncounteredError:
+    case libvlc_MediaPlayerEndReached:
+        sys->error = true;
+        break;
+    }
     pthread_cond_signal(&sys->doneCondVar);
     pthread_mutex_unlock(&sys->doneMutex);
 }
 
+static const libvlc_event_type_t thumbnailer_events[] = {
+    libvlc_MediaPlayerPlaying,
+    libvlc_MediaPlayerPositionChanged,
+    libvlc_MediaPlayerTimeChanged,
+    libvlc_MediaPlayerEncounteredError,
+    libvlc_MediaPlayerEndReached,
+};
 
-/**
- * Thumbnailer main function.
- * return null if the thumbail generation failed.
- **/
-jbyteArray Java_org_videolan_libvlc_LibVLC_getThumbnail(JNIEnv *env, jobject thiz,
-                                                        jlong instance, jstring filePath,
-                                                        const jint frameWidth, const jint frameHeight)
+static void set_deadline(struct timespec *deadline, unsigned timeout)
 {
-    libvlc_instance_t *libvlc = (libvlc_instance_t *)(intptr_t)instance;
-    jbyteArray byteArray = NULL;
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += timeout / 1000;
+    deadline->tv_nsec += (timeout % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
 
-    /* Create the thumbnailer data structure */
+static unsigned min_timeout(int64_t timeout)
+{
+    return timeout < THUMBNAIL_MAX_TIMEOUT ? timeout : THUMBNAIL_MAX_TIMEOUT;
+}
+
+
+/*
+ * Media that failed once are not retried, unless they change: they are
+ * known by their MRL, size and modification date.
+ */
+typedef struct
+{
+    uint64_t hash;
+    off_t size;
+    time_t mtime;
+} failure_t;
+
+static struct
+{
+    pthread_mutex_t lock;
+    failure_t entries[FAILURE_CACHE_SIZE];
+    unsigned count;
+    unsigned next;              /// oldest entry, replaced first
+} failures = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static failure_t failure_key(const char *mrl)
+{
+    failure_t key = { .hash = mrl_hash(mrl) };
+
+    struct stat st;
+    if (mrl_stat(mrl, &st))
+    {
+        key.size = st.st_size;
+        key.mtime = st.st_mtime;
+    }
+    return key;
+}
+
+static bool failure_cache_has(const failure_t *key)
+{
+    bool found = false;
+    pthread_mutex_lock(&failures.lock);
+    for (unsigned i = 0; i < failures.count && !found; ++i)
+        found = failures.entries[i].hash == key->hash
+             && failures.entries[i].size == key->size
+             && failures.entries[i].mtime == key->mtime;
+    pthread_mutex_unlock(&failures.lock);
+    return found;
+}
+
+static void failure_cache_add(const failure_t *key)
+{
+    pthread_mutex_lock(&failures.lock);
+    failures.entries[failures.next] = *key;
+    failures.next = (failures.next + 1) % FAILURE_CACHE_SIZE;
+    if (failures.count < FAILURE_CACHE_SIZE)
+        failures.count++;
+    pthread_mutex_unlock(&failures.lock);
+}
+
+
+static thumbnailer_sys_t *thumbnailer_sys_new(void)
+{
     thumbnailer_sys_t *sys = calloc(1, sizeof(thumbnailer_sys_t));
     if (sys == NULL)
     {
         LOGE("Could not create the thumbnailer data structure!");
-        goto enomem;
+        return NULL;
     }
 
     /* Initialize the barrier. */
     pthread_mutex_init(&sys->doneMutex, NULL);
     pthread_cond_init(&sys->doneCondVar, NULL);
+    sys->seekTime = -1;
+    return sys;
+}
+
+static void thumbnailer_sys_delete(thumbnailer_sys_t *sys)
+{
+    pthread_mutex_destroy(&sys->doneMutex);
+    pthread_cond_destroy(&sys->doneCondVar);
+    free(sys->scratch);
+    free(sys);
+}
+
+/**
+ * Get a thumbnailer media player, set the media and get its description.
+ * Return the player, or NULL on failure. *media is the media, with a
+ * reference that the caller must release once it added its options.
+ **/
+static libvlc_media_player_t *thumbnailer_open(libvlc_instance_t *libvlc, const char *mrl,
+                                               libvlc_media_t **media,
+                                               unsigned *videoWidth, unsigned *videoHeight,
+                                               libvlc_time_t *length, bool *badMedia)
+{
+    *badMedia = false;
 
-    /* Create a media player playing environment */
-    libvlc_media_player_t *mp = libvlc_media_player_new(libvlc);
-    libvlc_media_player_set_video_title_display(mp, libvlc_position_disable, 0);
+    /* Get a media player playing environment */
+    bool created;
+    libvlc_media_player_t *mp = mp_pool_get(libvlc, MP_ROLE_THUMBNAIL, 0, &created);
+    if (mp == NULL)
+    {
+        LOGE("Could not create the media player!");
+        return NULL;
+    }
 
-    libvlc_media_t *m = new_media(instance, env, thiz, filePath, true, false);
+    libvlc_media_t *m = libvlc_media_new_location(libvlc, mrl);
     if (m == NULL)
     {
         LOGE("Could not create the media to play!");
-        goto end;
+        goto error;
     }
 
     /* Fast and no options */
@@ -175,144 +370,900 @@ jbyteArray Java_org_videolan_libvlc_LibVLC_getThumbnail(JNIEnv *env, jobject thi
 
     libvlc_media_player_set_media(mp, m);
 
-    /* Get the size of the video with the tracks information of the media. */
-    libvlc_media_track_t **tracks;
-    libvlc_media_parse(m);
-    int nbTracks = libvlc_media_tracks_get(m, &tracks);
-    libvlc_media_release(m);
-
-    /* Parse the results */
-    unsigned videoWidth = 0, videoHeight = 0;
-    bool hasVideoTrack = false;
-    for (unsigned i = 0; i < nbTracks; ++i)
-        if (tracks[i]->i_type == libvlc_track_video)
-        {
-            videoWidth = tracks[i]->video->i_width;
-            videoHeight = tracks[i]->video->i_height;
-            hasVideoTrack = true;
-            break;
-        }
-
-    libvlc_media_tracks_release(tracks, nbTracks);
+    /* Get the size of the video from the description of the media, only
+     * parsed if it was not probed before. */
+    const probe_t *probe = probe_get(libvlc, mrl);
+    if (probe == NULL)
+        goto error;
+    *length = probe->length;
+    *videoWidth = probe->width;
+    *videoHeight = probe->height;
+    bool hasVideoTrack = probe->kind == PROBE_VIDEO;
+    /* A media without any track may only have failed to parse this time */
+    bool hasTracks = probe->track_count > 0;
+    probe_release(probe);
 
     /* Abort if we have not found a video track. */
+    *badMedia = hasTracks;
     if (!hasVideoTrack)
     {
         LOGE("Could not find any video track in this file.\n");
-        goto end;
+        goto error;
     }
 
-    LOGD("Video dimensions: %ix%i.\n", videoWidth, videoHeight );
+    LOGD("Video dimensions: %ix%i.\n", *videoWidth, *videoHeight );
+    *badMedia = true;
 
     /* VLC could not tell us the size */
-    if( videoWidth == 0 || videoHeight == 0 )
+    if( *videoWidth == 0 || *videoHeight == 0 )
     {
         LOGE("Could not find the video dimensions.\n");
-        goto end;
+        goto error;
     }
 
-    if( videoWidth < THUMBNAIL_MIN_WIDTH || videoHeight < THUMBNAIL_MIN_HEIGHT
-        || videoWidth > THUMBNAIL_MAX_WIDTH || videoHeight > THUMBNAIL_MAX_HEIGHT )
+    if( *videoWidth < THUMBNAIL_MIN_WIDTH || *videoHeight < THUMBNAIL_MIN_HEIGHT
+        || *videoWidth > THUMBNAIL_MAX_WIDTH || *videoHeight > THUMBNAIL_MAX_HEIGHT )
     {
         LOGE("Wrong video dimensions.\n");
-        goto end;
+        goto error;
     }
+    *badMedia = false;
 
-    /* Compute the size parameters of the frame to generate. */
-    unsigned thumbWidth  = frameWidth;
-    unsigned thumbHeight = frameHeight;
+    *media = m;
+    return mp;
+
+error:
+    if (m != NULL)
+        libvlc_media_release(m);
+    mp_pool_put(libvlc, mp, MP_ROLE_THUMBNAIL, 0);
+    return NULL;
+}
+
+/**
+ * Compute the size of the thumbnail in a frameWidth x frameHeight frame,
+ * and its offset, in pixels, from the top left corner of the frame.
+ **/
+static void thumbnailer_fit(unsigned videoWidth, unsigned videoHeight,
+                            unsigned frameWidth, unsigned frameHeight,
+                            unsigned *thumbWidth, unsigned *thumbHeight,
+                            unsigned *offsetX, unsigned *offsetY)
+{
+    *thumbWidth  = frameWidth;
+    *thumbHeight = frameHeight;
+    *offsetX = *offsetY = 0;
     const float inputAR = (float)videoWidth / videoHeight;
     const float screenAR = (float)frameWidth / frameHeight;
 
     /* Most of the cases, video is wider than tall */
     if (screenAR < inputAR)
     {
-        thumbHeight = (float)frameWidth / inputAR + 1;
-        sys->blackBorders = ( (frameHeight - thumbHeight) / 2 ) * frameWidth;
+        *thumbHeight = (float)frameWidth / inputAR + 1;
+        if (*thumbHeight > frameHeight)
+            *thumbHeight = frameHeight;
+        *offsetY = (frameHeight - *thumbHeight) / 2;
     }
     else
     {
         LOGD("Weird aspect Ratio.\n");
-        thumbWidth = (float)frameHeight * inputAR;
-        sys->blackBorders = (frameWidth - thumbWidth) / 2;
+        *thumbWidth = (float)frameHeight * inputAR;
+        *offsetX = (frameWidth - *thumbWidth) / 2;
     }
+}
 
-    sys->thumbPitch  = thumbWidth * PIXEL_SIZE;
-    sys->thumbHeight = thumbHeight;
-    sys->frameWidth  = frameWidth;
+/**
+ * Start the input directly at the keyframe before start, and only output
+ * the intra frames, without loop filter.
+ **/
+static void add_keyframe_options(libvlc_media_t *m, libvlc_time_t start)
+{
+    char option[32];
+    snprintf(option, sizeof(option), ":start-time=%.3f", start / 1000.);
+    libvlc_media_add_option(m, option);
+    libvlc_media_add_option(m, ":input-fast-seek");
+    libvlc_media_add_option(m, ":avcodec-skip-frame=3"); /* non key */
+    libvlc_media_add_option(m, ":avcodec-skiploopfilter=4"); /* all */
+    libvlc_media_add_option(m, ":avcodec-hurry-up");
+}
 
-    /* Allocate the memory to store the frames. */
-    size_t thumbSize = sys->thumbPitch * (sys->thumbHeight+1);
-    sys->thumbData = malloc(thumbSize);
-    if (sys->thumbData == NULL)
+/**
+ * Set the format of the pictures, with the pitch of the frame, and the
+ * callbacks.
+ **/
+static bool thumbnailer_setup(thumbnailer_sys_t *sys, libvlc_media_player_t *mp,
+                              unsigned thumbWidth, unsigned thumbHeight, unsigned pitch)
+{
+    /* Allocate the memory to store the other frames. */
+    sys->scratch = malloc(pitch * (thumbHeight + 1));
+    if (sys->scratch == NULL)
     {
         LOGE("Could not allocate the memory to store the frame!");
+        return false;
+    }
+
+    /* Set the video format and the callbacks. */
+    libvlc_video_set_format(mp, "RGBA", thumbWidth, thumbHeight, pitch);
+    libvlc_video_set_callbacks(mp, thumbnailer_lock, thumbnailer_unlock,
+                               NULL, (void*)sys);
+    return true;
+}
+
+static void thumbnailer_attach_events(thumbnailer_sys_t *sys, libvlc_media_player_t *mp,
+                                      bool attach)
+{
+    libvlc_event_manager_t *em = libvlc_media_player_event_manager(mp);
+    for (unsigned i = 0; i < sizeof(thumbnailer_events) / sizeof(*thumbnailer_events); ++i)
+        if (attach)
+            libvlc_event_attach(em, thumbnailer_events[i], thumbnailer_event, sys);
+        else
+            libvlc_event_detach(em, thumbnailer_events[i], thumbnailer_event, sys);
+}
+
+/**
+ * Wait for the thumbnail to be generated: the events take the state to
+ * THUMB_SEEKED, then the vout callbacks to THUMB_DONE.
+ * Return false on error or timeout.
+ **/
+static bool thumbnailer_wait(thumbnailer_sys_t *sys, const char *mrl,
+                             unsigned openTimeout, unsigned decodeTimeout)
+{
+    pthread_mutex_lock(&sys->doneMutex);
+    struct timespec deadline;
+    bool opened = sys->playing;
+    set_deadline(&deadline, opened ? decodeTimeout : openTimeout);
+    while (sys->state != THUMB_DONE && !sys->error)
+    {
+        if (!opened && sys->playing)
+        {
+            /* Now give the decoder time to reach the position */
+            opened = true;
+            set_deadline(&deadline, decodeTimeout);
+            continue;
+        }
+        if (pthread_cond_timedwait(&sys->doneCondVar, &sys->doneMutex, &deadline) != ETIMEDOUT)
+            continue;
+        if (opened && sys->state == THUMB_SEEKING)
+        {
+            /* The position was not reported, take the next frames anyway */
+            sys->state = THUMB_SEEKED;
+            set_deadline(&deadline, decodeTimeout);
+            continue;
+        }
+        LOGE("Timeout while creating the thumbnail of %s", mrl);
+        break;
+    }
+    bool done = sys->state == THUMB_DONE;
+    pthread_mutex_unlock(&sys->doneMutex);
+    return done;
+}
+
+static void thumbnailer_timeouts(const failure_t *key, libvlc_time_t length,
+                                 unsigned *openTimeout, unsigned *decodeTimeout)
+{
+    *openTimeout = key->size > 0
+        ? min_timeout(THUMBNAIL_OPEN_TIMEOUT + (key->size >> 26) * 1000)
+        : THUMBNAIL_MAX_TIMEOUT;
+    *decodeTimeout = min_timeout(THUMBNAIL_DECODE_TIMEOUT
+                                 + (length > 0 ? length / 3600 : 0));
+}
+
+/**
+ * Time of the candidate i of count, in THUMBNAIL_BEST mode. A single
+ * candidate is at THUMBNAIL_POSITION.
+ **/
+static libvlc_time_t candidate_time(libvlc_time_t length, unsigned count, unsigned i)
+{
+    return length * (THUMBNAIL_POSITION
+                     + THUMBNAIL_CANDIDATE_SPREAD * ((i + 0.5) / count - 0.5));
+}
+
+/**
+ * Score how informative a picture is: the entropy, in bits, of the
+ * histogram of its luma, sampled every 4 pixels of every 4 lines. Black
+ * frames, fades and title cards use few luma levels and score low.
+ **/
+static float picture_score(const char *picture, unsigned width, unsigned height,
+                           unsigned pitch)
+{
+    unsigned histogram[THUMBNAIL_SCORE_BINS] = { 0 };
+    unsigned samples = 0;
+
+    for (unsigned y = 0; y < height; y += 4)
+    {
+        const uint8_t *p = (const uint8_t *)picture + y * pitch;
+        for (unsigned x = 0; x < width; x += 4, p += 4 * PIXEL_SIZE)
+        {
+            /* BT.601 luma of the RGBA pixel */
+            unsigned luma = (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+            histogram[luma * THUMBNAIL_SCORE_BINS >> 8]++;
+            samples++;
+        }
+    }
+
+    float entropy = 0.f;
+    for (unsigned i = 0; i < THUMBNAIL_SCORE_BINS; ++i)
+        if (histogram[i] > 0)
+        {
+            float p = (float)histogram[i] / samples;
+            entropy -= p * logf(p);
+        }
+    return entropy / (float)M_LN2;
+}
+
+/**
+ * THUMBNAIL_BEST: play the media, decode up to candidates keyframes in
+ * sys->picture, and leave there the one with the best score. The media
+ * must start at the first candidate in keyframe mode. The search stops
+ * before a candidate that would exceed timeBudget ms.
+ * Return false if no candidate could be decoded.
+ **/
+static bool thumbnailer_select(thumbnailer_sys_t *sys, libvlc_media_player_t *mp,
+                               const char *mrl, libvlc_time_t length,
+                               unsigned candidates, unsigned timeBudget,
+                               unsigned thumbWidth, unsigned thumbHeight, unsigned pitch,
+                               unsigned openTimeout, unsigned decodeTimeout)
+{
+    const size_t lineSize = thumbWidth * PIXEL_SIZE;
+    char *best = malloc(lineSize * thumbHeight);
+    if (best == NULL)
+        return false;
+
+    const libvlc_time_t spacing = length * THUMBNAIL_CANDIDATE_SPREAD / candidates;
+    float bestScore = -1.f;
+    unsigned decoded = 0;
+    int64_t start = monotonic_ns();
+    for (unsigned i = 0; i < candidates; ++i)
+    {
+        /* Predict the cost of the next candidate from the previous ones */
+        int64_t elapsed = monotonic_ns() - start;
+        if (i > 0 && elapsed + elapsed / i > (int64_t)timeBudget * 1000000)
+            break;
+
+        /* Only seek forward, see thumbnail_strip_create() */
+        libvlc_time_t time = candidate_time(length, candidates, i);
+        pthread_mutex_lock(&sys->doneMutex);
+        sys->state = i == 0 ? THUMB_DROP_FIRST_FRAME : THUMB_SEEKING;
+        sys->seekTime = time - spacing / 2;
+        pthread_mutex_unlock(&sys->doneMutex);
+        if (i == 0)
+            libvlc_media_player_play(mp);
+        else
+            libvlc_media_player_set_time(mp, time);
+
+        if (!thumbnailer_wait(sys, mrl, openTimeout, decodeTimeout))
+        {
+            if (sys->error || !sys->playing)
+                break;
+            continue;
+        }
+        decoded++;
+
+        float score = picture_score(sys->picture, thumbWidth, thumbHeight, pitch);
+        if (score > bestScore)
+        {
+            bestScore = score;
+            for (unsigned y = 0; y < thumbHeight; ++y)
+                memcpy(best + y * lineSize, sys->picture + y * pitch, lineSize);
+        }
+        if (score >= THUMBNAIL_GOOD_SCORE)
+            break;
+    }
+
+    /* No picture may be decoded in the frame anymore */
+    pthread_mutex_lock(&sys->doneMutex);
+    sys->state = THUMB_DONE;
+    pthread_mutex_unlock(&sys->doneMutex);
+
+    if (decoded > 0)
+        for (unsigned y = 0; y < thumbHeight; ++y)
+            memcpy(sys->picture + y * pitch, best + y * lineSize, lineSize);
+    free(best);
+
+    LOGD("Best of %u/%u candidates of %s: %.2f bits in %lld ms", decoded, candidates, mrl,
+         bestScore, (long long)((monotonic_ns() - start) / 1000000));
+    return decoded > 0;
+}
+
+
+/**
+ * Create the thumbnail of a media, letterboxed in frameData, a zeroed
+ * frameWidth x frameHeight RGBA frame.
+ * Return false if the thumbnail generation failed, frameData is then
+ * undefined. *badMedia is set if the failure comes from the media, not on
+ * timeouts.
+ * This does not use the JVM and can be called from any thread.
+ **/
+static bool thumbnail_create(libvlc_instance_t *libvlc, const char *mrl,
+                             char *frameData, unsigned frameWidth, unsigned frameHeight,
+                             int mode, const failure_t *key, bool *badMedia)
+{
+    bool done = false;
+    *badMedia = false;
+
+    thumbnailer_sys_t *sys = thumbnailer_sys_new();
+    if (sys == NULL)
+        return false;
+
+    libvlc_media_t *m;
+    unsigned videoWidth, videoHeight;
+    libvlc_time_t length;
+    libvlc_media_player_t *mp = thumbnailer_open(libvlc, mrl, &m, &videoWidth, &videoHeight,
+                                                 &length, badMedia);
+    if (mp == NULL)
         goto end;
+
+    /* In keyframe mode, the first frame we get is the thumbnail. */
+    bool keyframe = (mode == THUMBNAIL_KEYFRAME || mode == THUMBNAIL_BEST) && length > 0;
+    unsigned candidates = 1, timeBudget = 0;
+    if (keyframe && mode == THUMBNAIL_BEST)
+    {
+        pthread_mutex_lock(&budget.lock);
+        candidates = budget.candidates;
+        timeBudget = budget.time;
+        pthread_mutex_unlock(&budget.lock);
     }
+    if (keyframe)
+        add_keyframe_options(m, candidate_time(length, candidates, 0));
+    libvlc_media_release(m);
+
+    /* Compute the size parameters of the frame to generate. */
+    unsigned thumbWidth, thumbHeight, offsetX, offsetY;
+    thumbnailer_fit(videoWidth, videoHeight, frameWidth, frameHeight,
+                    &thumbWidth, &thumbHeight, &offsetX, &offsetY);
+
+    const unsigned pitch = frameWidth * PIXEL_SIZE;
+    sys->picture = frameData + offsetY * pitch + offsetX * PIXEL_SIZE;
+    if (!thumbnailer_setup(sys, mp, thumbWidth, thumbHeight, pitch))
+        goto end;
+    sys->state = keyframe ? THUMB_DROP_FIRST_FRAME : THUMB_SEEKING;
+
+    thumbnailer_attach_events(sys, mp, true);
+
+    unsigned openTimeout, decodeTimeout;
+    thumbnailer_timeouts(key, length, &openTimeout, &decodeTimeout);
+
+    /* Play the media. */
+    if (candidates > 1)
+        done = thumbnailer_select(sys, mp, mrl, length, candidates, timeBudget,
+                                  thumbWidth, thumbHeight, pitch,
+                                  openTimeout, decodeTimeout);
+    else
+    {
+        libvlc_media_player_play(mp);
+        if (!keyframe)
+            libvlc_media_player_set_position(mp, THUMBNAIL_POSITION);
+
+        done = thumbnailer_wait(sys, mrl, openTimeout, decodeTimeout);
+    }
+
+    /* Stop the media player and give it back to the pool. */
+    thumbnailer_attach_events(sys, mp, false);
+    /* An error or the end of the media is the media's fault, a timeout may
+     * only come from the load of the device */
+    if (!done && sys->error)
+        *badMedia = true;
+
+end:
+    if (mp != NULL)
+        mp_pool_put(libvlc, mp, MP_ROLE_THUMBNAIL, 0);
+    thumbnailer_sys_delete(sys);
+    return done;
+}
+
+/**
+ * thumbnail_create(), accounted in the latency statistics
+ * *duration is set to the time spent, in ns
+ **/
+static bool thumbnail_create_timed(libvlc_instance_t *libvlc, const char *mrl,
+                                   char *frameData, unsigned frameWidth, unsigned frameHeight,
+                                   int mode, int64_t *duration)
+{
+    if (mode < 0 || mode >= THUMBNAIL_MODES)
+        mode = THUMBNAIL_ACCURATE;
+
+    failure_t key = failure_key(mrl);
+    if (failure_cache_has(&key))
+    {
+        *duration = 0;
+        pthread_mutex_lock(&stats.lock);
+        stats.modes[mode].skipped++;
+        pthread_mutex_unlock(&stats.lock);
+        return false;
+    }
+
+    bool badMedia;
+    int64_t start = monotonic_ns();
+    bool done = thumbnail_create(libvlc, mrl, frameData, frameWidth, frameHeight,
+                                 mode, &key, &badMedia);
+    *duration = monotonic_ns() - start;
+    if (badMedia)
+        failure_cache_add(&key);
+
+    pthread_mutex_lock(&stats.lock);
+    if (done)
+        stats.modes[mode].created++;
+    else
+        stats.modes[mode].failed++;
+    stats.modes[mode].time += *duration;
+    if (*duration > stats.modes[mode].max_time)
+        stats.modes[mode].max_time = *duration;
+    pthread_mutex_unlock(&stats.lock);
+
+    LOGD("Thumbnail of %s in %lld ms (mode %d)", mrl, (long long)(*duration / 1000000), mode);
+    return done;
+}
+
+/**
+ * Thumbnailer main function.
+ * return null if the thumbail generation failed.
+ **/
+jbyteArray Java_org_videolan_libvlc_LibVLC_getThumbnail(JNIEnv *env, jobject thiz,
+                                                        jlong instance, jstring filePath,
+                                                        const jint frameWidth, const jint frameHeight,
+                                                        jint mode)
+{
+    libvlc_instance_t *libvlc = (libvlc_instance_t *)(intptr_t)instance;
+    jbyteArray byteArray = NULL;
 
     /* Allocate the memory to store the thumbnail. */
-    unsigned frameSize = frameWidth * frameHeight * PIXEL_SIZE;
-    sys->frameData = calloc(frameSize, 1);
-    if (sys->frameData == NULL)
+    const jsize frameSize = frameWidth * frameHeight * PIXEL_SIZE;
+    char *frameData = calloc(frameSize, 1);
+    if (frameData == NULL)
     {
         LOGE("Could not allocate the memory to store the thumbnail!");
+        return NULL;
+    }
+
+    const char *mrl = (*env)->GetStringUTFChars(env, filePath, NULL);
+    if (mrl == NULL)
+        goto end;
+    int64_t duration;
+    bool done = thumbnail_create_timed(libvlc, mrl, frameData, frameWidth, frameHeight,
+                                       mode, &duration);
+    (*env)->ReleaseStringUTFChars(env, filePath, mrl);
+    if (!done)
+        goto end;
+
+    /* Create the Java byte array to return the create thumbnail. */
+    byteArray = (*env)->NewByteArray(env, frameSize);
+    if (byteArray == NULL)
+    {
+        LOGE("Could not allocate the Java byte array to store the frame!");
         goto end;
     }
+    (*env)->SetByteArrayRegion(env, byteArray, 0, frameSize, (const jbyte *)frameData);
 
-    /* Set the video format and the callbacks. */
-    libvlc_video_set_format(mp, "RGBA", thumbWidth, thumbHeight, sys->thumbPitch);
-    libvlc_video_set_callbacks(mp, thumbnailer_lock, thumbnailer_unlock,
-                               NULL, (void*)sys);
-    sys->state = THUMB_SEEKING;
+end:
+    free(frameData);
+    return byteArray;
+}
 
-    /* Play the media. */
-    libvlc_media_player_play(mp);
-    libvlc_media_player_set_position(mp, THUMBNAIL_POSITION);
+/**
+ * Create a thumbnail directly in frame, a direct buffer of at least
+ * frameWidth x frameHeight RGBA pixels, without any copy.
+ * return false if the thumbail generation failed.
+ **/
+jboolean Java_org_videolan_libvlc_LibVLC_getThumbnailInto(JNIEnv *env, jobject thiz,
+                                                          jlong instance, jstring filePath,
+                                                          jobject frame,
+                                                          jint frameWidth, jint frameHeight,
+                                                          jint mode)
+{
+    libvlc_instance_t *libvlc = (libvlc_instance_t *)(intptr_t)instance;
+
+    const jlong frameSize = (jlong)frameWidth * frameHeight * PIXEL_SIZE;
+    char *frameData = (*env)->GetDirectBufferAddress(env, frame);
+    if (frameData == NULL || (*env)->GetDirectBufferCapacity(env, frame) < frameSize)
+    {
+        LOGE("The thumbnail needs a direct buffer of %lld bytes", (long long)frameSize);
+        return JNI_FALSE;
+    }
+    memset(frameData, 0, frameSize);
+
+    const char *mrl = (*env)->GetStringUTFChars(env, filePath, NULL);
+    if (mrl == NULL)
+        return JNI_FALSE;
+    int64_t duration;
+    bool done = thumbnail_create_timed(libvlc, mrl, frameData, frameWidth, frameHeight,
+                                       mode, &duration);
+    (*env)->ReleaseStringUTFChars(env, filePath, mrl);
+    return done;
+}
+
+
+
+/*
+ * Thumbnail strips: evenly spaced keyframes, created in a single session
+ * and packed in the tiles of an atlas, for the seek previews.
+ */
+
+/**
+ * Fill atlas, a zeroed frame of columns tiles per row, with the thumbnails
+ * of count keyframes. times receives the time of each tile, in ms, or -1
+ * if the tile could not be created.
+ * Return the number of tiles created.
+ **/
+static unsigned thumbnail_strip_create(libvlc_instance_t *libvlc, const char *mrl,
+                                       char *atlas, unsigned tileWidth, unsigned tileHeight,
+                                       unsigned columns, unsigned count, jlong *times)
+{
+    unsigned created = 0;
+    for (unsigned i = 0; i < count; ++i)
+        times[i] = -1;
+
+    failure_t key = failure_key(mrl);
+    if (failure_cache_has(&key))
+        return 0;
+
+    thumbnailer_sys_t *sys = thumbnailer_sys_new();
+    if (sys == NULL)
+        return 0;
+
+    libvlc_media_t *m;
+    unsigned videoWidth, videoHeight;
+    libvlc_time_t length;
+    bool badMedia;
+    libvlc_media_player_t *mp = thumbnailer_open(libvlc, mrl, &m, &videoWidth, &videoHeight,
+                                                 &length, &badMedia);
+    if (mp == NULL)
+    {
+        if (badMedia)
+            failure_cache_add(&key);
+        goto end;
+    }
+
+    if (length < (libvlc_time_t)count)
+    {
+        LOGE("Could not get the length of %s for its strip", mrl);
+        libvlc_media_release(m);
+        goto end;
+    }
+
+    /* Take the middle of each interval */
+    const libvlc_time_t step = length / count;
+    add_keyframe_options(m, step / 2);
+    libvlc_media_release(m);
+
+    unsigned thumbWidth, thumbHeight, offsetX, offsetY;
+    thumbnailer_fit(videoWidth, videoHeight, tileWidth, tileHeight,
+                    &thumbWidth, &thumbHeight, &offsetX, &offsetY);
+
+    const unsigned pitch = columns * tileWidth * PIXEL_SIZE;
+    if (!thumbnailer_setup(sys, mp, thumbWidth, thumbHeight, pitch))
+        goto end;
+
+    thumbnailer_attach_events(sys, mp, true);
+
+    unsigned openTimeout, decodeTimeout;
+    thumbnailer_timeouts(&key, length, &openTimeout, &decodeTimeout);
+
+    int64_t start = monotonic_ns();
+    for (unsigned i = 0; i < count; ++i)
+    {
+        char *tile = atlas + (i / columns) * tileHeight * pitch
+                   + (i % columns) * tileWidth * PIXEL_SIZE;
+        libvlc_time_t time = step * i + step / 2;
+
+        /* The first tile is the start of the input, the next ones are
+         * reached by seeking forward while playing. */
+        pthread_mutex_lock(&sys->doneMutex);
+        sys->picture = tile + offsetY * pitch + offsetX * PIXEL_SIZE;
+        sys->state = i == 0 ? THUMB_DROP_FIRST_FRAME : THUMB_SEEKING;
+        sys->seekTime = time - step / 2;
+        pthread_mutex_unlock(&sys->doneMutex);
+        if (i == 0)
+            libvlc_media_player_play(mp);
+        else
+            libvlc_media_player_set_time(mp, time);
 
-    const int wait_time = 50000;
-    const int max_attempts = 100;
-    for (int i = 0; i < max_attempts; ++i) {
-        if (libvlc_media_player_is_playing(mp) && libvlc_media_player_get_position(mp) >= THUMBNAIL_POSITION)
+        if (thumbnailer_wait(sys, mrl, openTimeout, decodeTimeout))
+        {
+            times[i] = time;
+            created++;
+        }
+        else if (sys->error || !sys->playing)
             break;
-        usleep(wait_time);
     }
+    LOGD("Strip of %u/%u thumbnails of %s in %lld ms", created, count, mrl,
+         (long long)((monotonic_ns() - start) / 1000000));
 
-    /* Wait for the thumbnail to be generated. */
-    pthread_mutex_lock(&sys->doneMutex);
-    sys->state = THUMB_SEEKED;
-    struct timespec deadline;
-    clock_gettime(CLOCK_REALTIME, &deadline);
-    deadline.tv_sec += 10; /* amount of seconds before we abort thumbnailer */
-    do {
-        int ret = pthread_cond_timedwait(&sys->doneCondVar, &sys->doneMutex, &deadline);
-        if (ret == ETIMEDOUT)
+    thumbnailer_attach_events(sys, mp, false);
+
+end:
+    if (mp != NULL)
+        mp_pool_put(libvlc, mp, MP_ROLE_THUMBNAIL, 0);
+    thumbnailer_sys_delete(sys);
+    return created;
+}
+
+/**
+ * Create a strip of times.length thumbnails in atlas, a direct buffer of
+ * columns x rows tiles of tileWidth x tileHeight RGBA pixels, with
+ * rows = ceil(times.length / columns).
+ * return the number of tiles created, times receives their time in ms,
+ * or -1 for the missing ones.
+ **/
+jint Java_org_videolan_libvlc_LibVLC_getThumbnailStrip(JNIEnv *env, jobject thiz,
+                                                       jlong instance, jstring filePath,
+                                                       jobject atlas,
+                                                       jint tileWidth, jint tileHeight,
+                                                       jint columns, jlongArray timesArray)
+{
+    libvlc_instance_t *libvlc = (libvlc_instance_t *)(intptr_t)instance;
+
+    const unsigned count = (*env)->GetArrayLength(env, timesArray);
+    if (count == 0 || columns <= 0 || tileWidth <= 0 || tileHeight <= 0)
+        return 0;
+    const unsigned rows = (count + columns - 1) / columns;
+    const jlong atlasSize = (jlong)columns * tileWidth * rows * tileHeight * PIXEL_SIZE;
+
+    char *atlasData = (*env)->GetDirectBufferAddress(env, atlas);
+    if (atlasData == NULL || (*env)->GetDirectBufferCapacity(env, atlas) < atlasSize)
+    {
+        LOGE("The strip needs a direct buffer of %lld bytes", (long long)atlasSize);
+        return 0;
+    }
+    memset(atlasData, 0, atlasSize);
+
+    jlong *times = malloc(count * sizeof(*times));
+    if (times == NULL)
+        return 0;
+
+    unsigned created = 0;
+    const char *mrl = (*env)->GetStringUTFChars(env, filePath, NULL);
+    if (mrl != NULL)
+    {
+        created = thumbnail_strip_create(libvlc, mrl, atlasData, tileWidth, tileHeight,
+                                         columns, count, times);
+        (*env)->ReleaseStringUTFChars(env, filePath, mrl);
+    }
+    (*env)->SetLongArrayRegion(env, timesArray, 0, count, times);
+    free(times);
+    return created;
+}
+
+/*
+ * Batch thumbnailer: the media are shared among a pool of native worker
+ * threads, and the thumbnails are handed to the Java callback, on the
+ * calling thread, in the order they complete.
+ */
+
+#define BATCH_MAX_THREADS 8
+
+typedef struct batch_result
+{
+    struct batch_result *next;
+    unsigned index;
+    char *frameData;            /// NULL on failure
+    int64_t duration;           /// in ns
+} batch_result_t;
+
+typedef struct
+{
+    libvlc_instance_t *libvlc;
+    char **mrls;
+    unsigned count;
+    unsigned frameWidth;
+    unsigned frameHeight;
+    int mode;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wait;
+    unsigned next;              /// next media to take
+    unsigned workers;           /// worker threads still running
+    bool cancelled;
+    batch_result_t *first;      /// completed, not delivered yet
+    batch_result_t **last;
+} batch_t;
+
+static void *batch_worker(void *data)
+{
+    batch_t *batch = data;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&batch->lock);
+        unsigned index = batch->next;
+        bool done = batch->cancelled || index >= batch->count;
+        if (!done)
+            batch->next++;
+        pthread_mutex_unlock(&batch->lock);
+        if (done)
             break;
-    } while (sys->state != THUMB_DONE);
-    pthread_mutex_unlock(&sys->doneMutex);
 
-    /* Stop and release the media player. */
-    libvlc_media_player_stop(mp);
-    libvlc_media_player_release(mp);
+        batch_result_t *result = malloc(sizeof(*result));
+        if (result == NULL)
+            break;
+        result->next = NULL;
+        result->index = index;
+        result->duration = 0;
+        result->frameData = calloc(batch->frameWidth * batch->frameHeight, PIXEL_SIZE);
+        if (result->frameData != NULL
+         && !thumbnail_create_timed(batch->libvlc, batch->mrls[index], result->frameData,
+                                    batch->frameWidth, batch->frameHeight,
+                                    batch->mode, &result->duration))
+        {
+            free(result->frameData);
+            result->frameData = NULL;
+        }
+
+        pthread_mutex_lock(&batch->lock);
+        *batch->last = result;
+        batch->last = &result->next;
+        pthread_cond_signal(&batch->wait);
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    /* The deliverer stops waiting once all the workers are gone */
+    pthread_mutex_lock(&batch->lock);
+    batch->workers--;
+    pthread_cond_signal(&batch->wait);
+    pthread_mutex_unlock(&batch->lock);
+    return NULL;
+}
+
+/**
+ * Create the thumbnails of a list of media with up to threads worker
+ * threads. For each media, in completion order, the callback is called
+ * with the index of the media, its thumbnail (null on failure), lent as a
+ * direct buffer without copy, and the time spent creating it, in ns. The
+ * callback returns false to cancel the remaining media.
+ * Return the number of media handed to the callback.
+ **/
+jint Java_org_videolan_libvlc_LibVLC_getThumbnails(JNIEnv *env, jobject thiz,
+                                                   jlong instance, jobjectArray mrlArray,
+                                                   jint frameWidth, jint frameHeight,
+                                                   jint mode, jint threads, jobject callback)
+{
+    batch_t batch = {
+        .libvlc = (libvlc_instance_t *)(intptr_t)instance,
+        .count = (*env)->GetArrayLength(env, mrlArray),
+        .frameWidth = frameWidth,
+        .frameHeight = frameHeight,
+        .mode = mode,
+    };
+    batch.last = &batch.first;
+    jint delivered = 0;
+    if (batch.count == 0)
+        return 0;
 
-    if (sys->state == THUMB_DONE) {
-        /* Create the Java byte array to return the create thumbnail. */
-        byteArray = (*env)->NewByteArray(env, frameSize);
-        if (byteArray == NULL)
+    batch.mrls = calloc(batch.count, sizeof(*batch.mrls));
+    if (batch.mrls == NULL)
+        return 0;
+    for (unsigned i = 0; i < batch.count; ++i)
+    {
+        jstring mrl = (*env)->GetObjectArrayElement(env, mrlArray, i);
+        const char *psz_mrl = (*env)->GetStringUTFChars(env, mrl, NULL);
+        batch.mrls[i] = psz_mrl != NULL ? strdup(psz_mrl) : NULL;
+        if (psz_mrl != NULL)
+            (*env)->ReleaseStringUTFChars(env, mrl, psz_mrl);
+        (*env)->DeleteLocalRef(env, mrl);
+        if (batch.mrls[i] == NULL)
         {
-            LOGE("Could not allocate the Java byte array to store the frame!");
+            batch.count = i;
             goto end;
         }
+    }
+
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.wait, NULL);
 
-        (*env)->SetByteArrayRegion(env, byteArray, 0, frameSize,
-                (jbyte *)sys->frameData);
+    if (threads < 1)
+        threads = 1;
+    if (threads > BATCH_MAX_THREADS)
+        threads = BATCH_MAX_THREADS;
+    if ((unsigned)threads > batch.count)
+        threads = batch.count;
+
+    pthread_t workers[BATCH_MAX_THREADS];
+    int started = 0;
+    pthread_mutex_lock(&batch.lock);
+    while (started < threads)
+    {
+        batch.workers++;
+        if (pthread_create(&workers[started], NULL, batch_worker, &batch) != 0)
+        {
+            batch.workers--;
+            break;
+        }
+        started++;
     }
+    pthread_mutex_unlock(&batch.lock);
+    if (started == 0)
+        LOGE("Could not start the thumbnailer threads");
+
+    /* Deliver the results as they come. A worker out of memory drops its
+     * media and exits, so the results may run out before the count. */
+    const jlong frameSize = (jlong)frameWidth * frameHeight * PIXEL_SIZE;
+    pthread_mutex_lock(&batch.lock);
+    while (!batch.cancelled && delivered < batch.count)
+    {
+        while (batch.first == NULL && batch.workers > 0)
+            pthread_cond_wait(&batch.wait, &batch.lock);
+        if (batch.first == NULL)
+            break;
+        batch_result_t *result = batch.first;
+        batch.first = result->next;
+        if (batch.first == NULL)
+            batch.last = &batch.first;
+        pthread_mutex_unlock(&batch.lock);
+
+        /* The frame is lent to Java, without copy, during the callback */
+        jobject buffer = NULL;
+        if (result->frameData != NULL)
+            buffer = (*env)->NewDirectByteBuffer(env, result->frameData, frameSize);
+        jboolean more = (*env)->CallBooleanMethod(env, callback,
+                                                  fields.ThumbnailCallback.onThumbnailID,
+                                                  (jint)result->index, buffer,
+                                                  (jlong)result->duration);
+        if ((*env)->ExceptionCheck(env))
+        {
+            (*env)->ExceptionClear(env);
+            more = JNI_FALSE;
+        }
+        if (buffer != NULL)
+            (*env)->DeleteLocalRef(env, buffer);
+        free(result->frameData);
+        free(result);
+        delivered++;
+
+        pthread_mutex_lock(&batch.lock);
+        if (!more)
+            batch.cancelled = true;
+    }
+    /* Media being processed are not taken back, the workers finish them */
+    batch.cancelled = true;
+    pthread_mutex_unlock(&batch.lock);
+
+    for (int i = 0; i < started; ++i)
+        pthread_join(workers[i], NULL);
+
+    for (batch_result_t *result = batch.first, *next; result != NULL; result = next)
+    {
+        next = result->next;
+        free(result->frameData);
+        free(result);
+    }
+    pthread_cond_destroy(&batch.wait);
+    pthread_mutex_destroy(&batch.lock);
 
 end:
-    pthread_mutex_destroy(&sys->doneMutex);
-    pthread_cond_destroy(&sys->doneCondVar);
-    free(sys->frameData);
-    free(sys->thumbData);
-    free(sys);
-enomem:
-    return byteArray;
+    for (unsigned i = 0; i < batch.count; ++i)
+        free(batch.mrls[i]);
+    free(batch.mrls);
+    return delivered;
+}
+
+/**
+ * Bound the THUMBNAIL_BEST search to candidates keyframes, and to time ms
+ **/
+void Java_org_videolan_libvlc_LibVLC_setThumbnailBudget(JNIEnv *env, jobject thiz,
+                                                        jint candidates, jint time)
+{
+    pthread_mutex_lock(&budget.lock);
+    budget.candidates = candidates < 1 ? 1
+                      : candidates > THUMBNAIL_MAX_CANDIDATES ? THUMBNAIL_MAX_CANDIDATES
+                      : candidates;
+    budget.time = time > 0 ? time : 0;
+    pthread_mutex_unlock(&budget.lock);
+}
+
+/**
+ * Fill stats with, for each mode: thumbnails created, failures, total and
+ * maximum time in ns, and known bad media skipped
+ **/
+void Java_org_videolan_libvlc_LibVLC_nativeGetThumbnailStats(JNIEnv *env, jobject thiz,
+                                                             jlongArray statsArray)
+{
+    jlong values[5 * THUMBNAIL_MODES];
+    pthread_mutex_lock(&stats.lock);
+    for (unsigned i = 0; i < THUMBNAIL_MODES; ++i)
+    {
+        values[5 * i] = stats.modes[i].created;
+        values[5 * i + 1] = stats.modes[i].failed;
+        values[5 * i + 2] = stats.modes[i].time;
+        values[5 * i + 3] = stats.modes[i].max_time;
+        values[5 * i + 4] = stats.modes[i].skipped;
+    }
+    pthread_mutex_unlock(&stats.lock);
+    (*env)->SetLongArrayRegion(env, statsArray, 0, 5 * THUMBNAIL_MODES, values);
 }
@@ -21,10 +21,119 @@
 #ifndef LIBVLCJNI_UTILS_H
 #define LIBVLCJNI_UTILS_H
 
+/* Classes, fields and methods IDs used by the JNI entry points and by the
+ * native callbacks. They are looked up once in JNI_OnLoad, see libvlcjni.c */
+struct fields {
+    struct {
+        jclass clazz;
+        jfieldID mLibVlcInstanceID;
+        jfieldID mInternalMediaPlayerInstanceID;
+        jmethodID getAoutID;
+        jmethodID getVoutID;
+        jmethodID timeStretchingEnabledID;
+        jmethodID frameSkipEnabledID;
+        jmethodID getDeblockingID;
+        jmethodID getNetworkCachingID;
+        jmethodID getChromaID;
+        jmethodID getSubtitlesEncodingID;
+        jmethodID isVerboseModeID;
+        jmethodID getCachePathID;
+        jmethodID getHardwareAccelerationID;
+        jmethodID applyEqualizerID;
+        jmethodID initAoutID;
+        jmethodID playAudioID;
+        jmethodID useDirectAudioBuffersID;
+        jmethodID playAudioDirectID;
+        jmethodID getAudioLatencyID;
+        jmethodID isAoutFormatSupportedID;
+        jmethodID pauseAoutID;
+        jmethodID closeAoutID;
+        jmethodID onNativeCrashID;
+    } LibVLC;
+    struct {
+        jclass clazz;
+        jmethodID callbackID;
+    } EventHandler;
+    struct {
+        jclass clazz;
+        jmethodID setSurfaceSizeID;
+    } IVideoPlayer;
+    struct {
+        jclass clazz;
+        jmethodID onThumbnailID;
+    } ThumbnailCallback;
+    struct {
+        jclass clazz;
+        jmethodID onParsedID;
+    } ParseCallback;
+    struct {
+        jclass clazz;
+        jmethodID onChangesID;
+    } WatchCallback;
+    struct {
+        jclass clazz;
+        jmethodID ctorID;
+        jfieldID TypeID;
+        jfieldID IdID;
+        jfieldID CodecID;
+        jfieldID LanguageID;
+        jfieldID BitrateID;
+        jfieldID HeightID;
+        jfieldID WidthID;
+        jfieldID FramerateID;
+        jfieldID ChannelsID;
+        jfieldID SamplerateID;
+        jfieldID LengthID;
+        jfieldID TitleID;
+        jfieldID ArtistID;
+        jfieldID AlbumID;
+        jfieldID GenreID;
+        jfieldID ArtworkURLID;
+    } TrackInfo;
+    struct {
+        jclass clazz;
+        jmethodID ctorID;
+        jmethodID putIntID;
+        jmethodID putFloatID;
+        jmethodID putStringID;
+    } Bundle;
+    struct {
+        jclass clazz;
+        jmethodID appendID;
+    } StringBuffer;
+    struct {
+        jclass clazz;
+        jmethodID addID;
+        jmethodID removeID;
+    } ArrayList;
+    struct {
+        jclass clazz;
+    } String;
+    /* Bundle keys */
+    jstring dataKey;
+    jstring itemUriKey;
+    jstring itemIndexKey;
+};
+
+extern struct fields fields;
+
+/**
+ * Get the JNIEnv of the calling thread. Native threads are attached to the
+ * JVM on their first call, with the given name, and detached when they exit.
+ * Returns NULL if the thread could not be attached.
+ */
+JNIEnv *jni_get_env(const char *name);
+
 libvlc_media_t *new_media(jlong instance, JNIEnv *env, jobject thiz, jstring fileLocation, bool noOmx, bool noVideo);
 
 libvlc_media_player_t *getMediaPlayer(JNIEnv *env, jobject thiz);
 
+/**
+ * Stop the asynchronous parsing of the media: the pending jobs are
+ * cancelled and their callbacks called from the calling thread.
+ */
+void parse_async_stop(JNIEnv *env);
+
 jint getInt(JNIEnv *env, jobject thiz, const char* field);
 
 void setInt(JNIEnv *env, jobject item, const char* field, jint value);
@@ -37,6 +146,8 @@ void setFloat(JNIEnv *env, jobject item, const char* field, jfloat value);
 
 void setString(JNIEnv *env, jobject item, const char* field, const char* text);
 
+void setStringField(JNIEnv *env, jobject item, jfieldID fieldID, const char* text);
+
 void arrayListGetIDs(JNIEnv *env, jclass* p_class, jmethodID* p_add, jmethodID* p_remove);
 
 void arrayListStringAdd(JNIEnv *env, jclass class, jmethodID methodID, jobject arrayList, const char* str);
@@ -23,13 +23,15 @@
 
 #include <jni.h>
 
-/** Unique Java VM instance, as defined in libvlcjni.c */
-extern JavaVM *myVm;
+#include "utils.h"
+
+#define THREAD_NAME "jni_vout"
 
 pthread_mutex_t vout_android_lock;
 pthread_cond_t vout_android_surf_attached;
 static void *vout_android_surf = NULL;
 static void *vout_android_gui = NULL;
+static jmethodID vout_android_gui_hw_error_id = NULL;
 static jobject vout_android_java_surf = NULL;
 static jobject vout_android_subtitles_surf = NULL;
 static bool vout_video_player_activity_created = false;
@@ -64,15 +66,12 @@ void jni_EventHardwareAccelerationError()
     if (vout_android_gui == NULL)
         return;
 
-    JNIEnv *env;
-    (*myVm)->AttachCurrentThread(myVm, &env, NULL);
-
-    jclass cls = (*env)->GetObjectClass(env, vout_android_gui);
-    jmethodID methodId = (*env)->GetMethodID(env, cls, "eventHardwareAccelerationError", "()V");
-    (*env)->CallVoidMethod(env, vout_android_gui, methodId);
+    JNIEnv *env = jni_get_env(THREAD_NAME);
+    if (env == NULL)
+        return;
 
-    (*env)->DeleteLocalRef(env, cls);
-    (*myVm)->DetachCurrentThread(myVm);
+    if (vout_android_gui_hw_error_id != NULL)
+        (*env)->CallVoidMethod(env, vout_android_gui, vout_android_gui_hw_error_id);
 }
 
 void jni_SetAndroidSurfaceSizeEnv(JNIEnv *p_env, int width, int height, int visible_width, int visible_height, int sar_num, int sar_den)
@@ -80,22 +79,17 @@ void jni_SetAndroidSurfaceSizeEnv(JNIEnv *p_env, int width, int height, int visi
     if (vout_android_gui == NULL)
         return;
 
-    jclass cls = (*p_env)->GetObjectClass (p_env, vout_android_gui);
-    jmethodID methodId = (*p_env)->GetMethodID (p_env, cls, "setSurfaceSize", "(IIIIII)V");
-
-    (*p_env)->CallVoidMethod (p_env, vout_android_gui, methodId, width, height, visible_width, visible_height, sar_num, sar_den);
-
-    (*p_env)->DeleteLocalRef(p_env, cls);
+    (*p_env)->CallVoidMethod (p_env, vout_android_gui, fields.IVideoPlayer.setSurfaceSizeID,
+                              width, height, visible_width, visible_height, sar_num, sar_den);
 }
 
 void jni_SetAndroidSurfaceSize(int width, int height, int visible_width, int visible_height, int sar_num, int sar_den)
 {
-    JNIEnv *p_env;
+    JNIEnv *p_env = jni_get_env(THREAD_NAME);
+    if (p_env == NULL)
+        return;
 
-    (*myVm)->AttachCurrentThread (myVm, &p_env, NULL);
     jni_SetAndroidSurfaceSizeEnv(p_env, width, height, visible_width, visible_height, sar_num, sar_den);
-
-    (*myVm)->DetachCurrentThread (myVm);
 }
 
 bool jni_IsVideoPlayerActivityCreated() {
@@ -135,6 +129,13 @@ void Java_org_videolan_libvlc_LibVLC_attachSurface(JNIEnv *env, jobject thiz, jo
         (*env)->DeleteLocalRef(env, clz);
     }
     vout_android_gui = (*env)->NewGlobalRef(env, gui);
+    /* eventHardwareAccelerationError() is not part of IVideoPlayer, look it
+     * up once here instead of on each error. */
+    clz = (*env)->GetObjectClass(env, gui);
+    vout_android_gui_hw_error_id = (*env)->GetMethodID(env, clz, "eventHardwareAccelerationError", "()V");
+    if (vout_android_gui_hw_error_id == NULL)
+        (*env)->ExceptionClear(env);
+    (*env)->DeleteLocalRef(env, clz);
     vout_android_java_surf = (*env)->NewGlobalRef(env, surf);
     pthread_cond_signal(&vout_android_surf_attached);
     pthread_mutex_unlock(&vout_android_lock);
@@ -148,6 +149,7 @@ void Java_org_videolan_libvlc_LibVLC_detachSurface(JNIEnv *env, jobject thiz) {
     if (vout_android_java_surf != NULL)
         (*env)->DeleteGlobalRef(env, vout_android_java_surf);
     vout_android_gui = NULL;
+    vout_android_gui_hw_error_id = NULL;
     vout_android_java_surf = NULL;
     pthread_mutex_unlock(&vout_android_lock);
 }
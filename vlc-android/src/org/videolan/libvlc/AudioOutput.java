@@ -20,9 +20,13 @@
 
 package org.videolan.libvlc;
 
+import java.nio.ByteBuffer;
+
+import android.annotation.TargetApi;
 import android.media.AudioFormat;
 import android.media.AudioManager;
 import android.media.AudioTrack;
+import android.os.Build;
 import android.util.Log;
 
 public class AudioOutput {
@@ -39,16 +43,66 @@ public class AudioOutput {
     private AudioTrack mAudioTrack;
     private static final String TAG = "LibVLC/aout";
 
-    public void init(int sampleRateInHz, int channels, int samples) {
-        Log.d(TAG, sampleRateInHz + ", " + channels + ", " + samples + "=>" + channels * samples);
-        int minBufferSize = AudioTrack.getMinBufferSize(sampleRateInHz,
-                                                        AudioFormat.CHANNEL_OUT_STEREO,
-                                                        AudioFormat.ENCODING_PCM_16BIT);
+    /* AudioFormat.ENCODING_PCM_FLOAT, API 21 */
+    private static final int ENCODING_PCM_FLOAT = 4;
+    /* AudioFormat.CHANNEL_OUT_7POINT1_SURROUND, side channels are API 21 */
+    private static final int CHANNEL_OUT_7POINT1_SURROUND = 0x18fc;
+
+    /**
+     * @return true if the AudioTrack can be fed directly from direct
+     * ByteBuffers, without copying the samples into a Java byte array
+     */
+    public static boolean supportsDirectBuffers() {
+        /* AudioTrack.write(ByteBuffer, int, int) */
+        return Build.VERSION.SDK_INT >= 21;
+    }
+
+    /**
+     * @return the AudioTrack channel mask for this number of channels, in
+     * the order produced by the native code, or 0 if not supported
+     */
+    private static int getChannelMask(int channels) {
+        switch (channels) {
+        case 1:
+            return AudioFormat.CHANNEL_OUT_MONO;
+        case 2:
+            return AudioFormat.CHANNEL_OUT_STEREO;
+        case 4:
+            return AudioFormat.CHANNEL_OUT_QUAD;
+        case 6:
+            return AudioFormat.CHANNEL_OUT_5POINT1;
+        case 8:
+            return Build.VERSION.SDK_INT >= 21 ? CHANNEL_OUT_7POINT1_SURROUND : 0;
+        default:
+            return 0;
+        }
+    }
+
+    /**
+     * @return true if an AudioTrack can be created with this format
+     */
+    public static boolean isFormatSupported(int sampleRateInHz, int channels, boolean floatSamples) {
+        int channelMask = getChannelMask(channels);
+        if (channelMask == 0)
+            return false;
+        if (floatSamples && Build.VERSION.SDK_INT < 21)
+            return false;
+        int encoding = floatSamples ? ENCODING_PCM_FLOAT : AudioFormat.ENCODING_PCM_16BIT;
+        return AudioTrack.getMinBufferSize(sampleRateInHz, channelMask, encoding) > 0;
+    }
+
+    public void init(int sampleRateInHz, int channels, int samples, boolean floatSamples) {
+        Log.d(TAG, sampleRateInHz + ", " + channels + ", " + samples + "=>" + channels * samples
+                + (floatSamples ? " float" : ""));
+        int channelMask = getChannelMask(channels);
+        int encoding = floatSamples ? ENCODING_PCM_FLOAT : AudioFormat.ENCODING_PCM_16BIT;
+        int bytesPerSample = floatSamples ? 4 : 2;
+        int minBufferSize = AudioTrack.getMinBufferSize(sampleRateInHz, channelMask, encoding);
         mAudioTrack = new AudioTrack(AudioManager.STREAM_MUSIC,
                                      sampleRateInHz,
-                                     AudioFormat.CHANNEL_OUT_STEREO,
-                                     AudioFormat.ENCODING_PCM_16BIT,
-                                     Math.max(minBufferSize, channels * samples * 2),
+                                     channelMask,
+                                     encoding,
+                                     Math.max(minBufferSize, channels * samples * bytesPerSample),
                                      AudioTrack.MODE_STREAM);
     }
 
@@ -68,6 +122,20 @@ public class AudioOutput {
         mAudioTrack.play();
     }
 
+    /**
+     * Only called if supportsDirectBuffers()
+     */
+    @TargetApi(21)
+    public void playBuffer(ByteBuffer audioData, int bufferSize) {
+        if (mAudioTrack.getState() == AudioTrack.STATE_UNINITIALIZED)
+            return;
+        audioData.clear();
+        if (mAudioTrack.write(audioData, bufferSize, AudioTrack.WRITE_BLOCKING) != bufferSize) {
+            Log.w(TAG, "Could not write all the samples to the audio device");
+        }
+        mAudioTrack.play();
+    }
+
     public void pause() {
         mAudioTrack.pause();
     }
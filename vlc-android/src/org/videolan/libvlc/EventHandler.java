@@ -25,6 +25,7 @@ import java.util.ArrayList;
 import android.os.Bundle;
 import android.os.Handler;
 import android.os.Message;
+import android.util.Log;
 
 public class EventHandler {
 
@@ -96,9 +97,26 @@ public class EventHandler {
 
     public static final int HardwareAccelerationError         = 0x3000;
 
+    private static final String TAG = "LibVLC/EventHandler";
+
+    /** Maximum number of native events drained at once */
+    private static final int EVENT_BATCH_SIZE = 64;
+    /** Native wait timeout, in ms */
+    private static final int EVENT_WAIT_TIMEOUT = 1000;
+
     private ArrayList<Handler> mEventHandler;
     private static EventHandler mInstance;
 
+    private Thread mEventThread;
+    private volatile boolean mEventThreadRunning = false;
+
+    /** Delivery statistics of the native events, see getEventStats() */
+    private final Object mStatsLock = new Object();
+    private long mBatchCount = 0;
+    private long mEventCount = 0;
+    private long mTotalLatency = 0; /* in ns */
+    private long mMaxLatency = 0; /* in ns */
+
     EventHandler() {
         mEventHandler = new ArrayList<Handler>();
     }
@@ -128,4 +146,148 @@ public class EventHandler {
             mEventHandler.get(i).sendMessage(msg);
         }
     }
+
+    /**
+     * Enable or disable an event type at the source: disabled events are
+     * dropped by the native callback, before any JNI call.
+     * Only the media player events and MediaParsedChanged can be disabled.
+     */
+    public void setEventEnabled(int event, boolean enabled) {
+        nativeSetEventEnabled(event, enabled);
+    }
+
+    /**
+     * Deliver at most one MediaPlayerTimeChanged and one
+     * MediaPlayerPositionChanged event per interval.
+     *
+     * @param interval minimum period in ms, 0 to deliver them all
+     */
+    public void setProgressInterval(int interval) {
+        nativeSetProgressInterval(interval);
+    }
+
+    /**
+     * Start the thread draining the native event queue.
+     * Until it runs, the native code calls callback() for each event.
+     */
+    synchronized void startEventThread() {
+        if (mEventThread != null)
+            return;
+        nativeStartEvents();
+        mEventThreadRunning = true;
+        mEventThread = new Thread(new Runnable() {
+            @Override
+            public void run() {
+                drainEvents();
+            }
+        }, "LibVLC EventHandler");
+        mEventThread.start();
+    }
+
+    synchronized void stopEventThread() {
+        if (mEventThread == null)
+            return;
+        mEventThreadRunning = false;
+        nativeStopEvents();
+        try {
+            mEventThread.join();
+        } catch (InterruptedException e) {
+            Log.w(TAG, "Interrupted while stopping the event thread");
+        }
+        mEventThread = null;
+    }
+
+    private void drainEvents() {
+        final int[] types = new int[EVENT_BATCH_SIZE];
+        final long[] times = new long[EVENT_BATCH_SIZE];
+        final float[] positions = new float[EVENT_BATCH_SIZE];
+        final int[] values = new int[EVENT_BATCH_SIZE];
+        final long[] dates = new long[EVENT_BATCH_SIZE];
+
+        while (mEventThreadRunning) {
+            int count = nativeWaitEvents(types, times, positions, values, dates, EVENT_WAIT_TIMEOUT);
+            if (count < 0)
+                break;
+            if (count == 0)
+                continue;
+
+            for (int i = 0; i < count; ++i) {
+                Bundle b = new Bundle();
+                switch (types[i]) {
+                    case MediaPlayerTimeChanged:
+                        b.putInt("data", (int) times[i]);
+                        break;
+                    case MediaPlayerPositionChanged:
+                        b.putFloat("data", positions[i]);
+                        break;
+                    case MediaPlayerVout:
+                        b.putInt("data", values[i]);
+                        break;
+                }
+                callback(types[i], b);
+            }
+
+            /* Both dates come from CLOCK_MONOTONIC */
+            long now = System.nanoTime();
+            synchronized (mStatsLock) {
+                mBatchCount++;
+                mEventCount += count;
+                for (int i = 0; i < count; ++i) {
+                    long latency = now - dates[i];
+                    mTotalLatency += latency;
+                    if (latency > mMaxLatency)
+                        mMaxLatency = latency;
+                }
+            }
+        }
+    }
+
+    public static class EventStats {
+        /** Events received from libvlc */
+        public int received;
+        /** Events dropped at the source because they were disabled */
+        public int filtered;
+        /** Time and position events dropped by the rate limit */
+        public int throttled;
+        /** Events queued by the native code */
+        public int queued;
+        /** Events dropped because a newer time or position update superseded them */
+        public int coalesced;
+        /** Events dropped because the native queue was full */
+        public int dropped;
+        /** Events and batches delivered to the handlers */
+        public long delivered;
+        public long batches;
+        /** Delivery latency, from the native queue to the handlers, in µs */
+        public long averageLatency;
+        public long maxLatency;
+    }
+
+    public EventStats getEventStats() {
+        int[] nativeStats = new int[7];
+        nativeGetEventStats(nativeStats);
+
+        EventStats stats = new EventStats();
+        stats.queued = nativeStats[0];
+        stats.coalesced = nativeStats[2];
+        stats.dropped = nativeStats[3];
+        stats.received = nativeStats[4];
+        stats.filtered = nativeStats[5];
+        stats.throttled = nativeStats[6];
+        synchronized (mStatsLock) {
+            stats.delivered = mEventCount;
+            stats.batches = mBatchCount;
+            stats.averageLatency = mEventCount > 0 ? mTotalLatency / mEventCount / 1000 : 0;
+            stats.maxLatency = mMaxLatency / 1000;
+        }
+        return stats;
+    }
+
+    private native void nativeStartEvents();
+    private native void nativeStopEvents();
+    private native int nativeWaitEvents(int[] types, long[] times, float[] positions,
+                                        int[] values, long[] dates, int timeout);
+    private native void nativeGetEventStats(int[] stats);
+    private native void nativeSetEventEnabled(int event, boolean enabled);
+    private native void nativeSetProgressInterval(int interval);
 }
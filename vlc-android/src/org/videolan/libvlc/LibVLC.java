@@ -21,6 +21,7 @@
 package org.videolan.libvlc;
 
 import java.io.File;
+import java.nio.ByteBuffer;
 import java.util.ArrayList;
 import java.util.Map;
 
@@ -75,6 +76,7 @@ public class LibVLC {
     private float[] equalizer = null;
     private boolean frameSkip = false;
     private int networkCaching = 0;
+    private int audioLatency = 0;
 
     /** Path of application-specific cache */
     private String mCachePath = "";
@@ -84,6 +86,10 @@ public class LibVLC {
 
     /** Check in libVLC already initialized otherwise crash */
     private boolean mIsInitialized = false;
+
+    /** Native thread attachments, see getThreadAttachRate() */
+    private int mLastAttachCount = 0;
+    private long mLastAttachDate = 0;
     public native void attachSurface(Surface surface, IVideoPlayer player);
 
     public native void detachSurface();
@@ -285,6 +291,18 @@ public class LibVLC {
             this.vout = vout;
     }
 
+    /**
+     * Get the target latency of the native audio buffer, in ms
+     * (0 for the default). Only used by the Java AudioTrack output.
+     */
+    public int getAudioLatency() {
+        return audioLatency;
+    }
+
+    public void setAudioLatency(int audioLatency) {
+        this.audioLatency = audioLatency;
+    }
+
     public boolean timeStretchingEnabled() {
         return timeStretching;
     }
@@ -393,6 +411,7 @@ public class LibVLC {
             nativeInit();
             mMediaList = mPrimaryList = new MediaList(this);
             setEventHandler(EventHandler.getInstance());
+            EventHandler.getInstance().startEventThread();
             mIsInitialized = true;
         }
     }
@@ -404,6 +423,7 @@ public class LibVLC {
     public void destroy() {
         Log.v(TAG, "Destroying LibVLC instance");
         nativeDestroy();
+        EventHandler.getInstance().stopEventThread();
         detachEventHandler();
         mIsInitialized = false;
     }
@@ -412,9 +432,17 @@ public class LibVLC {
      * Open the Java audio output.
      * This function is called by the native code
      */
-    public void initAout(int sampleRateInHz, int channels, int samples) {
+    public void initAout(int sampleRateInHz, int channels, int samples, boolean floatSamples) {
         Log.d(TAG, "Opening the java audio output");
-        mAout.init(sampleRateInHz, channels, samples);
+        mAout.init(sampleRateInHz, channels, samples, floatSamples);
+    }
+
+    /**
+     * Tell whether the Java audio output can play this format as is.
+     * This function is called by the native code
+     */
+    public boolean isAoutFormatSupported(int sampleRateInHz, int channels, boolean floatSamples) {
+        return AudioOutput.isFormatSupported(sampleRateInHz, channels, floatSamples);
     }
 
     /**
@@ -425,6 +453,23 @@ public class LibVLC {
         mAout.playBuffer(audioData, bufferSize);
     }
 
+    /**
+     * Tell whether the native code can hand direct buffers to the Java
+     * audio output instead of copying the samples into a byte array.
+     * This function is called by the native code
+     */
+    public boolean useDirectAudioBuffers() {
+        return AudioOutput.supportsDirectBuffers();
+    }
+
+    /**
+     * Play an audio buffer held in native memory
+     * This function is called by the native code
+     */
+    public void playAudioDirect(ByteBuffer audioData, int bufferSize) {
+        mAout.playBuffer(audioData, bufferSize);
+    }
+
     /**
      * Pause the Java audio output
      * This function is called by the native code
@@ -457,6 +502,20 @@ public class LibVLC {
         playMRL(mLibVlcInstance, mrl, options);
     }
 
+    /**
+     * Create and parse the media at this index of the media list ahead, so
+     * that a following playIndex(position) starts it faster.
+     *
+     * @param position The index of the next media
+     */
+    public void preloadIndex(int position) {
+        String mrl = mMediaList.getMRL(position);
+        if (mrl == null)
+            return;
+        String[] options = mMediaList.getMediaOptions(position);
+        preloadMRL(mLibVlcInstance, mrl, options);
+    }
+
     /**
      * Play an MRL directly.
      *
@@ -469,19 +528,135 @@ public class LibVLC {
         playMRL(mLibVlcInstance, mrl, options);
     }
 
+    /**
+     * Get the tracks of a media, then its meta data. The description of
+     * the media is cached natively, keyed by its MRL and the size and date
+     * of its file, and shared with hasVideoTrack() and the thumbnails.
+     */
     public TrackInfo[] readTracksInfo(String mrl) {
         return readTracksInfo(mLibVlcInstance, mrl);
     }
 
+    /**
+     * Receive the result of parseAsync()
+     */
+    public interface ParseCallback {
+        /**
+         * This function is called once per parseAsync(), by a native thread.
+         * @param id the id returned by parseAsync()
+         * @param tracks as readTracksInfo(), or null if the media could not
+         *               be parsed before its timeout, or was cancelled
+         */
+        public void onParsed(int id, TrackInfo[] tracks);
+    }
+
+    /**
+     * Parse a media in the background, without blocking the calling thread.
+     * Many media can be in flight; a media that does not answer is abandoned
+     * after its timeout. The description is cached as with readTracksInfo().
+     * @param timeout in ms, at most 60 s
+     * @return the id of the job, for cancelParse(), or -1 on error (the
+     *         callback is then not called)
+     */
+    public int parseAsync(String mrl, int timeout, ParseCallback callback) {
+        return parseAsync(mLibVlcInstance, mrl, timeout, callback);
+    }
+
+    /**
+     * Cancel a job of parseAsync(): its callback is soon called with null.
+     * @return false if the job was already finished
+     */
+    public native boolean cancelParse(int id);
+
+    /** Seek to the exact position and decode up to it */
+    public static final int THUMBNAIL_ACCURATE = 0;
+    /** Only decode the keyframe before the position: faster, less accurate */
+    public static final int THUMBNAIL_KEYFRAME = 1;
+    /**
+     * Decode a few keyframes around the position and keep the most
+     * informative one, to avoid black frames, fades and title cards.
+     * Its cost is bounded by setThumbnailBudget().
+     */
+    public static final int THUMBNAIL_BEST = 2;
+
     /**
      * Get a media thumbnail.
      */
     public byte[] getThumbnail(String mrl, int i_width, int i_height) {
-        return getThumbnail(mLibVlcInstance, mrl, i_width, i_height);
+        return getThumbnail(mLibVlcInstance, mrl, i_width, i_height, THUMBNAIL_ACCURATE);
     }
 
     /**
-     * Return true if there is a video track in the file
+     * Get a media thumbnail.
+     * @param mode THUMBNAIL_ACCURATE, THUMBNAIL_KEYFRAME or THUMBNAIL_BEST
+     */
+    public byte[] getThumbnail(String mrl, int i_width, int i_height, int mode) {
+        return getThumbnail(mLibVlcInstance, mrl, i_width, i_height, mode);
+    }
+
+    /**
+     * Get a media thumbnail, decoded directly in frame without any copy.
+     * @param frame direct buffer of at least i_width * i_height * 4 bytes,
+     *              for RGBA pixels (the layout of an ARGB_8888 Bitmap)
+     * @param mode THUMBNAIL_ACCURATE, THUMBNAIL_KEYFRAME or THUMBNAIL_BEST
+     * @return false if the thumbnail could not be created
+     */
+    public boolean getThumbnail(String mrl, ByteBuffer frame, int i_width, int i_height, int mode) {
+        return getThumbnailInto(mLibVlcInstance, mrl, frame, i_width, i_height, mode);
+    }
+
+    /**
+     * Bound the cost of a THUMBNAIL_BEST thumbnail.
+     * @param candidates maximum number of keyframes decoded (1 to 16)
+     * @param time no keyframe is decoded past this time, in ms
+     */
+    public native void setThumbnailBudget(int candidates, int time);
+
+    /**
+     * Get a strip of thumbnails of evenly spaced keyframes, created in a
+     * single session, in the tiles of an atlas.
+     * @param atlas direct buffer of columns x rows tiles of
+     *              i_width x i_height RGBA pixels, with
+     *              rows = ceil(times.length / columns)
+     * @param times receives the time of each tile in ms, or -1 if the tile
+     *              could not be created; its length is the number of tiles
+     * @return the number of tiles created
+     */
+    public int getThumbnailStrip(String mrl, ByteBuffer atlas, int i_width, int i_height,
+            int columns, long[] times) {
+        return getThumbnailStrip(mLibVlcInstance, mrl, atlas, i_width, i_height, columns, times);
+    }
+
+    /**
+     * Receive the thumbnails of getThumbnails(), in the order they are ready.
+     */
+    public interface ThumbnailCallback {
+        /**
+         * This function is called by the native code, on the thread that
+         * called getThumbnails().
+         * @param index index of the media in the mrl array
+         * @param thumbnail RGBA pixels, or null if the thumbnail could not be created.
+         *                  This direct buffer is only valid during the call.
+         * @param duration time spent creating this thumbnail, in ns
+         * @return false to cancel the remaining media
+         */
+        public boolean onThumbnail(int index, ByteBuffer thumbnail, long duration);
+    }
+
+    /**
+     * Get the thumbnails of several media, created in parallel by up to
+     * threads native threads. Blocks until the last thumbnail is delivered
+     * or until the callback cancels the batch.
+     * @return the number of media delivered to the callback
+     */
+    public int getThumbnails(String[] mrls, int i_width, int i_height, int mode, int threads,
+            ThumbnailCallback callback) {
+        return getThumbnails(mLibVlcInstance, mrls, i_width, i_height, mode, threads, callback);
+    }
+
+    /**
+     * Return true if there is a video track in the file.
+     * The media is only played if its description has no track.
      */
     public boolean hasVideoTrack(String mrl) throws java.io.IOException {
         return hasVideoTrack(mLibVlcInstance, mrl);
@@ -533,6 +708,14 @@ public class LibVLC {
      */
     private native void playMRL(long instance, String mrl, String[] mediaOptions);
 
+    private native void preloadMRL(long instance, String mrl, String[] mediaOptions);
+
+    /**
+     * Get the time between the last playIndex() or playMRL() and the start
+     * of the playback, in µs, or -1 if unknown.
+     */
+    public native long getSwitchLatency();
+
     /**
      * Returns true if any media is playing
      */
@@ -627,7 +810,17 @@ public class LibVLC {
      * Get a media thumbnail.
      * @return a bytearray with the RGBA thumbnail data inside.
      */
-    private native byte[] getThumbnail(long instance, String mrl, int i_width, int i_height);
+    private native byte[] getThumbnail(long instance, String mrl, int i_width, int i_height,
+            int mode);
+
+    private native boolean getThumbnailInto(long instance, String mrl, ByteBuffer frame,
+            int i_width, int i_height, int mode);
+
+    private native int getThumbnailStrip(long instance, String mrl, ByteBuffer atlas,
+            int i_width, int i_height, int columns, long[] times);
+
+    private native int getThumbnails(long instance, String[] mrls, int i_width, int i_height,
+            int mode, int threads, ThumbnailCallback callback);
 
     /**
      * Return true if there is a video track in the file
@@ -636,6 +829,8 @@ public class LibVLC {
 
     private native TrackInfo[] readTracksInfo(long instance, String mrl);
 
+    private native int parseAsync(long instance, String mrl, int timeout, ParseCallback callback);
+
     public native TrackInfo[] readTracksInfoInternal();
 
     public native int getAudioTracksCount();
@@ -682,6 +877,56 @@ public class LibVLC {
 
     public native static boolean nativeIsPathDirectory(String path);
 
+    /**
+     * Native recursive walk of media directories, see MediaWalker in the
+     * application for the format of the records.
+     * @param knownPaths directories which are not read if their
+     *        modification date is still the one in knownDates, or null
+     * @return the walker handle, or 0 if out of memory
+     */
+    public native static long nativeWalkerNew(String[] roots, String[] videoExtensions,
+            String[] audioExtensions, String[] blacklist, String[] knownPaths, long[] knownDates);
+    public native static void nativeWalkerPush(long walker, String path);
+    /**
+     * Fill a direct buffer with the next records of the walk
+     * @return the size of the records, 0 at the end of the walk, or -1 if
+     *         the buffer is too small
+     */
+    public native static int nativeWalkerNext(long walker, ByteBuffer buffer);
+    public native static void nativeWalkerRelease(long walker);
+
+    /** Changes reported by the media watcher */
+    public final static int WATCH_ADDED = 0;
+    public final static int WATCH_REMOVED = 1;
+    public final static int WATCH_DIR_ADDED = 2;
+    public final static int WATCH_DIR_REMOVED = 3;
+    /** Too many changes, or changes lost, as when a folder is unmounted:
+     * everything should be scanned again */
+    public final static int WATCH_OVERFLOW = 4;
+
+    /**
+     * Receive the changes of the directories watched by nativeWatcherStart()
+     */
+    public interface WatchCallback {
+        /**
+         * This function is called by the watcher thread, with a batch of
+         * changes: the files added or rewritten, removed, the directories
+         * added and removed, as WATCH_* events. The hidden entries are not
+         * reported. Do not stop the watcher from it.
+         */
+        public void onChanges(String[] paths, int[] events);
+    }
+
+    /**
+     * Watch directories and their sub directories with inotify. The changes
+     * are reported by batches, within a second.
+     * @param blacklist directories not to watch
+     * @return the watcher handle, or 0 on error
+     */
+    public native static long nativeWatcherStart(String[] dirs, String[] blacklist,
+            WatchCallback callback);
+    public native static void nativeWatcherStop(long watcher);
+
      /**
       * Expand and continue playing the current media.
       *
@@ -729,6 +974,127 @@ public class LibVLC {
         return mCachePath;
     }
 
+    /**
+     * Get the number of native threads attached to the JVM per second since
+     * the previous call. Native threads stay attached until they exit, so
+     * this should stay close to zero during playback.
+     */
+    public synchronized float getThreadAttachRate() {
+        int[] stats = new int[2];
+        nativeGetAttachStats(stats);
+        long now = System.nanoTime();
+        float rate = 0.f;
+        if (mLastAttachDate != 0 && now > mLastAttachDate)
+            rate = (stats[0] - mLastAttachCount) * 1000000000.f / (now - mLastAttachDate);
+        mLastAttachCount = stats[0];
+        mLastAttachDate = now;
+        return rate;
+    }
+
+    /**
+     * Fill stats with the number of native threads attached to and detached
+     * from the JVM.
+     */
+    private native void nativeGetAttachStats(int[] stats);
+
+    public static class AudioStats {
+        /** Times the native audio buffer ran empty during playback */
+        public long underruns;
+        /** Audio buffers dropped because the AudioTrack did not keep up */
+        public long overruns;
+        /** Latency from the decoder to the AudioTrack, in µs */
+        public long latency;
+        public long averageLatency;
+        /** Frames converted to the AudioTrack format, and the time spent, in µs */
+        public long convertedFrames;
+        public long conversionTime;
+        /** Audio outputs kept from one track to the next */
+        public long reusedOutputs;
+    }
+
+    /**
+     * Get the statistics of the Java AudioTrack output (AOUT_AUDIOTRACK_JAVA)
+     * since the process started.
+     */
+    public AudioStats getAudioStats() {
+        long[] nativeStats = new long[7];
+        nativeGetAudioStats(nativeStats);
+
+        AudioStats stats = new AudioStats();
+        stats.underruns = nativeStats[0];
+        stats.overruns = nativeStats[1];
+        stats.latency = nativeStats[2];
+        stats.averageLatency = nativeStats[3];
+        stats.convertedFrames = nativeStats[4];
+        stats.conversionTime = nativeStats[5] / 1000;
+        stats.reusedOutputs = nativeStats[6];
+        return stats;
+    }
+
+    private native void nativeGetAudioStats(long[] stats);
+
+    public static class MediaPlayerPoolStats {
+        /** Native media players created and released */
+        public long created;
+        public long released;
+        /** Media players taken back from the pool instead of being created */
+        public long reused;
+        /** Time spent creating and releasing media players, in µs */
+        public long creationTime;
+        public long releaseTime;
+    }
+
+    /**
+     * Get the statistics of the pool of native media players used for
+     * playback, thumbnails and probing.
+     */
+    public MediaPlayerPoolStats getMediaPlayerPoolStats() {
+        long[] nativeStats = new long[5];
+        nativeGetMediaPlayerPoolStats(nativeStats);
+
+        MediaPlayerPoolStats stats = new MediaPlayerPoolStats();
+        stats.created = nativeStats[0];
+        stats.released = nativeStats[1];
+        stats.reused = nativeStats[2];
+        stats.creationTime = nativeStats[3] / 1000;
+        stats.releaseTime = nativeStats[4] / 1000;
+        return stats;
+    }
+
+    private native void nativeGetMediaPlayerPoolStats(long[] stats);
+
+    public static class ThumbnailStats {
+        /** Thumbnails created, and media without thumbnail */
+        public long created;
+        public long failed;
+        /** Media skipped because they failed before and did not change since */
+        public long skipped;
+        /** Average and maximum time per media, in ms */
+        public long averageTime;
+        public long maxTime;
+    }
+
+    /**
+     * Get the latency statistics of the thumbnails created in a mode,
+     * to compare THUMBNAIL_ACCURATE, THUMBNAIL_KEYFRAME and THUMBNAIL_BEST.
+     */
+    public ThumbnailStats getThumbnailStats(int mode) {
+        long[] nativeStats = new long[15];
+        nativeGetThumbnailStats(nativeStats);
+
+        ThumbnailStats stats = new ThumbnailStats();
+        int i = mode >= THUMBNAIL_ACCURATE && mode <= THUMBNAIL_BEST ? 5 * mode : 0;
+        stats.created = nativeStats[i];
+        stats.failed = nativeStats[i + 1];
+        long count = stats.created + stats.failed;
+        stats.averageTime = count > 0 ? nativeStats[i + 2] / count / 1000000 : 0;
+        stats.maxTime = nativeStats[i + 3] / 1000000;
+        stats.skipped = nativeStats[i + 4];
+        return stats;
+    }
+
+    private native void nativeGetThumbnailStats(long[] stats);
+
     public native int getTitle();
     public native void setTitle(int title);
     public native int getChapterCountForTitle(int title);
@@ -140,9 +140,22 @@ public class Media implements Comparable<Media> {
         extractTrackInfo(tracks);
     }
 
+    /**
+     * Create a new Media from the tracks parsed by LibVLC.parseAsync()
+     * @param URI The URI of the media.
+     * @param tracks The tracks and meta data of the media, or null if it
+     *               could not be parsed.
+     */
+    public Media(String URI, TrackInfo[] tracks) {
+        mLocation = URI;
+
+        mType = TYPE_ALL;
+        extractTrackInfo(tracks);
+    }
+
     private void extractTrackInfo(TrackInfo[] tracks) {
         if (tracks == null)
-            return;
+            tracks = new TrackInfo[0];
 
         for (TrackInfo track : tracks) {
             if (track.Type == TrackInfo.TYPE_VIDEO) {
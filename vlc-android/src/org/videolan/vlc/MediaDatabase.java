@@ -20,39 +20,44 @@
 
 package org.videolan.vlc;
 
-import java.io.ByteArrayOutputStream;
 import java.io.File;
 import java.text.SimpleDateFormat;
 import java.util.ArrayList;
+import java.util.Collections;
 import java.util.Date;
 import java.util.HashMap;
 import java.util.HashSet;
 import java.util.List;
 import java.util.Locale;
+import java.util.Map;
 import java.util.Set;
 
 import org.videolan.libvlc.Media;
+import org.videolan.vlc.util.ThumbnailStore;
 
 import android.content.ContentValues;
 import android.content.Context;
 import android.database.Cursor;
 import android.database.sqlite.SQLiteDatabase;
 import android.database.sqlite.SQLiteException;
-import android.database.sqlite.SQLiteFullException;
 import android.database.sqlite.SQLiteOpenHelper;
+import android.database.sqlite.SQLiteStatement;
 import android.graphics.Bitmap;
-import android.graphics.BitmapFactory;
+import android.os.Handler;
+import android.os.HandlerThread;
 import android.util.Log;
 
 public class MediaDatabase {
     public final static String TAG = "VLC/MediaDatabase";
 
     private static MediaDatabase instance;
+    private static Handler sWriterHandler;
 
     private SQLiteDatabase mDb;
+    private Writer mWriter;
     private final String DB_NAME = "vlc_database";
-    private final int DB_VERSION = 8;
-    private final int CHUNK_SIZE = 50;
+    private final int DB_VERSION = 10;
+    private final int PAGE_SIZE = 500;
 
     private final String DIR_TABLE_NAME = "directories_table";
     private final String DIR_ROW_PATH = "path";
@@ -62,7 +67,6 @@ public class MediaDatabase {
     private final String MEDIA_TIME = "time";
     private final String MEDIA_LENGTH = "length";
     private final String MEDIA_TYPE = "type";
-    private final String MEDIA_PICTURE = "picture";
     private final String MEDIA_TITLE = "title";
     private final String MEDIA_ARTIST = "artist";
     private final String MEDIA_GENRE = "genre";
@@ -73,6 +77,17 @@ public class MediaDatabase {
     private final String MEDIA_AUDIOTRACK = "audio_track";
     private final String MEDIA_SPUTRACK = "spu_track";
 
+    private final String SCAN_DIR_TABLE_NAME = "scan_dir_table";
+    private final String SCAN_DIR_PATH = "path";
+    private final String SCAN_DIR_MTIME = "mtime";
+    private final String SCAN_DIR_FILES = "files";
+    private final String SCAN_DIR_DIRS = "dirs";
+
+    private final String SCAN_FILE_TABLE_NAME = "scan_file_table";
+    private final String SCAN_FILE_LOCATION = "location";
+    private final String SCAN_FILE_SIZE = "size";
+    private final String SCAN_FILE_MTIME = "mtime";
+
     private final String PLAYLIST_TABLE_NAME = "playlist_table";
     private final String PLAYLIST_NAME = "name";
 
@@ -87,7 +102,7 @@ public class MediaDatabase {
 
     public enum mediaColumn {
         MEDIA_TABLE_NAME, MEDIA_PATH, MEDIA_TIME, MEDIA_LENGTH,
-        MEDIA_TYPE, MEDIA_PICTURE, MEDIA_TITLE, MEDIA_ARTIST, MEDIA_GENRE, MEDIA_ALBUM,
+        MEDIA_TYPE, MEDIA_TITLE, MEDIA_ARTIST, MEDIA_GENRE, MEDIA_ALBUM,
         MEDIA_WIDTH, MEDIA_HEIGHT, MEDIA_ARTWORKURL, MEDIA_AUDIOTRACK, MEDIA_SPUTRACK
     }
 
@@ -102,6 +117,10 @@ public class MediaDatabase {
         this.mDb = helper.getWritableDatabase();
     }
 
+    private MediaDatabase(SQLiteDatabase db) {
+        this.mDb = db;
+    }
+
     public synchronized static MediaDatabase getInstance() {
         if (instance == null) {
             instance = new MediaDatabase(VLCApplication.getAppContext());
@@ -158,7 +177,6 @@ public class MediaDatabase {
                     + MEDIA_TIME + " INTEGER, "
                     + MEDIA_LENGTH + " INTEGER, "
                     + MEDIA_TYPE + " INTEGER, "
-                    + MEDIA_PICTURE + " BLOB, "
                     + MEDIA_TITLE + " VARCHAR(200), "
                     + MEDIA_ARTIST + " VARCHAR(200), "
                     + MEDIA_GENRE + " VARCHAR(200), "
@@ -172,6 +190,25 @@ public class MediaDatabase {
             db.execSQL(query);
         }
 
+        public void createScanTablesQuery(SQLiteDatabase db) {
+            String query = "CREATE TABLE IF NOT EXISTS "
+                    + SCAN_DIR_TABLE_NAME + " ("
+                    + SCAN_DIR_PATH + " TEXT PRIMARY KEY NOT NULL, "
+                    + SCAN_DIR_MTIME + " INTEGER, "
+                    + SCAN_DIR_FILES + " TEXT, "
+                    + SCAN_DIR_DIRS + " TEXT"
+                    + ");";
+            db.execSQL(query);
+
+            query = "CREATE TABLE IF NOT EXISTS "
+                    + SCAN_FILE_TABLE_NAME + " ("
+                    + SCAN_FILE_LOCATION + " TEXT PRIMARY KEY NOT NULL, "
+                    + SCAN_FILE_SIZE + " INTEGER, "
+                    + SCAN_FILE_MTIME + " INTEGER"
+                    + ");";
+            db.execSQL(query);
+        }
+
         @Override
         public void onCreate(SQLiteDatabase db) {
 
@@ -186,6 +223,9 @@ public class MediaDatabase {
             // Create the media table
             createMediaTableQuery(db);
 
+            // Create the fingerprints of the scanned directories and files
+            createScanTablesQuery(db);
+
             String createPlaylistTableQuery = "CREATE TABLE IF NOT EXISTS " +
                     PLAYLIST_TABLE_NAME + " (" +
                     PLAYLIST_NAME + " VARCHAR(200) PRIMARY KEY NOT NULL);";
@@ -215,6 +255,11 @@ public class MediaDatabase {
             if (oldVersion < DB_VERSION && newVersion == DB_VERSION) {
                 dropMediaTableQuery(db);
                 createMediaTableQuery(db);
+                /* The fingerprints are only valid with the media they
+                 * describe */
+                db.execSQL("DROP TABLE IF EXISTS " + SCAN_DIR_TABLE_NAME + ";");
+                db.execSQL("DROP TABLE IF EXISTS " + SCAN_FILE_TABLE_NAME + ";");
+                createScanTablesQuery(db);
             }
         }
     }
@@ -271,10 +316,11 @@ public class MediaDatabase {
     }
 
     /**
-     * Add a new media to the database. The picture can only added by update.
+     * Add a new media to the database. Its picture is kept by the ThumbnailStore.
      * @param media which you like to add to the database
      */
     public synchronized void addMedia(Media media) {
+        getWriter().flush();
 
         ContentValues values = new ContentValues();
 
@@ -302,6 +348,7 @@ public class MediaDatabase {
      * @return True if the item exists, false if it does not
      */
     public synchronized boolean mediaItemExists(String location) {
+        getWriter().flush();
         try {
             Cursor cursor = mDb.query(MEDIA_TABLE_NAME,
                     new String[] { MEDIA_LOCATION },
@@ -343,100 +390,172 @@ public class MediaDatabase {
         return files;
     }
 
-    public synchronized HashMap<String, Media> getMedias() {
+    /**
+     * Streaming read of the media table, by pages of PAGE_SIZE rows keyed on
+     * the rowid: each page is a lookup in the table, instead of a skip of
+     * all the rows before it with OFFSET. The pages are read with the
+     * database lock, but not the whole stream, so the rows written meanwhile
+     * may be missed, or read twice if replaced.
+     * The artist, genre and album strings, mostly repeated, are shared
+     * between the media read.
+     */
+    public class MediaCursor {
+        private final HashMap<String, String> mStrings = new HashMap<String, String>();
+        private Cursor mCursor;
+        private long mLastRowId = 0;
+        private int mPageCount = 0;
+        private boolean mEnd = false;
+
+        private MediaCursor() {
+        }
 
-        Cursor cursor;
-        HashMap<String, Media> medias = new HashMap<String, Media>();
-        int chunk_count = 0;
-        int count = 0;
+        /**
+         * @return the next media, or null at the end of the table
+         */
+        public Media next() {
+            if (mCursor != null && !mCursor.moveToNext()) {
+                mCursor.close();
+                mCursor = null;
+                mEnd = mPageCount < PAGE_SIZE;
+            }
+            if (mCursor == null) {
+                if (mEnd || !readPage())
+                    return null;
+            }
 
-        do {
-            count = 0;
-            cursor = mDb.rawQuery(String.format(Locale.US,
-                    "SELECT %s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s FROM %s LIMIT %d OFFSET %d",
-                    MEDIA_TIME, //0 long
-                    MEDIA_LENGTH, //1 long
-                    MEDIA_TYPE, //2 int
-                    MEDIA_TITLE, //3 string
-                    MEDIA_ARTIST, //4 string
-                    MEDIA_GENRE, //5 string
-                    MEDIA_ALBUM, //6 string
-                    MEDIA_WIDTH, //7 int
-                    MEDIA_HEIGHT, //8 int
-                    MEDIA_ARTWORKURL, //9 string
-                    MEDIA_AUDIOTRACK, //10 string
-                    MEDIA_SPUTRACK, //11 string
-                    MEDIA_LOCATION, //12 string
-                    MEDIA_TABLE_NAME,
-                    CHUNK_SIZE,
-                    chunk_count * CHUNK_SIZE), null);
+            mLastRowId = mCursor.getLong(13);
+            return new Media(mCursor.getString(12),
+                    mCursor.getLong(0),         // MEDIA_TIME
+                    mCursor.getLong(1),         // MEDIA_LENGTH
+                    mCursor.getInt(2),          // MEDIA_TYPE
+                    null,                       // see ThumbnailStore
+                    mCursor.getString(3),       // MEDIA_TITLE
+                    share(mCursor.getString(4)),// MEDIA_ARTIST
+                    share(mCursor.getString(5)),// MEDIA_GENRE
+                    share(mCursor.getString(6)),// MEDIA_ALBUM
+                    mCursor.getInt(7),          // MEDIA_WIDTH
+                    mCursor.getInt(8),          // MEDIA_HEIGHT
+                    mCursor.getString(9),       // MEDIA_ARTWORKURL
+                    mCursor.getInt(10),         // MEDIA_AUDIOTRACK
+                    mCursor.getInt(11));        // MEDIA_SPUTRACK
+        }
 
-            if (cursor.moveToFirst()) {
-                do {
-                    String location = cursor.getString(12);
-                    Media media = new Media(location,
-                            cursor.getLong(0),      // MEDIA_TIME
-                            cursor.getLong(1),      // MEDIA_LENGTH
-                            cursor.getInt(2),       // MEDIA_TYPE
-                            null,                   // MEDIA_PICTURE
-                            cursor.getString(3),    // MEDIA_TITLE
-                            cursor.getString(4),    // MEDIA_ARTIST
-                            cursor.getString(5),    // MEDIA_GENRE
-                            cursor.getString(6),    // MEDIA_ALBUM
-                            cursor.getInt(7),       // MEDIA_WIDTH
-                            cursor.getInt(8),       // MEDIA_HEIGHT
-                            cursor.getString(9),    // MEDIA_ARTWORKURL
-                            cursor.getInt(10),      // MEDIA_AUDIOTRACK
-                            cursor.getInt(11));     // MEDIA_SPUTRACK
-                    medias.put(media.getLocation(), media);
+        public void close() {
+            if (mCursor != null) {
+                mCursor.close();
+                mCursor = null;
+            }
+            mEnd = true;
+        }
 
-                    count++;
-                } while (cursor.moveToNext());
+        private boolean readPage() {
+            synchronized (MediaDatabase.this) {
+                mCursor = mDb.rawQuery(String.format(Locale.US,
+                        "SELECT %s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,rowid FROM %s "
+                        + "WHERE rowid>%d ORDER BY rowid LIMIT %d",
+                        MEDIA_TIME, //0 long
+                        MEDIA_LENGTH, //1 long
+                        MEDIA_TYPE, //2 int
+                        MEDIA_TITLE, //3 string
+                        MEDIA_ARTIST, //4 string
+                        MEDIA_GENRE, //5 string
+                        MEDIA_ALBUM, //6 string
+                        MEDIA_WIDTH, //7 int
+                        MEDIA_HEIGHT, //8 int
+                        MEDIA_ARTWORKURL, //9 string
+                        MEDIA_AUDIOTRACK, //10 int
+                        MEDIA_SPUTRACK, //11 int
+                        MEDIA_LOCATION, //12 string
+                        MEDIA_TABLE_NAME,
+                        mLastRowId,
+                        PAGE_SIZE), null);
+                mPageCount = mCursor.getCount();
             }
+            if (!mCursor.moveToFirst()) {
+                close();
+                return false;
+            }
+            return true;
+        }
 
+        private String share(String string) {
+            if (string == null)
+                return null;
+            String shared = mStrings.get(string);
+            if (shared == null) {
+                mStrings.put(string, string);
+                shared = string;
+            }
+            return shared;
+        }
+    }
+
+    /**
+     * Read the media table as a stream, see MediaCursor. The queued writes
+     * are flushed first.
+     */
+    public MediaCursor getMediaCursor() {
+        getWriter().flush();
+        return new MediaCursor();
+    }
+
+    public HashMap<String, Media> getMedias() {
+        int count;
+        synchronized (this) {
+            getWriter().flush();
+            Cursor cursor = mDb.rawQuery("SELECT COUNT(*) FROM " + MEDIA_TABLE_NAME, null);
+            count = cursor.moveToFirst() ? cursor.getInt(0) : 0;
             cursor.close();
-            chunk_count++;
-        } while (count == CHUNK_SIZE);
+        }
+
+        HashMap<String, Media> medias = new HashMap<String, Media>(count * 4 / 3 + 1);
+        MediaCursor cursor = getMediaCursor();
+        Media media;
+        while ((media = cursor.next()) != null)
+            medias.put(media.getLocation(), media);
+        cursor.close();
 
         return medias;
     }
 
     public synchronized HashMap<String, Long> getVideoTimes(Context context) {
+        getWriter().flush();
 
         Cursor cursor;
         HashMap<String, Long> times = new HashMap<String, Long>();
-        int chunk_count = 0;
+        long lastRowId = 0;
         int count = 0;
 
         do {
             count = 0;
             cursor = mDb.rawQuery(String.format(Locale.US,
-                    "SELECT %s,%s FROM %s WHERE %s=%d LIMIT %d OFFSET %d",
+                    "SELECT %s,%s,rowid FROM %s WHERE %s=%d AND rowid>%d ORDER BY rowid LIMIT %d",
                     MEDIA_LOCATION, //0 string
                     MEDIA_TIME, //1 long
                     MEDIA_TABLE_NAME,
                     MEDIA_TYPE,
                     Media.TYPE_VIDEO,
-                    CHUNK_SIZE,
-                    chunk_count * CHUNK_SIZE), null);
+                    lastRowId,
+                    PAGE_SIZE), null);
 
             if (cursor.moveToFirst()) {
                 do {
                     String location = cursor.getString(0);
                     long time = cursor.getLong(1);
                     times.put(location, time);
+                    lastRowId = cursor.getLong(2);
                     count++;
                 } while (cursor.moveToNext());
             }
 
             cursor.close();
-            chunk_count++;
-        } while (count == CHUNK_SIZE);
+        } while (count == PAGE_SIZE);
 
         return times;
     }
 
     public synchronized Media getMedia(String location) {
+        getWriter().flush();
 
         Cursor cursor;
         Media media = null;
@@ -470,7 +589,7 @@ public class MediaDatabase {
                     cursor.getLong(0),
                     cursor.getLong(1),
                     cursor.getInt(2),
-                    null, // lazy loading, see getPicture()
+                    null, // see ThumbnailStore
                     cursor.getString(3),
                     cursor.getString(4),
                     cursor.getString(5),
@@ -485,47 +604,19 @@ public class MediaDatabase {
         return media;
     }
 
-    public synchronized Bitmap getPicture(Context context, String location) {
-        /* Used for the lazy loading */
-        Cursor cursor;
-        Bitmap picture = null;
-        byte[] blob;
-
-        cursor = mDb.query(
-                MEDIA_TABLE_NAME,
-                new String[] { MEDIA_PICTURE },
-                MEDIA_LOCATION + "=?",
-                new String[] { location },
-                null, null, null);
-        if (cursor.moveToFirst()) {
-            blob = cursor.getBlob(0);
-            if (blob != null && blob.length > 1 && blob.length < 500000) {
-                try {
-                    picture = BitmapFactory.decodeByteArray(blob, 0, blob.length);
-                } catch(OutOfMemoryError e) {
-                    picture = null;
-                } finally {
-                    blob = null;
-                }
-            }
+    public void removeMedia(String location) {
+        synchronized (this) {
+            getWriter().flush();
+            mDb.delete(MEDIA_TABLE_NAME, MEDIA_LOCATION + "=?", new String[] { location });
         }
-        cursor.close();
-        return picture;
-    }
-
-    public synchronized void removeMedia(String location) {
-        mDb.delete(MEDIA_TABLE_NAME, MEDIA_LOCATION + "=?", new String[] { location });
+        ThumbnailStore.getInstance().remove(Collections.singleton(location));
     }
 
     public void removeMedias(Set<String> locations) {
-        mDb.beginTransaction();
-        try {
-            for (String location : locations)
-                mDb.delete(MEDIA_TABLE_NAME, MEDIA_LOCATION + "=?", new String[] { location });
-            mDb.setTransactionSuccessful();
-        } finally {
-            mDb.endTransaction();
-        }
+        Writer writer = getWriter();
+        for (String location : locations)
+            writer.removeMedia(location);
+        writer.flush();
     }
 
     public synchronized void updateMedia(String location, mediaColumn col,
@@ -534,39 +625,11 @@ public class MediaDatabase {
         if (location == null)
             return;
 
-        ContentValues values = new ContentValues();
-        switch (col) {
-            case MEDIA_PICTURE:
-                if (object != null) {
-                    Bitmap picture = (Bitmap) object;
-                    ByteArrayOutputStream out = new ByteArrayOutputStream();
-                    picture.compress(Bitmap.CompressFormat.JPEG, 90, out);
-                    values.put(MEDIA_PICTURE, out.toByteArray());
-                }
-                else {
-                    values.put(MEDIA_PICTURE, new byte[1]);
-                }
-                break;
-            case MEDIA_TIME:
-                if (object != null)
-                    values.put(MEDIA_TIME, (Long)object);
-                break;
-            case MEDIA_AUDIOTRACK:
-                if (object != null)
-                    values.put(MEDIA_AUDIOTRACK, (Integer)object);
-                break;
-            case MEDIA_SPUTRACK:
-                if (object != null)
-                    values.put(MEDIA_SPUTRACK, (Integer)object);
-                break;
-            case MEDIA_LENGTH:
-                if (object != null)
-                    values.put(MEDIA_LENGTH, (Long)object);
-                break;
-            default:
-                return;
-        }
-        mDb.update(MEDIA_TABLE_NAME, values, MEDIA_LOCATION + "=?", new String[] { location });
+        /* Written after the queued writes of the media, and before returning:
+         * an insert still queued would overwrite it otherwise */
+        Writer writer = getWriter();
+        writer.updateMedia(location, col, object);
+        writer.flush();
     }
 
     /**
@@ -667,19 +730,408 @@ public class MediaDatabase {
      * Empty the database for debugging purposes
      */
     public synchronized void emptyDatabase() {
+        getWriter().flush();
         mDb.delete(MEDIA_TABLE_NAME, null, null);
+        mDb.delete(SCAN_DIR_TABLE_NAME, null, null);
+        mDb.delete(SCAN_FILE_TABLE_NAME, null, null);
     }
 
-    public static void setPicture(Media m, Bitmap p) {
-        Log.d(TAG, "Setting new picture for " + m.getTitle());
+    /**
+     * State of a directory at the end of the last complete scan: its
+     * modification date, and its media files and sub directories, as
+     * listed by the media library. The names never contain '/', which
+     * separates them in the table.
+     */
+    public static class DirFingerprint {
+        public final long lastModified;
+        public final String[] files;
+        public final String[] dirs;
+
+        public DirFingerprint(long lastModified, String[] files, String[] dirs) {
+            this.lastModified = lastModified;
+            this.files = files;
+            this.dirs = dirs;
+        }
+    }
+
+    private static String joinNames(String[] names) {
+        StringBuilder sb = new StringBuilder();
+        for (String name : names) {
+            if (sb.length() > 0)
+                sb.append('/');
+            sb.append(name);
+        }
+        return sb.toString();
+    }
+
+    private static String[] splitNames(String names) {
+        if (names == null || names.length() == 0)
+            return new String[0];
+        return names.split("/");
+    }
+
+    /**
+     * Get the fingerprints of the scanned directories, by canonical path
+     */
+    public synchronized HashMap<String, DirFingerprint> getDirFingerprints() {
+        HashMap<String, DirFingerprint> dirs = new HashMap<String, DirFingerprint>();
+        Cursor cursor = mDb.query(SCAN_DIR_TABLE_NAME,
+                new String[] { SCAN_DIR_PATH, SCAN_DIR_MTIME, SCAN_DIR_FILES, SCAN_DIR_DIRS },
+                null, null, null, null, null);
+        while (cursor.moveToNext())
+            dirs.put(cursor.getString(0), new DirFingerprint(cursor.getLong(1),
+                    splitNames(cursor.getString(2)), splitNames(cursor.getString(3))));
+        cursor.close();
+        return dirs;
+    }
+
+    /**
+     * Get the size and modification date of the media files, when they
+     * were last parsed, by location
+     */
+    public synchronized HashMap<String, long[]> getFileFingerprints() {
+        HashMap<String, long[]> files = new HashMap<String, long[]>();
+        Cursor cursor = mDb.query(SCAN_FILE_TABLE_NAME,
+                new String[] { SCAN_FILE_LOCATION, SCAN_FILE_SIZE, SCAN_FILE_MTIME },
+                null, null, null, null, null);
+        while (cursor.moveToNext())
+            files.put(cursor.getString(0), new long[] { cursor.getLong(1), cursor.getLong(2) });
+        cursor.close();
+        return files;
+    }
+
+    /**
+     * Store the size and modification date of parsed media files
+     */
+    public synchronized void setFileFingerprints(Map<String, long[]> files) {
+        mDb.beginTransaction();
         try {
-            getInstance().updateMedia(
-                m.getLocation(),
-                mediaColumn.MEDIA_PICTURE,
-                p);
-        } catch (SQLiteFullException e) {
-            Log.d(TAG, "SQLiteFullException while setting picture");
+            ContentValues values = new ContentValues();
+            for (Map.Entry<String, long[]> file : files.entrySet()) {
+                values.put(SCAN_FILE_LOCATION, file.getKey());
+                values.put(SCAN_FILE_SIZE, file.getValue()[0]);
+                values.put(SCAN_FILE_MTIME, file.getValue()[1]);
+                mDb.replace(SCAN_FILE_TABLE_NAME, null, values);
+            }
+            mDb.setTransactionSuccessful();
+        } finally {
+            mDb.endTransaction();
+        }
+    }
+
+    /**
+     * Store the fingerprints of the directories listed by a complete scan,
+     * and remove the ones of the directories that were not found.
+     */
+    public synchronized void setDirFingerprints(Map<String, DirFingerprint> dirs,
+            Set<String> removed) {
+        mDb.beginTransaction();
+        try {
+            ContentValues values = new ContentValues();
+            for (Map.Entry<String, DirFingerprint> dir : dirs.entrySet()) {
+                values.put(SCAN_DIR_PATH, dir.getKey());
+                values.put(SCAN_DIR_MTIME, dir.getValue().lastModified);
+                values.put(SCAN_DIR_FILES, joinNames(dir.getValue().files));
+                values.put(SCAN_DIR_DIRS, joinNames(dir.getValue().dirs));
+                mDb.replace(SCAN_DIR_TABLE_NAME, null, values);
+            }
+            for (String path : removed)
+                mDb.delete(SCAN_DIR_TABLE_NAME, SCAN_DIR_PATH + "=?", new String[] { path });
+            mDb.setTransactionSuccessful();
+        } finally {
+            mDb.endTransaction();
+        }
+    }
+
+    private final static int WRITE_INSERT = 0;
+    private final static int WRITE_UPDATE = 1;
+    private final static int WRITE_DELETE = 2;
+
+    private static class WriteOperation {
+        final int type;
+        final String location;
+        final Media media;
+        final mediaColumn column;
+        final Object value;
+
+        WriteOperation(int type, String location, Media media, mediaColumn column, Object value) {
+            this.type = type;
+            this.location = location;
+            this.media = media;
+            this.column = column;
+            this.value = value;
+        }
+    }
+
+    /**
+     * Get the batched writer of the media table
+     */
+    public synchronized Writer getWriter() {
+        if (mWriter == null)
+            mWriter = new Writer();
+        return mWriter;
+    }
+
+    private static synchronized Handler getWriterHandler() {
+        if (sWriterHandler == null) {
+            HandlerThread thread = new HandlerThread("MediaDatabaseWriter");
+            thread.start();
+            sWriterHandler = new Handler(thread.getLooper());
+        }
+        return sWriterHandler;
+    }
+
+    /**
+     * Batched writer of the media table: the inserts, updates and deletes
+     * are queued, and written in order by a single transaction with
+     * compiled statements, once FLUSH_COUNT of them are queued, FLUSH_DELAY
+     * ms after the first one, or on flush(). The other reads and writes of
+     * the media table flush the queue first, so that they keep their order.
+     */
+    public class Writer {
+        private final static int FLUSH_COUNT = 500;
+        private final static long FLUSH_DELAY = 1000; // ms
+
+        private final ArrayList<WriteOperation> mOperations = new ArrayList<WriteOperation>();
+        /* Compiled statements, used with the database lock */
+        private SQLiteStatement mInsert;
+        private SQLiteStatement mDelete;
+        private SQLiteStatement mDeleteFingerprint;
+        private final HashMap<mediaColumn, SQLiteStatement> mUpdates =
+                new HashMap<mediaColumn, SQLiteStatement>();
+        /* Statistics */
+        private long mWritten;
+        private long mWriteTime;
+
+        private final Runnable mFlushRunnable = new Runnable() {
+            @Override
+            public void run() {
+                flush();
+            }
+        };
+
+        private Writer() {
+        }
+
+        /**
+         * Add or replace a media, as addMedia()
+         */
+        public void addMedia(Media media) {
+            queue(new WriteOperation(WRITE_INSERT, media.getLocation(), media, null, null));
+        }
+
+        /**
+         * Update the time, length, audio or subtitles track of a media, as
+         * updateMedia()
+         */
+        public void updateMedia(String location, mediaColumn col, Object object) {
+            if (location == null || object == null || getColumnName(col) == null)
+                return;
+            queue(new WriteOperation(WRITE_UPDATE, location, null, col, object));
+        }
+
+        /**
+         * Remove a media, the fingerprint of its file, and its thumbnail
+         */
+        public void removeMedia(String location) {
+            queue(new WriteOperation(WRITE_DELETE, location, null, null, null));
+        }
+
+        private void queue(WriteOperation operation) {
+            boolean flush;
+            synchronized (mOperations) {
+                mOperations.add(operation);
+                flush = mOperations.size() >= FLUSH_COUNT;
+                if (mOperations.size() == 1 && !flush)
+                    getWriterHandler().postDelayed(mFlushRunnable, FLUSH_DELAY);
+            }
+            if (flush)
+                flush();
+        }
+
+        /**
+         * Write the queued operations now
+         */
+        public void flush() {
+            ArrayList<WriteOperation> operations;
+            synchronized (MediaDatabase.this) {
+                synchronized (mOperations) {
+                    if (mOperations.isEmpty())
+                        return;
+                    operations = new ArrayList<WriteOperation>(mOperations);
+                    mOperations.clear();
+                    getWriterHandler().removeCallbacks(mFlushRunnable);
+                }
+                write(operations);
+            }
+            pruneThumbnails(operations);
+        }
+
+        /**
+         * Remove the thumbnails of the media deleted, and not added back,
+         * by the operations, without the database lock
+         */
+        private void pruneThumbnails(ArrayList<WriteOperation> operations) {
+            HashSet<String> removed = new HashSet<String>();
+            for (WriteOperation operation : operations) {
+                if (operation.type == WRITE_DELETE)
+                    removed.add(operation.location);
+                else if (operation.type == WRITE_INSERT)
+                    removed.remove(operation.location);
+            }
+            if (!removed.isEmpty())
+                ThumbnailStore.getInstance().remove(removed);
         }
+
+        /**
+         * @return the operations written per second, on average
+         */
+        public synchronized long getWriteRate() {
+            return mWritten * 1000000000L / Math.max(1, mWriteTime);
+        }
+
+        private String getColumnName(mediaColumn col) {
+            switch (col) {
+                case MEDIA_TIME:
+                    return MEDIA_TIME;
+                case MEDIA_LENGTH:
+                    return MEDIA_LENGTH;
+                case MEDIA_AUDIOTRACK:
+                    return MEDIA_AUDIOTRACK;
+                case MEDIA_SPUTRACK:
+                    return MEDIA_SPUTRACK;
+                default:
+                    return null;
+            }
+        }
+
+        private void bindString(SQLiteStatement statement, int index, String value) {
+            if (value != null)
+                statement.bindString(index, value);
+            else
+                statement.bindNull(index);
+        }
+
+        /* Called with the database lock */
+        private void write(ArrayList<WriteOperation> operations) {
+            long start = System.nanoTime();
+            mDb.beginTransaction();
+            try {
+                for (WriteOperation operation : operations) {
+                    switch (operation.type) {
+                        case WRITE_INSERT:
+                            if (mInsert == null)
+                                mInsert = mDb.compileStatement("INSERT OR REPLACE INTO "
+                                        + MEDIA_TABLE_NAME + " ("
+                                        + MEDIA_LOCATION + "," + MEDIA_TIME + ","
+                                        + MEDIA_LENGTH + "," + MEDIA_TYPE + ","
+                                        + MEDIA_TITLE + "," + MEDIA_ARTIST + ","
+                                        + MEDIA_GENRE + "," + MEDIA_ALBUM + ","
+                                        + MEDIA_WIDTH + "," + MEDIA_HEIGHT + ","
+                                        + MEDIA_ARTWORKURL + "," + MEDIA_AUDIOTRACK + ","
+                                        + MEDIA_SPUTRACK
+                                        + ") VALUES (?,?,?,?,?,?,?,?,?,?,?,?,?)");
+                            Media media = operation.media;
+                            bindString(mInsert, 1, media.getLocation());
+                            mInsert.bindLong(2, media.getTime());
+                            mInsert.bindLong(3, media.getLength());
+                            mInsert.bindLong(4, media.getType());
+                            bindString(mInsert, 5, media.getTitle());
+                            bindString(mInsert, 6, media.getArtist());
+                            bindString(mInsert, 7, media.getGenre());
+                            bindString(mInsert, 8, media.getAlbum());
+                            mInsert.bindLong(9, media.getWidth());
+                            mInsert.bindLong(10, media.getHeight());
+                            bindString(mInsert, 11, media.getArtworkURL());
+                            mInsert.bindLong(12, media.getAudioTrack());
+                            mInsert.bindLong(13, media.getSpuTrack());
+                            mInsert.executeInsert();
+                            break;
+                        case WRITE_UPDATE:
+                            SQLiteStatement update = mUpdates.get(operation.column);
+                            if (update == null) {
+                                update = mDb.compileStatement("UPDATE " + MEDIA_TABLE_NAME
+                                        + " SET " + getColumnName(operation.column) + "=? WHERE "
+                                        + MEDIA_LOCATION + "=?");
+                                mUpdates.put(operation.column, update);
+                            }
+                            update.bindLong(1, ((Number) operation.value).longValue());
+                            update.bindString(2, operation.location);
+                            update.execute();
+                            break;
+                        case WRITE_DELETE:
+                            if (mDelete == null) {
+                                mDelete = mDb.compileStatement("DELETE FROM " + MEDIA_TABLE_NAME
+                                        + " WHERE " + MEDIA_LOCATION + "=?");
+                                mDeleteFingerprint = mDb.compileStatement("DELETE FROM "
+                                        + SCAN_FILE_TABLE_NAME + " WHERE " + SCAN_FILE_LOCATION + "=?");
+                            }
+                            mDelete.bindString(1, operation.location);
+                            mDelete.execute();
+                            mDeleteFingerprint.bindString(1, operation.location);
+                            mDeleteFingerprint.execute();
+                            break;
+                    }
+                }
+                mDb.setTransactionSuccessful();
+            } catch (SQLiteException e) {
+                Log.e(TAG, "Could not write " + operations.size() + " operations", e);
+            } finally {
+                mDb.endTransaction();
+            }
+            synchronized (this) {
+                mWritten += operations.size();
+                mWriteTime += System.nanoTime() - start;
+            }
+        }
+    }
+
+    /**
+     * Measure the insertion of count media in a temporary database, one by
+     * one with addMedia(), then by the batched writer.
+     */
+    public static String benchmark(Context context, int count) {
+        File file = new File(context.getCacheDir(), "benchmark.db");
+        file.delete();
+        SQLiteDatabase sqlDb = SQLiteDatabase.openOrCreateDatabase(file, null);
+        MediaDatabase db = new MediaDatabase(sqlDb);
+        db.new DatabaseHelper(context).onCreate(sqlDb);
+
+        Media[] medias = new Media[count];
+        for (int i = 0; i < count; ++i)
+            medias[i] = new Media("file:///sdcard/benchmark/" + i + ".mkv", 0, 60000,
+                    Media.TYPE_VIDEO, null, "Video " + i, null, null, null,
+                    1280, 720, null, -1, -1);
+
+        long start = System.nanoTime();
+        for (Media media : medias)
+            db.addMedia(media);
+        long single = System.nanoTime() - start;
+
+        db.emptyDatabase();
+        Writer writer = db.getWriter();
+        start = System.nanoTime();
+        for (Media media : medias)
+            writer.addMedia(media);
+        writer.flush();
+        long batched = System.nanoTime() - start;
+
+        sqlDb.close();
+        file.delete();
+        new File(file.getPath() + "-journal").delete();
+
+        String result = String.format("%d inserts: one by one %d ms (%d/s), batched %d ms (%d/s)",
+                count, single / 1000000, count * 1000000000L / Math.max(1, single),
+                batched / 1000000, count * 1000000000L / Math.max(1, batched));
+        Log.i(TAG, "Benchmark: " + result);
+        return result;
+    }
+
+    public static void setPicture(Media m, Bitmap p) {
+        Log.d(TAG, "Setting new picture for " + m.getTitle());
+        /* The pictures are kept in the thumbnail store, which survives the
+         * rescans, instead of the media table */
+        ThumbnailStore.getInstance().put(m.getLocation(), p);
         m.setPictureParsed(true);
     }
 }
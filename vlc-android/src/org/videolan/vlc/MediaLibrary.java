@@ -27,15 +27,19 @@ import java.lang.Thread.State;
 import java.util.ArrayList;
 import java.util.HashMap;
 import java.util.HashSet;
+import java.util.Iterator;
 import java.util.List;
 import java.util.Locale;
 import java.util.Stack;
+import java.util.concurrent.LinkedBlockingQueue;
+import java.util.concurrent.Semaphore;
 import java.util.concurrent.locks.ReadWriteLock;
 import java.util.concurrent.locks.ReentrantReadWriteLock;
 
 import org.videolan.libvlc.LibVLC;
 import org.videolan.libvlc.LibVlcException;
 import org.videolan.libvlc.Media;
+import org.videolan.libvlc.TrackInfo;
 import org.videolan.vlc.gui.MainActivity;
 import org.videolan.vlc.gui.audio.AudioBrowserFragment;
 import org.videolan.vlc.gui.video.VideoGridFragment;
@@ -54,6 +58,17 @@ public class MediaLibrary {
 
     public static final int MEDIA_ITEMS_UPDATED = 100;
 
+    /* New media parsed at the same time by default */
+    private static final int DEFAULT_PARSE_CONCURRENCY = 8;
+    /* A media that is not parsed in time is added without its tracks */
+    private static final int PARSE_TIMEOUT = 10000; // ms
+    /* Media added to the list, and to the database, at once */
+    private static final int PUBLISH_BATCH_SIZE = 50;
+    /* The modification dates have a 1 s resolution on most file systems:
+     * a directory modified less than that before being listed could be
+     * modified again without changing its date */
+    private static final long DIR_MTIME_GRANULARITY = 2000; // ms
+
     private static MediaLibrary mInstance;
     private final ArrayList<Media> mItemList;
     private final ArrayList<Handler> mUpdateHandler;
@@ -61,6 +76,16 @@ public class MediaLibrary {
     private boolean isStopping = false;
     private boolean mRestart = false;
     protected Thread mLoadingThread;
+    private int mParseConcurrency = DEFAULT_PARSE_CONCURRENCY;
+    private ScanStats mScanStats = new ScanStats();
+    /* inotify watcher of the media folders, between the scans */
+    private volatile long mWatcher = 0;
+    /* stopWatching() was called, the watcher thread has to return */
+    private volatile boolean mWatchStopping = false;
+    /* The watcher missed changes, a scan is needed */
+    private volatile boolean mWatchLost = false;
+    /* Parses of the media added while watching */
+    private volatile ParsePipeline mWatchPipeline;
 
     private MediaLibrary() {
         mInstance = this;
@@ -101,6 +126,38 @@ public class MediaLibrary {
         return false;
     }
 
+    /**
+     * Set the number of new media parsed at the same time by the next scans
+     */
+    public void setParseConcurrency(int concurrency) {
+        mParseConcurrency = Math.max(1, concurrency);
+    }
+
+    public static class ScanStats {
+        /** Directories walked, and the ones listed again because they
+         * changed since the last scan */
+        public int directories;
+        public int listedDirectories;
+        /** Media files found, new ones and changed ones among them */
+        public int files;
+        public int newFiles;
+        public int changedFiles;
+        /** New media that could not be parsed in time */
+        public int timedOut;
+        /** Time spent walking the directories, and processing the files, in ms */
+        public long walkTime;
+        public long processTime;
+        /** Files processed per second */
+        public long throughput;
+    }
+
+    /**
+     * Get the statistics of the last complete scan
+     */
+    public ScanStats getScanStats() {
+        return mScanStats;
+    }
+
     public synchronized static MediaLibrary getInstance() {
         if (mInstance == null)
             mInstance = new MediaLibrary();
@@ -199,9 +256,6 @@ public class MediaLibrary {
 
     private class GetMediaItemsRunnable implements Runnable {
 
-        private final Stack<File> directories = new Stack<File>();
-        private final HashSet<String> directoriesScanned = new HashSet<String>();
-
         public GetMediaItemsRunnable() {
         }
 
@@ -221,21 +275,23 @@ public class MediaLibrary {
             // show progressbar in footer
             MainActivity.showProgressBar();
 
-            List<File> mediaDirs = DBManager.getMediaDirs();
-            if (mediaDirs.size() == 0) {
-                // Use all available storage directories as our default
-                String storageDirs[] = AndroidDevices.getMediaDirectories();
-                for (String dir: storageDirs) {
-                    File f = new File(dir);
-                    if (f.exists())
-                        mediaDirs.add(f);
-                }
-            }
-            directories.addAll(mediaDirs);
+            // the changes made during the scan are found by the walk
+            stopWatching();
+
+            List<File> mediaDirs = getMediaDirs();
 
             // get all existing media items
             HashMap<String, Media> existingMedias = DBManager.getMedias();
 
+            // fingerprints of the last complete scan: the directories that
+            // did not change are not listed again, and the files of the
+            // ones that did are only parsed again if they changed too
+            Walk walk = new Walk(DBManager.getDirFingerprints());
+            HashMap<String, long[]> fileFingerprints = null;
+            HashMap<String, long[]> parsedFiles = new HashMap<String, long[]>();
+            // paths of the parsed files, by location
+            HashMap<String, String> parsedPaths = new HashMap<String, String>();
+
             // list of all added files
             HashSet<String> addedLocations = new HashSet<String>();
 
@@ -244,95 +300,120 @@ public class MediaLibrary {
             mItemList.clear();
             mItemListLock.writeLock().unlock();
 
-            MediaItemFilter mediaFileFilter = new MediaItemFilter();
-
             int count = 0;
 
-            ArrayList<File> mediaToScan = new ArrayList<File>();
+            ParsePipeline pipeline = null;
+            int newFiles = 0, changedFiles = 0;
+            long start = System.nanoTime();
             try {
                 // Count total files, and stack them
-                while (!directories.isEmpty()) {
-                    File dir = directories.pop();
-                    String dirPath = dir.getAbsolutePath();
-                    File[] f = null;
-
-                    // Skip some system folders
-                    if (dirPath.startsWith("/proc/") || dirPath.startsWith("/sys/") || dirPath.startsWith("/dev/"))
-                        continue;
+                if (!walk(mediaDirs, walk)) {
+                    Log.d(TAG, "Stopping scan");
+                    return;
+                }
+                ArrayList<ScannedFile> mediaToScan = walk.files;
 
-                    // Do not scan again if same canonical path
-                    try {
-                        dirPath = dir.getCanonicalPath();
-                    } catch (IOException e) {
-                        e.printStackTrace();
-                    }
-                    if (directoriesScanned.contains(dirPath))
-                        continue;
-                    else
-                        directoriesScanned.add(dirPath);
+                long walkEnd = System.nanoTime();
 
-                    // Do no scan media in .nomedia folders
-                    if (new File(dirPath + "/.nomedia").exists()) {
+                // Process the stacked items: the known media are published
+                // directly, the new ones once parsed, by batches
+                pipeline = new ParsePipeline(libVlcInstance, mParseConcurrency);
+                ArrayList<Media> batch = new ArrayList<Media>(PUBLISH_BATCH_SIZE);
+                ArrayList<Media> newBatch = new ArrayList<Media>(PUBLISH_BATCH_SIZE);
+                for (int i = 0; i < mediaToScan.size(); ++i) {
+                    ScannedFile file = mediaToScan.get(i);
+                    String fileURI = LibVLC.PathToURI(file.path);
+                    MainActivity.sendTextInfo(file.path.substring(file.path.lastIndexOf('/') + 1),
+                            count, mediaToScan.size());
+                    count++;
+                    /**
+                     * only add file if it is not already in the list. eg. if
+                     * user select an subfolder as well
+                     */
+                    if (!addedLocations.add(fileURI))
                         continue;
-                    }
-
-                    // Filter the extensions and the folders
-                    try {
-                        if ((f = dir.listFiles(mediaFileFilter)) != null) {
-                            for (File file : f) {
-                                if (file.isFile()) {
-                                    mediaToScan.add(file);
-                                } else if (file.isDirectory()) {
-                                    directories.push(file);
-                                }
-                            }
+                    Media media = existingMedias.get(fileURI);
+                    if (media != null && file.size >= 0) {
+                        // its folder changed, check if the file did too
+                        if (fileFingerprints == null)
+                            fileFingerprints = DBManager.getFileFingerprints();
+                        long[] fingerprint = fileFingerprints.get(fileURI);
+                        if (fingerprint == null || fingerprint[0] != file.size
+                                || fingerprint[1] != file.lastModified) {
+                            media = null;
+                            changedFiles++;
                         }
-                    } catch (Exception e)
-                    {
-                        // listFiles can fail in OutOfMemoryError, go to the next folder
-                        continue;
-                    }
-
-                    if (isStopping) {
-                        Log.d(TAG, "Stopping scan");
-                        return;
+                    } else if (media == null) {
+                        newFiles++;
                     }
-                }
-
-                // Process the stacked items
-                for (File file : mediaToScan) {
-                    String fileURI = LibVLC.PathToURI(file.getPath());
-                    MainActivity.sendTextInfo(file.getName(), count,
-                            mediaToScan.size());
-                    count++;
-                    if (existingMedias.containsKey(fileURI)) {
-                        /**
-                         * only add file if it is not already in the list. eg. if
-                         * user select an subfolder as well
-                         */
-                        if (!addedLocations.contains(fileURI)) {
-                            mItemListLock.writeLock().lock();
-                            // get existing media item from database
-                            mItemList.add(existingMedias.get(fileURI));
-                            mItemListLock.writeLock().unlock();
-                            addedLocations.add(fileURI);
-                        }
+                    if (media != null) {
+                        // get existing media item from database
+                        batch.add(media);
                     } else {
-                        mItemListLock.writeLock().lock();
-                        // create new media item
-                        Media m = new Media(libVlcInstance, fileURI);
-                        mItemList.add(m);
-                        // Add this item to database
-                        MediaDatabase db = MediaDatabase.getInstance();
-                        db.addMedia(m);
-                        mItemListLock.writeLock().unlock();
+                        // parse the new media item in the background
+                        if (file.size >= 0) {
+                            parsedFiles.put(fileURI, new long[] { file.size, file.lastModified });
+                        } else {
+                            File f = new File(file.path);
+                            parsedFiles.put(fileURI, new long[] { f.length(), f.lastModified() });
+                        }
+                        parsedPaths.put(fileURI, file.path);
+                        pipeline.submit(fileURI);
                     }
+                    pipeline.drainTo(newBatch);
+                    if (batch.size() + newBatch.size() >= PUBLISH_BATCH_SIZE)
+                        publish(batch, newBatch);
                     if (isStopping) {
                         Log.d(TAG, "Stopping scan");
                         return;
                     }
                 }
+                pipeline.await();
+                pipeline.drainTo(newBatch);
+                publish(batch, newBatch);
+                DBManager.getWriter().flush();
+                // the media not parsed are parsed again by the next scan:
+                // neither them nor their folders are fingerprinted
+                for (String location : pipeline.removeTimedOut(parsedFiles)) {
+                    String path = parsedPaths.get(location);
+                    walk.listed.remove(path.substring(0, path.lastIndexOf('/')));
+                }
+
+                // the scan is complete, the fingerprints can be trusted by
+                // the next one
+                DBManager.setFileFingerprints(parsedFiles);
+                if (Environment.getExternalStorageState().equals(Environment.MEDIA_MOUNTED))
+                    DBManager.setDirFingerprints(walk.listed, walk.known.keySet());
+                else
+                    DBManager.setDirFingerprints(walk.listed, new HashSet<String>());
+
+                ScanStats stats = new ScanStats();
+                stats.directories = walk.dirs;
+                stats.listedDirectories = walk.listedDirs;
+                stats.files = mediaToScan.size();
+                stats.newFiles = newFiles;
+                stats.changedFiles = changedFiles;
+                stats.timedOut = pipeline.getTimedOut();
+                stats.walkTime = (walkEnd - start) / 1000000;
+                stats.processTime = (System.nanoTime() - walkEnd) / 1000000;
+                stats.throughput = stats.files * 1000 / Math.max(1, stats.processTime);
+                mScanStats = stats;
+                Log.d(TAG, String.format("Scanned %d files (%d new, %d changed, %d timed out) in %d folders (%d listed): walk %d ms, process %d ms (%d files/s, %d parses in flight)",
+                        stats.files, stats.newFiles, stats.changedFiles, stats.timedOut,
+                        stats.directories, stats.listedDirectories, stats.walkTime,
+                        stats.processTime, stats.throughput, mParseConcurrency));
+                pipeline = null;
+
+                // keep the library up to date until the next scan
+                startWatching(mediaDirs);
             } finally {
+                // wait for the parses in flight, so that no media is
+                // added after the scan
+                if (pipeline != null) {
+                    pipeline.cancel();
+                    pipeline.await();
+                }
+
                 // update the video and audio activities
                 for (int i = 0; i < mUpdateHandler.size(); i++) {
                     Handler h = mUpdateHandler.get(i);
@@ -366,6 +447,548 @@ public class MediaLibrary {
         }
     };
 
+    private List<File> getMediaDirs() {
+        List<File> mediaDirs = MediaDatabase.getInstance().getMediaDirs();
+        if (mediaDirs.size() == 0) {
+            // Use all available storage directories as our default
+            String storageDirs[] = AndroidDevices.getMediaDirectories();
+            for (String dir: storageDirs) {
+                File f = new File(dir);
+                if (f.exists())
+                    mediaDirs.add(f);
+            }
+        }
+        return mediaDirs;
+    }
+
+    /**
+     * A media file found by a walk, with the size and modification date
+     * read when listing its folder, or -1 if its folder was not listed
+     */
+    private static class ScannedFile {
+        final String path;
+        final long size;
+        final long lastModified;
+
+        ScannedFile(String path, long size, long lastModified) {
+            this.path = path;
+            this.size = size;
+            this.lastModified = lastModified;
+        }
+    }
+
+    /**
+     * Result of a walk of the media folders
+     */
+    private static class Walk {
+        /* Fingerprints of the last complete scan, removed as their folder
+         * is walked: the remaining ones are the folders that disappeared */
+        final HashMap<String, MediaDatabase.DirFingerprint> known;
+        /* Fingerprints of the folders listed by this walk */
+        final HashMap<String, MediaDatabase.DirFingerprint> listed =
+                new HashMap<String, MediaDatabase.DirFingerprint>();
+        final ArrayList<ScannedFile> files = new ArrayList<ScannedFile>();
+        final long start = System.currentTimeMillis();
+        /* Folders walked, and listed */
+        int dirs;
+        int listedDirs;
+        /* The walk is stopped with the watcher, instead of the scan */
+        boolean watching = false;
+
+        Walk(HashMap<String, MediaDatabase.DirFingerprint> known) {
+            this.known = known;
+        }
+
+        /**
+         * Add the files of a folder that did not change
+         */
+        void addUnchanged(String path, MediaDatabase.DirFingerprint fingerprint) {
+            dirs++;
+            for (String name : fingerprint.files)
+                files.add(new ScannedFile(path + "/" + name, -1, -1));
+        }
+
+        /**
+         * Keep the fingerprint of a listed folder, unless it was modified
+         * too recently to be trusted
+         */
+        void addListed(String path, long lastModified, ArrayList<String> files,
+                ArrayList<String> dirs) {
+            this.dirs++;
+            listedDirs++;
+            if (lastModified != 0 && start - lastModified > DIR_MTIME_GRANULARITY)
+                listed.put(path, new MediaDatabase.DirFingerprint(lastModified,
+                        files.toArray(new String[files.size()]),
+                        dirs.toArray(new String[dirs.size()])));
+        }
+    }
+
+    /**
+     * @return true if the scan, or the watcher for its walks, is stopping
+     */
+    private boolean isStopped(Walk walk) {
+        return walk.watching ? mWatchStopping : isStopping;
+    }
+
+    /**
+     * Walk the media folders natively, or in Java if the native walker
+     * cannot be created
+     * @return false if the scan was stopped
+     */
+    private boolean walk(List<File> roots, Walk walk) {
+        MediaWalker walker = MediaWalker.create(roots, walk.known);
+        if (walker == null) {
+            Log.w(TAG, "Could not walk the media folders natively");
+            return walkJava(roots, walk);
+        }
+        return walkNative(walker, walk);
+    }
+
+    /**
+     * Walk the media folders with MediaWalker, and release it
+     * @return false if the scan was stopped
+     */
+    private boolean walkNative(MediaWalker walker, Walk walk) {
+        try {
+            String dir = null;
+            long lastModified = 0;
+            ArrayList<String> files = null;
+            ArrayList<String> dirs = null;
+            while (walker.next()) {
+                switch (walker.getKind()) {
+                    case MediaWalker.DIR:
+                        if (dir != null)
+                            walk.addListed(dir, lastModified, files, dirs);
+                        if (isStopped(walk))
+                            return false;
+                        dir = walker.getPath();
+                        lastModified = walker.getLastModified();
+                        files = new ArrayList<String>();
+                        dirs = new ArrayList<String>();
+                        walk.known.remove(dir);
+                        break;
+                    case MediaWalker.DIR_UNCHANGED:
+                        // Reuse the listing of the last scan
+                        MediaDatabase.DirFingerprint fingerprint = walk.known.remove(walker.getPath());
+                        if (fingerprint == null)
+                            break;
+                        walk.addUnchanged(walker.getPath(), fingerprint);
+                        for (String name : fingerprint.dirs)
+                            walker.push(walker.getPath() + "/" + name);
+                        break;
+                    case MediaWalker.SUBDIR:
+                        dirs.add(walker.getName());
+                        break;
+                    default:
+                        files.add(walker.getName());
+                        walk.files.add(new ScannedFile(walker.getPath(),
+                                walker.getSize(), walker.getLastModified()));
+                        break;
+                }
+            }
+            if (dir != null)
+                walk.addListed(dir, lastModified, files, dirs);
+        } finally {
+            walker.release();
+        }
+        return !(isStopped(walk));
+    }
+
+    /**
+     * Walk the media folders with File.listFiles(), only used if the
+     * native walker cannot be, and to compare them
+     * @return false if the scan was stopped
+     */
+    private boolean walkJava(List<File> roots, Walk walk) {
+        final Stack<File> directories = new Stack<File>();
+        final HashSet<String> directoriesScanned = new HashSet<String>();
+        MediaItemFilter mediaFileFilter = new MediaItemFilter();
+
+        directories.addAll(roots);
+        while (!directories.isEmpty()) {
+            File dir = directories.pop();
+            String dirPath = dir.getAbsolutePath();
+            File[] f = null;
+
+            // Skip some system folders
+            if (dirPath.startsWith("/proc/") || dirPath.startsWith("/sys/") || dirPath.startsWith("/dev/"))
+                continue;
+
+            // Do not scan again if same canonical path
+            try {
+                if (!directoriesScanned.add(dir.getCanonicalPath()))
+                    continue;
+            } catch (IOException e) {
+                e.printStackTrace();
+            }
+
+            if (isStopped(walk))
+                return false;
+
+            // Reuse the listing of the last scan if the folder did not
+            // change: adding, removing or renaming an entry, including
+            // .nomedia, updates its modification date
+            long lastModified = dir.lastModified();
+            MediaDatabase.DirFingerprint fingerprint = walk.known.remove(dirPath);
+            if (fingerprint != null && lastModified != 0
+                    && fingerprint.lastModified == lastModified) {
+                walk.addUnchanged(dirPath, fingerprint);
+                for (String name : fingerprint.dirs)
+                    directories.push(new File(dirPath, name));
+                continue;
+            }
+
+            ArrayList<String> files = new ArrayList<String>();
+            ArrayList<String> dirs = new ArrayList<String>();
+
+            // Do no scan media in .nomedia folders
+            if (!new File(dirPath + "/.nomedia").exists()) {
+                // Filter the extensions and the folders
+                try {
+                    if ((f = dir.listFiles(mediaFileFilter)) == null)
+                        continue;
+                    for (File file : f) {
+                        if (file.isFile()) {
+                            walk.files.add(new ScannedFile(file.getPath(),
+                                    file.length(), file.lastModified()));
+                            files.add(file.getName());
+                        } else if (file.isDirectory()) {
+                            directories.push(file);
+                            dirs.add(file.getName());
+                        }
+                    }
+                } catch (Exception e)
+                {
+                    // listFiles can fail in OutOfMemoryError, go to the next folder
+                    continue;
+                }
+            }
+
+            walk.addListed(dirPath, lastModified, files, dirs);
+        }
+        return true;
+    }
+
+    /**
+     * Measure the walk of the media folders, natively and in Java, as done
+     * by the first scan: without the fingerprints of the last one. Each
+     * walk is done twice, and the second one measured, so that both find
+     * the file system metadata in the kernel caches.
+     */
+    public String benchmarkWalk() {
+        List<File> roots = getMediaDirs();
+        long javaTime = 0, nativeTime = 0;
+        Walk javaWalk = null, nativeWalk = null;
+        for (int i = 0; i < 2; ++i) {
+            long start = System.nanoTime();
+            javaWalk = new Walk(new HashMap<String, MediaDatabase.DirFingerprint>());
+            walkJava(roots, javaWalk);
+            javaTime = System.nanoTime() - start;
+
+            start = System.nanoTime();
+            nativeWalk = new Walk(new HashMap<String, MediaDatabase.DirFingerprint>());
+            MediaWalker walker = MediaWalker.create(roots, nativeWalk.known);
+            if (walker == null)
+                return "The native walker is not available";
+            walkNative(walker, nativeWalk);
+            nativeTime = System.nanoTime() - start;
+        }
+
+        String result = String.format("Java: %d files in %d folders, %d ms (%d files/s)\n"
+                + "Native: %d files in %d folders, %d ms (%d files/s)",
+                javaWalk.files.size(), javaWalk.dirs, javaTime / 1000000,
+                javaWalk.files.size() * 1000000000L / Math.max(1, javaTime),
+                nativeWalk.files.size(), nativeWalk.dirs, nativeTime / 1000000,
+                nativeWalk.files.size() * 1000000000L / Math.max(1, nativeTime));
+        Log.i(TAG, "Walk benchmark: " + result);
+        return result;
+    }
+
+    /**
+     * Watch the media folders, to update the library as soon as their
+     * media change, without scanning them again
+     */
+    private synchronized void startWatching(List<File> mediaDirs) {
+        stopWatching();
+        // a storage mounted later would not be seen
+        if (!Environment.getExternalStorageState().equals(Environment.MEDIA_MOUNTED))
+            return;
+        mWatchStopping = false;
+        String[] dirs = new String[mediaDirs.size()];
+        for (int i = 0; i < dirs.length; ++i)
+            dirs[i] = mediaDirs.get(i).getAbsolutePath();
+        mWatcher = LibVLC.nativeWatcherStart(dirs,
+                Media.FOLDER_BLACKLIST.toArray(new String[Media.FOLDER_BLACKLIST.size()]),
+                mWatchCallback);
+        mWatchLost = false;
+    }
+
+    private synchronized void stopWatching() {
+        // do not wait for the walk and the parses of the watcher thread
+        mWatchStopping = true;
+        ParsePipeline pipeline = mWatchPipeline;
+        if (pipeline != null)
+            pipeline.cancel();
+        if (mWatcher != 0) {
+            LibVLC.nativeWatcherStop(mWatcher);
+            mWatcher = 0;
+        }
+    }
+
+    /**
+     * @return true if the library is kept up to date with the media
+     *         folders, since the last complete scan
+     */
+    public boolean isWatching() {
+        return mWatcher != 0 && !mWatchLost;
+    }
+
+    /* Called by the watcher thread: it must not take the MediaLibrary lock,
+     * held while the watcher is stopped */
+    private final LibVLC.WatchCallback mWatchCallback = new LibVLC.WatchCallback() {
+        @Override
+        public void onChanges(String[] paths, int[] events) {
+            applyChanges(paths, events);
+        }
+    };
+
+    /**
+     * Update the library with a batch of changes of the media folders: the
+     * new media are parsed, and the removed ones dropped, from the list and
+     * the database.
+     */
+    private void applyChanges(String[] paths, int[] events) {
+        LibVLC libVlc;
+        try {
+            libVlc = VLCInstance.getLibVlcInstance();
+        } catch (LibVlcException e) {
+            return;
+        }
+        long start = System.nanoTime();
+
+        MediaItemFilter mediaFileFilter = new MediaItemFilter();
+        HashSet<String> removed = new HashSet<String>();
+        ArrayList<String> removedDirs = new ArrayList<String>();
+        ArrayList<ScannedFile> added = new ArrayList<ScannedFile>();
+        ArrayList<File> addedDirs = new ArrayList<File>();
+        for (int i = 0; i < paths.length; ++i) {
+            switch (events[i]) {
+                case LibVLC.WATCH_ADDED:
+                    File file = new File(paths[i]);
+                    if (mediaFileFilter.accept(file) && file.isFile()
+                            && !new File(file.getParent(), ".nomedia").exists())
+                        added.add(new ScannedFile(paths[i], file.length(), file.lastModified()));
+                    break;
+                case LibVLC.WATCH_REMOVED:
+                    removed.add(LibVLC.PathToURI(paths[i]));
+                    break;
+                case LibVLC.WATCH_DIR_ADDED:
+                    addedDirs.add(new File(paths[i]));
+                    break;
+                case LibVLC.WATCH_DIR_REMOVED:
+                    removedDirs.add(LibVLC.PathToURI(paths[i]) + "/");
+                    break;
+                default:
+                    // the changes were lost, scan everything again
+                    mWatchLost = true;
+                    restartHandler.sendEmptyMessage(1);
+                    return;
+            }
+        }
+
+        // the new media, and the rewritten ones, are parsed as the scan
+        // does: stopWatching() sets mWatchStopping, then cancels the
+        // pipeline published here, so one of them sees the other
+        ParsePipeline pipeline = new ParsePipeline(libVlc, mParseConcurrency);
+        mWatchPipeline = pipeline;
+        if (mWatchStopping)
+            pipeline.cancel();
+
+        // the folders that appeared may already have media, if moved
+        if (!addedDirs.isEmpty()) {
+            Walk walk = new Walk(new HashMap<String, MediaDatabase.DirFingerprint>());
+            walk.watching = true;
+            walk(addedDirs, walk);
+            added.addAll(walk.files);
+        }
+
+        HashMap<String, long[]> parsedFiles = new HashMap<String, long[]>();
+        for (ScannedFile file : added) {
+            if (mWatchStopping)
+                break;
+            String location = LibVLC.PathToURI(file.path);
+            if (parsedFiles.containsKey(location))
+                continue;
+            parsedFiles.put(location, new long[] { file.size, file.lastModified });
+            pipeline.submit(location);
+        }
+        pipeline.await();
+        mWatchPipeline = null;
+        // the next scan takes over
+        if (mWatchStopping || pipeline.isCancelled())
+            return;
+        pipeline.removeTimedOut(parsedFiles);
+
+        ArrayList<Media> parsed = new ArrayList<Media>();
+        pipeline.drainTo(parsed);
+        HashMap<String, Media> newMedias = new HashMap<String, Media>();
+        for (Media media : parsed)
+            newMedias.put(media.getLocation(), media);
+
+        mItemListLock.writeLock().lock();
+        for (Iterator<Media> it = mItemList.iterator(); it.hasNext(); ) {
+            String location = it.next().getLocation();
+            boolean drop = removed.contains(location) || newMedias.containsKey(location);
+            for (int i = 0; !drop && i < removedDirs.size(); ++i)
+                drop = location.startsWith(removedDirs.get(i));
+            if (drop) {
+                it.remove();
+                removed.add(location);
+            }
+        }
+        mItemList.addAll(newMedias.values());
+        mItemListLock.writeLock().unlock();
+
+        MediaDatabase db = MediaDatabase.getInstance();
+        MediaDatabase.Writer writer = db.getWriter();
+        for (String location : removed)
+            writer.removeMedia(location);
+        for (Media media : newMedias.values())
+            writer.addMedia(media);
+        writer.flush();
+        db.setFileFingerprints(parsedFiles);
+
+        for (int i = 0; i < mUpdateHandler.size(); i++)
+            mUpdateHandler.get(i).sendEmptyMessage(MEDIA_ITEMS_UPDATED);
+
+        Log.d(TAG, String.format("Applied %d changes: %d media added, %d removed, in %d ms",
+                paths.length, newMedias.size(), removed.size(),
+                (System.nanoTime() - start) / 1000000));
+    }
+
+    /**
+     * Add a batch of media to the list, and the new ones to the database,
+     * then clear the batches. The media are parsed before, out of the lock.
+     */
+    private void publish(ArrayList<Media> batch, ArrayList<Media> newBatch) {
+        mItemListLock.writeLock().lock();
+        mItemList.addAll(batch);
+        mItemList.addAll(newBatch);
+        mItemListLock.writeLock().unlock();
+
+        // written by batches, flushed at the end of the scan
+        MediaDatabase.Writer writer = MediaDatabase.getInstance().getWriter();
+        for (Media m : newBatch)
+            writer.addMedia(m);
+        batch.clear();
+        newBatch.clear();
+    }
+
+    /**
+     * Parse the new media with LibVLC.parseAsync(), with up to concurrency
+     * media in flight.
+     */
+    private class ParsePipeline implements LibVLC.ParseCallback {
+        private final LibVLC mLibVlc;
+        private final int mConcurrency;
+        private final Semaphore mSlots;
+        /* Parses in flight: id -> location */
+        private final HashMap<Integer, String> mJobs = new HashMap<Integer, String>();
+        private final LinkedBlockingQueue<Media> mResults = new LinkedBlockingQueue<Media>();
+        /* Media that timed out or failed, guarded by mJobs */
+        private final HashSet<String> mTimedOut = new HashSet<String>();
+        private volatile boolean mCancelled = false;
+
+        public ParsePipeline(LibVLC libVlc, int concurrency) {
+            mLibVlc = libVlc;
+            mConcurrency = concurrency;
+            mSlots = new Semaphore(concurrency);
+        }
+
+        /**
+         * Start parsing a media, once there are less than concurrency media
+         * in flight.
+         */
+        public void submit(String location) {
+            mSlots.acquireUninterruptibly();
+            synchronized (mJobs) {
+                if (mCancelled) {
+                    mSlots.release();
+                    return;
+                }
+                int id = mLibVlc.parseAsync(location, PARSE_TIMEOUT, this);
+                if (id >= 0) {
+                    mJobs.put(id, location);
+                    return;
+                }
+            }
+            mSlots.release();
+            mResults.add(new Media(mLibVlc, location));
+        }
+
+        @Override
+        public void onParsed(int id, TrackInfo[] tracks) {
+            String location;
+            synchronized (mJobs) {
+                location = mJobs.remove(id);
+                if (location != null && tracks == null)
+                    mTimedOut.add(location);
+            }
+            if (location != null && !mCancelled)
+                mResults.add(new Media(location, tracks));
+            mSlots.release();
+        }
+
+        /**
+         * Move the parsed media to list
+         */
+        public void drainTo(ArrayList<Media> list) {
+            mResults.drainTo(list);
+        }
+
+        /**
+         * Cancel the parses in flight, and the next ones
+         */
+        public void cancel() {
+            synchronized (mJobs) {
+                mCancelled = true;
+                for (int id : mJobs.keySet())
+                    mLibVlc.cancelParse(id);
+            }
+        }
+
+        public boolean isCancelled() {
+            return mCancelled;
+        }
+
+        public int getTimedOut() {
+            synchronized (mJobs) {
+                return mTimedOut.size();
+            }
+        }
+
+        /**
+         * Remove the media that timed out or failed from fingerprints, so
+         * that they are not taken as parsed
+         * @return the locations of these media
+         */
+        public ArrayList<String> removeTimedOut(HashMap<String, long[]> fingerprints) {
+            synchronized (mJobs) {
+                for (String location : mTimedOut)
+                    fingerprints.remove(location);
+                return new ArrayList<String>(mTimedOut);
+            }
+        }
+
+        /**
+         * Wait for the end of the parses in flight
+         */
+        public void await() {
+            mSlots.acquireUninterruptibly(mConcurrency);
+            mSlots.release(mConcurrency);
+        }
+    }
+
     private Handler restartHandler = new RestartHandler(this);
 
     private static class RestartHandler extends WeakHandler<MediaLibrary> {
@@ -0,0 +1,192 @@
+/*****************************************************************************
+ * MediaWalker.java
+ *****************************************************************************
+ * Copyright © 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+package org.videolan.vlc;
+
+import java.io.File;
+import java.io.UnsupportedEncodingException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.List;
+import java.util.Map;
+
+import org.videolan.libvlc.LibVLC;
+import org.videolan.libvlc.Media;
+
+/**
+ * Recursive walk of the media directories, done natively: the entries are
+ * read with readdir(), without a File object nor a stat per entry, and
+ * returned by batches in a direct buffer.
+ *
+ * The hidden entries, the .nomedia folders and the blacklisted folders are
+ * skipped, and each folder is only walked once, even through symbolic
+ * links. Get one with create(), call next() until it returns false, then
+ * release().
+ */
+public class MediaWalker {
+    /** A folder that was read: its media files and sub folders follow */
+    public final static int DIR = 0;
+    /** A folder that did not change since the date given for it: it is not
+     * read, its known sub folders should be pushed back */
+    public final static int DIR_UNCHANGED = 1;
+    /** A sub folder of the last folder read, which will be walked */
+    public final static int SUBDIR = 2;
+    /** A video or audio file of the last folder read */
+    public final static int VIDEO = 3;
+    public final static int AUDIO = 4;
+
+    private final static int BUFFER_SIZE = 64 * 1024;
+
+    private long mWalker;
+    private final ByteBuffer mBuffer = ByteBuffer.allocateDirect(BUFFER_SIZE)
+            .order(ByteOrder.nativeOrder());
+    private byte[] mBytes = new byte[256];
+
+    /* Current record */
+    private int mKind;
+    private String mName;
+    private String mPath;
+    private long mSize;
+    private long mLastModified;
+    /* Last folder read */
+    private String mDir;
+
+    private MediaWalker(long walker) {
+        mWalker = walker;
+        mBuffer.limit(0);
+    }
+
+    /**
+     * @param roots folders to walk
+     * @param known folders not to read again if their modification date is
+     *        still the one of their fingerprint, or null
+     * @return the walker, or null if it could not be created, or the native
+     *         walker is not available
+     */
+    public static MediaWalker create(List<File> roots,
+            Map<String, MediaDatabase.DirFingerprint> known) {
+        String[] rootPaths = new String[roots.size()];
+        for (int i = 0; i < rootPaths.length; ++i)
+            rootPaths[i] = roots.get(i).getAbsolutePath();
+
+        String[] knownPaths = null;
+        long[] knownDates = null;
+        if (known != null) {
+            knownPaths = new String[known.size()];
+            knownDates = new long[known.size()];
+            int i = 0;
+            for (Map.Entry<String, MediaDatabase.DirFingerprint> dir : known.entrySet()) {
+                knownPaths[i] = dir.getKey();
+                knownDates[i] = dir.getValue().lastModified;
+                i++;
+            }
+        }
+
+        long walker;
+        try {
+            walker = LibVLC.nativeWalkerNew(rootPaths,
+                    Media.VIDEO_EXTENSIONS.toArray(new String[Media.VIDEO_EXTENSIONS.size()]),
+                    Media.AUDIO_EXTENSIONS.toArray(new String[Media.AUDIO_EXTENSIONS.size()]),
+                    Media.FOLDER_BLACKLIST.toArray(new String[Media.FOLDER_BLACKLIST.size()]),
+                    knownPaths, knownDates);
+        } catch (UnsatisfiedLinkError e) {
+            return null;
+        }
+        return walker != 0 ? new MediaWalker(walker) : null;
+    }
+
+    /**
+     * Walk a folder too, after the current one
+     */
+    public void push(String path) {
+        LibVLC.nativeWalkerPush(mWalker, path);
+    }
+
+    /**
+     * Move to the next record
+     * @return false at the end of the walk
+     */
+    public boolean next() {
+        if (!mBuffer.hasRemaining()) {
+            mBuffer.clear();
+            int size = LibVLC.nativeWalkerNext(mWalker, mBuffer);
+            if (size <= 0) {
+                mBuffer.limit(0);
+                return false;
+            }
+            mBuffer.limit(size);
+        }
+
+        mKind = mBuffer.getInt();
+        int length = mBuffer.getInt();
+        mSize = mBuffer.getLong();
+        mLastModified = mBuffer.getLong();
+        if (length > mBytes.length)
+            mBytes = new byte[Math.max(length, 2 * mBytes.length)];
+        mBuffer.get(mBytes, 0, length);
+        try {
+            mName = new String(mBytes, 0, length, "UTF-8");
+        } catch (UnsupportedEncodingException e) {
+            throw new RuntimeException(e);
+        }
+
+        if (mKind == DIR || mKind == DIR_UNCHANGED) {
+            mPath = mName;
+            if (mKind == DIR)
+                mDir = mName;
+        } else {
+            mPath = mDir + "/" + mName;
+        }
+        return true;
+    }
+
+    /** Kind of the current record */
+    public int getKind() {
+        return mKind;
+    }
+
+    /** Name of the current sub folder or media file, full path of the
+     * current folder */
+    public String getName() {
+        return mName;
+    }
+
+    /** Full path of the current record */
+    public String getPath() {
+        return mPath;
+    }
+
+    /** Size of the current media file */
+    public long getSize() {
+        return mSize;
+    }
+
+    /** Modification date of the current folder or media file, in ms */
+    public long getLastModified() {
+        return mLastModified;
+    }
+
+    public void release() {
+        if (mWalker != 0) {
+            LibVLC.nativeWalkerRelease(mWalker);
+            mWalker = 0;
+        }
+    }
+}
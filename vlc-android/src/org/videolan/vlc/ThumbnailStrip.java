@@ -0,0 +1,235 @@
+/*****************************************************************************
+ * ThumbnailStrip.java
+ *****************************************************************************
+ * Copyright © 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+package org.videolan.vlc;
+
+import java.io.BufferedInputStream;
+import java.io.BufferedOutputStream;
+import java.io.DataInputStream;
+import java.io.DataOutputStream;
+import java.io.File;
+import java.io.FileInputStream;
+import java.io.FileOutputStream;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+
+import org.videolan.libvlc.LibVLC;
+import org.videolan.vlc.util.MurmurHash;
+import org.videolan.vlc.util.ThumbnailStore;
+
+import android.content.Context;
+import android.graphics.Bitmap;
+import android.graphics.Bitmap.Config;
+import android.graphics.BitmapFactory;
+import android.util.Log;
+
+/**
+ * Keyframes evenly spaced in a video, packed in a sprite atlas, for the
+ * seek previews. The strips are stored in the cache directory, so they
+ * are only created on the first play of a video, and again if its file
+ * changes: they are keyed by the identity of the file, see
+ * ThumbnailStore.getIdentity().
+ */
+public class ThumbnailStrip {
+    public final static String TAG = "VLC/ThumbnailStrip";
+
+    private final static int MAGIC = 0x564c4353; // VLCS
+    private final static int VERSION = 2;
+    private final static String CACHE_DIR = "strips";
+
+    public final static int DEFAULT_COUNT = 20;
+    public final static int DEFAULT_COLUMNS = 5;
+
+    private final String mMrl;
+    /* Size and modification date of the file when the strip was created */
+    private final long mSize;
+    private final long mLastModified;
+    private final Bitmap mAtlas;
+    private final int mTileWidth;
+    private final int mTileHeight;
+    /* Index of the tiles: time in ms and position in the atlas */
+    private final long[] mTimes;
+    private final int[] mX;
+    private final int[] mY;
+    private final Bitmap[] mTiles;
+
+    private ThumbnailStrip(String mrl, long size, long lastModified, Bitmap atlas,
+            int tileWidth, int tileHeight, long[] times, int[] x, int[] y) {
+        mMrl = mrl;
+        mSize = size;
+        mLastModified = lastModified;
+        mAtlas = atlas;
+        mTileWidth = tileWidth;
+        mTileHeight = tileHeight;
+        mTimes = times;
+        mX = x;
+        mY = y;
+        mTiles = new Bitmap[times.length];
+    }
+
+    /**
+     * Create the strip of a video. This takes a while, do not call it from
+     * the UI thread.
+     * @return the strip, or null if no thumbnail could be created
+     */
+    public static ThumbnailStrip create(LibVLC libVlc, String mrl, int count, int columns,
+            int tileWidth, int tileHeight) {
+        long[] identity = ThumbnailStore.getIdentity(mrl);
+        int rows = (count + columns - 1) / columns;
+        ByteBuffer buffer = ByteBuffer.allocateDirect(columns * tileWidth * rows * tileHeight * 4);
+        long[] nativeTimes = new long[count];
+        if (libVlc.getThumbnailStrip(mrl, buffer, tileWidth, tileHeight, columns, nativeTimes) == 0)
+            return null;
+
+        Bitmap atlas = Bitmap.createBitmap(columns * tileWidth, rows * tileHeight, Config.ARGB_8888);
+        atlas.copyPixelsFromBuffer(buffer);
+
+        // Only index the tiles that were created
+        int n = 0;
+        for (long time : nativeTimes)
+            if (time >= 0)
+                n++;
+        long[] times = new long[n];
+        int[] x = new int[n];
+        int[] y = new int[n];
+        for (int i = 0, j = 0; i < count; ++i) {
+            if (nativeTimes[i] < 0)
+                continue;
+            times[j] = nativeTimes[i];
+            x[j] = (i % columns) * tileWidth;
+            y[j] = (i / columns) * tileHeight;
+            j++;
+        }
+        return new ThumbnailStrip(mrl, identity[1], identity[2], atlas, tileWidth, tileHeight,
+                times, x, y);
+    }
+
+    private static File getFile(Context context, String mrl) {
+        File dir = new File(context.getCacheDir(), CACHE_DIR);
+        return new File(dir, Long.toHexString(MurmurHash.hash64(mrl)) + ".strip");
+    }
+
+    /**
+     * Load the strip of a video from the cache.
+     * @return the strip, or null if it is not in the cache, or was created
+     *         for another version of the file
+     */
+    public static ThumbnailStrip load(Context context, String mrl) {
+        File file = getFile(context, mrl);
+        if (!file.exists())
+            return null;
+
+        DataInputStream in = null;
+        try {
+            in = new DataInputStream(new BufferedInputStream(new FileInputStream(file)));
+            if (in.readInt() != MAGIC || in.readInt() != VERSION || !mrl.equals(in.readUTF()))
+                return null;
+            long[] identity = ThumbnailStore.getIdentity(mrl);
+            long size = in.readLong();
+            long lastModified = in.readLong();
+            if (size != identity[1] || lastModified != identity[2])
+                return null;
+            int tileWidth = in.readInt();
+            int tileHeight = in.readInt();
+            int n = in.readInt();
+            long[] times = new long[n];
+            int[] x = new int[n];
+            int[] y = new int[n];
+            for (int i = 0; i < n; ++i) {
+                times[i] = in.readLong();
+                x[i] = in.readInt();
+                y[i] = in.readInt();
+            }
+            Bitmap atlas = BitmapFactory.decodeStream(in);
+            if (atlas == null)
+                return null;
+            return new ThumbnailStrip(mrl, size, lastModified, atlas, tileWidth, tileHeight,
+                    times, x, y);
+        } catch (IOException e) {
+            Log.w(TAG, "Could not read the strip of " + mrl, e);
+            return null;
+        } finally {
+            if (in != null)
+                try {
+                    in.close();
+                } catch (IOException e) {}
+        }
+    }
+
+    /**
+     * Store the strip in the cache.
+     */
+    public void save(Context context) {
+        File file = getFile(context, mMrl);
+        file.getParentFile().mkdirs();
+
+        DataOutputStream out = null;
+        try {
+            out = new DataOutputStream(new BufferedOutputStream(new FileOutputStream(file)));
+            out.writeInt(MAGIC);
+            out.writeInt(VERSION);
+            out.writeUTF(mMrl);
+            out.writeLong(mSize);
+            out.writeLong(mLastModified);
+            out.writeInt(mTileWidth);
+            out.writeInt(mTileHeight);
+            out.writeInt(mTimes.length);
+            for (int i = 0; i < mTimes.length; ++i) {
+                out.writeLong(mTimes[i]);
+                out.writeInt(mX[i]);
+                out.writeInt(mY[i]);
+            }
+            mAtlas.compress(Bitmap.CompressFormat.JPEG, 80, out);
+        } catch (IOException e) {
+            Log.w(TAG, "Could not write the strip of " + mMrl, e);
+            file.delete();
+        } finally {
+            if (out != null)
+                try {
+                    out.close();
+                } catch (IOException e) {}
+        }
+    }
+
+    /**
+     * Get the preview of a time: the tile closest to it.
+     * Call it from the UI thread only.
+     */
+    public Bitmap getPreview(long time) {
+        if (mTimes.length == 0)
+            return null;
+
+        // The tiles are sorted by time
+        int lo = 0, hi = mTimes.length - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) >>> 1;
+            if (mTimes[mid] < time)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo > 0 && time - mTimes[lo - 1] < mTimes[lo] - time)
+            lo--;
+
+        if (mTiles[lo] == null)
+            mTiles[lo] = Bitmap.createBitmap(mAtlas, mX[lo], mY[lo], mTileWidth, mTileHeight);
+        return mTiles[lo];
+    }
+}
@@ -30,6 +30,7 @@ import java.util.concurrent.locks.Lock;
 import java.util.concurrent.locks.ReentrantLock;
 
 import org.videolan.libvlc.LibVLC;
+import org.videolan.libvlc.LibVlcUtil;
 import org.videolan.libvlc.LibVlcException;
 import org.videolan.libvlc.Media;
 import org.videolan.vlc.gui.MainActivity;
@@ -38,8 +39,10 @@ import org.videolan.vlc.util.BitmapUtil;
 import org.videolan.vlc.util.VLCInstance;
 
 import android.content.Context;
+import android.content.SharedPreferences;
 import android.graphics.Bitmap;
 import android.graphics.Bitmap.Config;
+import android.preference.PreferenceManager;
 import android.util.DisplayMetrics;
 import android.util.Log;
 import android.view.Display;
@@ -60,12 +63,21 @@ public class Thumbnailer implements Runnable {
     private int totalCount;
     private final float mDensity;
     private final String mPrefix;
+    private final SharedPreferences mSettings;
+
+    /* Media given to each native thumbnailer thread per batch */
+    private final static int BATCH_SIZE_PER_THREAD = 4;
+    /* Progress, only used by the thumbnailer thread */
+    private int mCount;
+    private int mTotal;
+    private long mBatchTime;
 
     public Thumbnailer(Context context, Display display) {
         DisplayMetrics metrics = new DisplayMetrics();
         display.getMetrics(metrics);
         mDensity = metrics.density;
         mPrefix = context.getResources().getString(R.string.thumbnail);
+        mSettings = PreferenceManager.getDefaultSharedPreferences(context);
     }
 
     public void start(VideoGridFragment videoGridFragment) {
@@ -123,15 +135,18 @@ public class Thumbnailer implements Runnable {
      */
     @Override
     public void run() {
-        int count = 0;
-        int total = 0;
-
         Log.d(TAG, "Thumbnailer started");
 
+        LibVlcUtil.MachineSpecs specs = LibVlcUtil.getMachineSpecs();
+        final int threads = specs != null ? Math.max(specs.processors, 1) : 1;
+        final int width = (int) (120 * mDensity);
+        final int height = (int) (75 * mDensity);
+
+        mCount = 0;
         while (!isStopping) {
             mVideoGridFragment.resetBarrier();
             lock.lock();
-            // Get the id of the file browser item to create its thumbnail.
+            // Get the file browser items to create their thumbnails.
             boolean interrupted = false;
             while (mItems.size() == 0) {
                 try {
@@ -149,47 +164,35 @@ public class Thumbnailer implements Runnable {
                 lock.unlock();
                 break;
             }
-            total = totalCount;
-            Media item = mItems.poll();
+            mTotal = totalCount;
+            // Small batches, so that new jobs do not wait for a long one
+            final Media[] batch = new Media[Math.min(mItems.size(), threads * BATCH_SIZE_PER_THREAD)];
+            for (int i = 0; i < batch.length; ++i)
+                batch[i] = mItems.poll();
             lock.unlock();
 
             MainActivity.showProgressBar();
 
-            MainActivity.sendTextInfo(String.format("%s %s", mPrefix, item.getFileName()), count, total);
-            count++;
-
-            int width = (int) (120 * mDensity);
-            int height = (int) (75 * mDensity);
-
-            // Get the thumbnail.
-            Bitmap thumbnail = Bitmap.createBitmap(width, height, Config.ARGB_8888);
-            //Log.i(TAG, "create new bitmap for: " + item.getName());
-            byte[] b = mLibVlc.getThumbnail(item.getLocation(), width, height);
-
-            if (b == null) {// We were not able to create a thumbnail for this item, store a dummy
-                MediaDatabase.setPicture(item, Bitmap.createBitmap(1, 1, Config.ARGB_8888));
-                continue;
-            }
-
-            thumbnail.copyPixelsFromBuffer(ByteBuffer.wrap(b));
-
-            Log.i(TAG, "Thumbnail created for " + item.getFileName());
-
-            MediaDatabase.setPicture(item, thumbnail);
-            // Post to the file browser the new item.
-            mVideoGridFragment.setItemToUpdate(item);
-
-            // Wait for the file browser to process the change.
-            try {
-                mVideoGridFragment.await();
-            } catch (InterruptedException e) {
-                Log.i(TAG, "interruption probably requested by stop()");
-                break;
-            } catch (BrokenBarrierException e) {
-                Log.e(TAG, "Unexpected BrokenBarrierException");
-                e.printStackTrace();
-                break;
-            }
+            String[] mrls = new String[batch.length];
+            for (int i = 0; i < batch.length; ++i)
+                mrls[i] = batch[i].getLocation();
+
+            int mode = mSettings.getBoolean("enable_best_thumbnails", false)
+                    ? LibVLC.THUMBNAIL_BEST : LibVLC.THUMBNAIL_KEYFRAME;
+            long start = System.nanoTime();
+            mBatchTime = 0;
+            int done = mLibVlc.getThumbnails(mrls, width, height, mode, threads,
+                    new LibVLC.ThumbnailCallback() {
+                @Override
+                public boolean onThumbnail(int index, ByteBuffer b, long duration) {
+                    mBatchTime += duration;
+                    return onThumbnailCreated(batch[index], b, width, height);
+                }
+            });
+            if (done > 0)
+                Log.d(TAG, String.format("%d thumbnails in %d ms with %d threads (%d ms each)",
+                        done, (System.nanoTime() - start) / 1000000, threads,
+                        mBatchTime / done / 1000000));
         }
         /* cleanup */
         MainActivity.hideProgressBar();
@@ -197,4 +200,43 @@ public class Thumbnailer implements Runnable {
         mVideoGridFragment = null;
         Log.d(TAG, "Thumbnailer stopped");
     }
+
+    /**
+     * Store a thumbnail and wait for the file browser to show it.
+     * Called on the thumbnailer thread.
+     * @return false if the thumbnailer is stopping
+     */
+    private boolean onThumbnailCreated(Media item, ByteBuffer b, int width, int height) {
+        MainActivity.sendTextInfo(String.format("%s %s", mPrefix, item.getFileName()), mCount, mTotal);
+        mCount++;
+
+        if (b == null) {// We were not able to create a thumbnail for this item, store a dummy
+            MediaDatabase.setPicture(item, Bitmap.createBitmap(1, 1, Config.ARGB_8888));
+            return !isStopping;
+        }
+
+        // Get the thumbnail.
+        Bitmap thumbnail = Bitmap.createBitmap(width, height, Config.ARGB_8888);
+        thumbnail.copyPixelsFromBuffer(b);
+
+        Log.i(TAG, "Thumbnail created for " + item.getFileName());
+
+        MediaDatabase.setPicture(item, thumbnail);
+        // Post to the file browser the new item.
+        mVideoGridFragment.resetBarrier();
+        mVideoGridFragment.setItemToUpdate(item);
+
+        // Wait for the file browser to process the change.
+        try {
+            mVideoGridFragment.await();
+        } catch (InterruptedException e) {
+            Log.i(TAG, "interruption probably requested by stop()");
+            return false;
+        } catch (BrokenBarrierException e) {
+            Log.e(TAG, "Unexpected BrokenBarrierException");
+            e.printStackTrace();
+            return false;
+        }
+        return !isStopping;
+    }
 }
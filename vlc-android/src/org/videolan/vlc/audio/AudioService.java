@@ -164,6 +164,7 @@ public class AudioService extends Service {
         mNextIndex = -1;
         mPrevious = new Stack<Integer>();
         mEventHandler = EventHandler.getInstance();
+        updateEventSubscriptions();
         mRemoteControlClientReceiverComponent = new ComponentName(getPackageName(),
                 RemoteControlClientReceiver.class.getName());
 
@@ -801,11 +802,28 @@ public class AudioService extends Service {
         changeAudioFocus(false);
     }
 
+    /**
+     * Nobody listens to the time events, and the position events only
+     * update the widget, so there is no need for more than one per second
+     * when no activity is bound.
+     */
+    private void updateEventSubscriptions() {
+        mEventHandler.setEventEnabled(EventHandler.MediaPlayerTimeChanged, false);
+        mEventHandler.setProgressInterval(mCallback.isEmpty() ? 1000 : 250);
+    }
+
     private void determinePrevAndNextIndices() {
         determinePrevAndNextIndices(false);
     }
 
     private void determinePrevAndNextIndices(boolean expand) {
+        findPrevAndNextIndices(expand);
+        // Open the next media ahead for a faster switch
+        if (mNextIndex != -1 && mNextIndex != mCurrentIndex)
+            mLibVLC.preloadIndex(mNextIndex);
+    }
+
+    private void findPrevAndNextIndices(boolean expand) {
         mNextIndex = expand ? mLibVLC.expand() : -1;
         mPrevIndex = -1;
 
@@ -1065,6 +1083,7 @@ public class AudioService extends Service {
             if (count == null)
                 count = 0;
             mCallback.put(cb, count + 1);
+            updateEventSubscriptions();
             if (hasCurrentMedia())
                 mHandler.sendEmptyMessage(SHOW_PROGRESS);
         }
@@ -1079,6 +1098,7 @@ public class AudioService extends Service {
                 mCallback.put(cb, count - 1);
             else
                 mCallback.remove(cb);
+            updateEventSubscriptions();
         }
 
         @Override
@@ -330,8 +330,9 @@ public class MainActivity extends ActionBarActivity {
         if (getIntent().hasExtra(AudioService.START_FROM_NOTIFICATION))
             getIntent().removeExtra(AudioService.START_FROM_NOTIFICATION);
 
-        /* Load media items from database and storage */
-        if (mScanNeeded)
+        /* Load media items from database and storage, unless the library
+         * is kept up to date since the last scan */
+        if (mScanNeeded && !MediaLibrary.getInstance().isWatching())
             MediaLibrary.getInstance().loadMediaItems();
     }
 
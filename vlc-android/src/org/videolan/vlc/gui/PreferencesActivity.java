@@ -20,9 +20,12 @@
 
 package org.videolan.vlc.gui;
 
+import java.util.concurrent.Callable;
+
 import org.videolan.libvlc.LibVLC;
 import org.videolan.libvlc.LibVlcUtil;
 import org.videolan.vlc.MediaDatabase;
+import org.videolan.vlc.MediaLibrary;
 import org.videolan.vlc.R;
 import org.videolan.vlc.VLCApplication;
 import org.videolan.vlc.audio.AudioService;
@@ -30,6 +33,7 @@ import org.videolan.vlc.audio.AudioServiceController;
 import org.videolan.vlc.gui.audio.AudioUtil;
 import org.videolan.vlc.util.BitmapCache;
 import org.videolan.vlc.util.Logcat;
+import org.videolan.vlc.util.ThumbnailStore;
 import org.videolan.vlc.util.VLCInstance;
 
 import android.app.AlertDialog;
@@ -163,6 +167,7 @@ public class PreferencesActivity extends PreferenceActivity implements OnSharedP
                     @Override
                     public boolean onPreferenceClick(Preference preference) {
                         MediaDatabase.getInstance().emptyDatabase();
+                        ThumbnailStore.getInstance().clear();
                         BitmapCache.getInstance().clear();
                         AudioUtil.clearCacheFolders();
                         Toast.makeText(getBaseContext(), R.string.media_db_cleared, Toast.LENGTH_SHORT).show();
@@ -226,6 +231,28 @@ public class PreferencesActivity extends PreferenceActivity implements OnSharedP
                     }
                 });
 
+        setBenchmark("benchmark_thumbnails", R.string.benchmark_thumbnails_running,
+                new Callable<String>() {
+                    @Override
+                    public String call() {
+                        return ThumbnailStore.benchmark(PreferencesActivity.this, 5000);
+                    }
+                });
+        setBenchmark("benchmark_walk", R.string.benchmark_walk_running,
+                new Callable<String>() {
+                    @Override
+                    public String call() {
+                        return MediaLibrary.getInstance().benchmarkWalk();
+                    }
+                });
+        setBenchmark("benchmark_database", R.string.benchmark_database_running,
+                new Callable<String>() {
+                    @Override
+                    public String call() {
+                        return MediaDatabase.benchmark(PreferencesActivity.this, 10000);
+                    }
+                });
+
         // Audio output
         ListPreference aoutPref = (ListPreference) findPreference("aout");
         int aoutEntriesId = LibVlcUtil.isGingerbreadOrLater() ? R.array.aouts : R.array.aouts_froyo;
@@ -327,6 +354,41 @@ public class PreferencesActivity extends PreferenceActivity implements OnSharedP
         AudioServiceController.getInstance().unbindAudioService(this);
     }
 
+    /**
+     * Run a benchmark, which takes a while, on its own thread when the
+     * preference is clicked, and show its result in a toast.
+     */
+    private void setBenchmark(String key, final int runningId, final Callable<String> benchmark) {
+        findPreference(key).setOnPreferenceClickListener(
+                new OnPreferenceClickListener() {
+                    @Override
+                    public boolean onPreferenceClick(Preference preference) {
+                        Toast.makeText(PreferencesActivity.this, runningId,
+                                Toast.LENGTH_SHORT).show();
+                        new Thread(new Runnable() {
+                            @Override
+                            public void run() {
+                                String result;
+                                try {
+                                    result = benchmark.call();
+                                } catch (Exception e) {
+                                    result = e.toString();
+                                }
+                                final String message = result;
+                                runOnUiThread(new Runnable() {
+                                    @Override
+                                    public void run() {
+                                        Toast.makeText(PreferencesActivity.this,
+                                                message, Toast.LENGTH_LONG).show();
+                                    }
+                                });
+                            }
+                        }, "Benchmark").start();
+                        return true;
+                    }
+                });
+    }
+
     private void restartService(Context context) {
         Intent service = new Intent(context, AudioService.class);
 
@@ -127,12 +127,13 @@ public class MediaInfoFragment extends ListFragment {
             // Get the thumbnail.
             mImage = Bitmap.createBitmap(width, height, Config.ARGB_8888);
 
-            byte[] b = mLibVlc.getThumbnail(mItem.getLocation(), width, height);
+            ByteBuffer b = ByteBuffer.allocateDirect(width * height * 4);
 
-            if (b == null) // We were not able to create a thumbnail for this item.
+            if (!mLibVlc.getThumbnail(mItem.getLocation(), b, width, height,
+                    LibVLC.THUMBNAIL_ACCURATE)) // We were not able to create a thumbnail for this item.
                 return;
 
-            mImage.copyPixelsFromBuffer(ByteBuffer.wrap(b));
+            mImage.copyPixelsFromBuffer(b);
             mImage = BitmapUtil.cropBorders(mImage, width, height);
 
             mHandler.sendEmptyMessage(NEW_IMAGE);
@@ -46,6 +46,7 @@ import org.videolan.libvlc.LibVlcUtil;
 import org.videolan.libvlc.Media;
 import org.videolan.vlc.MediaDatabase;
 import org.videolan.vlc.R;
+import org.videolan.vlc.ThumbnailStrip;
 import org.videolan.vlc.VLCApplication;
 import org.videolan.vlc.audio.AudioServiceController;
 import org.videolan.vlc.gui.CommonDialogs;
@@ -164,6 +165,8 @@ public class VideoPlayerActivity extends Activity implements IVideoPlayer {
     private TextView mTime;
     private TextView mLength;
     private TextView mInfo;
+    private ImageView mPreview;
+    private ThumbnailStrip mStrip;
     private ImageView mLoading;
     private TextView mLoadingText;
     private ImageButton mPlayPause;
@@ -305,6 +308,7 @@ public class VideoPlayerActivity extends Activity implements IVideoPlayer {
 
         // the info textView is not on the overlay
         mInfo = (TextView) findViewById(R.id.player_overlay_info);
+        mPreview = (ImageView) findViewById(R.id.player_overlay_preview);
 
         mEnableBrightnessGesture = mSettings.getBoolean("enable_brightness_gesture", true);
         mScreenOrientation = Integer.valueOf(
@@ -1342,6 +1346,7 @@ public class VideoPlayerActivity extends Activity implements IVideoPlayer {
             mDragging = false;
             showOverlay();
             hideInfo();
+            mPreview.setVisibility(View.INVISIBLE);
         }
 
         @Override
@@ -1351,6 +1356,10 @@ public class VideoPlayerActivity extends Activity implements IVideoPlayer {
                 setOverlayProgress();
                 mTime.setText(Strings.millisToString(progress));
                 showInfo(Strings.millisToString(progress));
+                if (mStrip != null) {
+                    mPreview.setImageBitmap(mStrip.getPreview(progress));
+                    mPreview.setVisibility(View.VISIBLE);
+                }
             }
 
         }
@@ -2005,6 +2014,43 @@ public class VideoPlayerActivity extends Activity implements IVideoPlayer {
             title = itemTitle;
         }
         mTitle.setText(title);
+
+        mStrip = null;
+        if (mLocation != null && mLocation.length() > 0 && !dontParse)
+            loadThumbnailStrip(mLocation);
+    }
+
+    /**
+     * Load the seek previews of the media from the cache, or create them
+     * in the background on its first play.
+     */
+    private void loadThumbnailStrip(final String location) {
+        final Context context = getApplicationContext();
+        final int tileWidth = getResources().getDimensionPixelSize(R.dimen.seek_preview_width);
+        final int tileHeight = getResources().getDimensionPixelSize(R.dimen.seek_preview_height);
+        Thread thread = new Thread(new Runnable() {
+            @Override
+            public void run() {
+                android.os.Process.setThreadPriority(android.os.Process.THREAD_PRIORITY_BACKGROUND);
+                ThumbnailStrip strip = ThumbnailStrip.load(context, location);
+                if (strip == null) {
+                    strip = ThumbnailStrip.create(mLibVLC, location, ThumbnailStrip.DEFAULT_COUNT,
+                            ThumbnailStrip.DEFAULT_COLUMNS, tileWidth, tileHeight);
+                    if (strip == null)
+                        return;
+                    strip.save(context);
+                }
+                final ThumbnailStrip result = strip;
+                runOnUiThread(new Runnable() {
+                    @Override
+                    public void run() {
+                        if (location.equals(mLocation))
+                            mStrip = result;
+                    }
+                });
+            }
+        }, "SeekPreviews");
+        thread.start();
     }
 
     @SuppressWarnings("deprecation")
@@ -21,8 +21,6 @@
 package org.videolan.vlc.util;
 
 import org.videolan.libvlc.Media;
-import org.videolan.vlc.MediaDatabase;
-import org.videolan.vlc.VLCApplication;
 
 import android.content.Context;
 import android.graphics.Bitmap;
@@ -89,11 +87,10 @@ public class BitmapUtil {
             Bitmap picture = cache.getBitmapFromMemCache(media.getLocation());
             if(picture == null) {
                 /* Not in memcache:
-                 * serving the file from the database and
-                 * adding it to the memcache for later use.
+                 * serving the file from the thumbnail store and adding it
+                 * to the memcache for later use.
                  */
-                Context c = VLCApplication.getAppContext();
-                picture = MediaDatabase.getInstance().getPicture(c, media.getLocation());
+                picture = ThumbnailStore.getInstance().get(media.getLocation());
                 cache.addBitmapToMemCache(media.getLocation(), picture);
             }
             return picture;
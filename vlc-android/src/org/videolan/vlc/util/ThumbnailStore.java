@@ -0,0 +1,441 @@
+/*****************************************************************************
+ * ThumbnailStore.java
+ *****************************************************************************
+ * Copyright © 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+package org.videolan.vlc.util;
+
+import java.io.ByteArrayOutputStream;
+import java.io.File;
+import java.io.IOException;
+import java.io.RandomAccessFile;
+import java.nio.ByteBuffer;
+import java.nio.MappedByteBuffer;
+import java.nio.channels.FileChannel;
+import java.util.Collection;
+import java.util.HashMap;
+
+import org.videolan.vlc.VLCApplication;
+
+import android.content.Context;
+import android.graphics.Bitmap;
+import android.graphics.Bitmap.Config;
+import android.graphics.BitmapFactory;
+import android.net.Uri;
+import android.util.Log;
+
+/**
+ * Persistent store of the video thumbnails, independent of the media
+ * database: a thumbnail survives the rescans that drop the media table,
+ * and is found again as long as its file keeps its path, size and
+ * modification date. It is only pruned when its media is removed.
+ *
+ * The thumbnails are appended to a single pack file, which is mapped in
+ * memory. Each record is: MurmurHash64 of the location, file size, file
+ * modification date, JPEG length, JPEG data. The index is rebuilt by
+ * walking the record headers when the store is opened; a record
+ * overrides the previous ones of the same location, and an empty record
+ * removes them.
+ */
+public class ThumbnailStore {
+    public final static String TAG = "VLC/ThumbnailStore";
+
+    private final static int MAGIC = 0x564c4354; // VLCT
+    private final static int VERSION = 1;
+    private final static int HEADER_SIZE = 8;
+    private final static int RECORD_HEADER_SIZE = 8 + 8 + 8 + 4;
+    private final static String FILE_NAME = "thumbnails.pack";
+    /* Compact the pack when more than half of it is overridden or removed
+     * records */
+    private final static long MIN_COMPACT_SIZE = 1024 * 1024;
+
+    private static ThumbnailStore sInstance;
+
+    private static class Entry {
+        long size;
+        long lastModified;
+        long offset;            // of the JPEG data
+        int length;
+    }
+
+    private final File mFile;
+    private RandomAccessFile mRaf;
+    private FileChannel mChannel;
+    private MappedByteBuffer mMap;
+    private long mEnd;          // end of the last complete record
+    private long mWasted;       // size of the overridden and removed records
+    private final HashMap<Long, Entry> mIndex = new HashMap<Long, Entry>();
+
+    /* Statistics */
+    private long mOpenTime;
+    private long mHits;
+    private long mMisses;
+    private long mLoadTime;
+
+    public static synchronized ThumbnailStore getInstance() {
+        if (sInstance == null) {
+            Context context = VLCApplication.getAppContext();
+            sInstance = new ThumbnailStore(new File(context.getFilesDir(), FILE_NAME));
+        }
+        return sInstance;
+    }
+
+    private ThumbnailStore(File file) {
+        mFile = file;
+        long start = System.nanoTime();
+        try {
+            open();
+        } catch (IOException e) {
+            Log.e(TAG, "Could not open the thumbnail store", e);
+            close();
+        }
+        mOpenTime = System.nanoTime() - start;
+        Log.d(TAG, String.format("%d thumbnails indexed in %d ms",
+                mIndex.size(), mOpenTime / 1000000));
+    }
+
+    private void open() throws IOException {
+        mRaf = new RandomAccessFile(mFile, "rw");
+        mChannel = mRaf.getChannel();
+        if (mRaf.length() < HEADER_SIZE || mRaf.readInt() != MAGIC || mRaf.readInt() != VERSION) {
+            reset();
+            return;
+        }
+
+        map();
+        mWasted = 0;
+        long end = HEADER_SIZE;
+        final long length = mMap.capacity();
+        while (end + RECORD_HEADER_SIZE <= length) {
+            mMap.position((int) end);
+            long hash = mMap.getLong();
+            Entry entry = new Entry();
+            entry.size = mMap.getLong();
+            entry.lastModified = mMap.getLong();
+            entry.length = mMap.getInt();
+            entry.offset = end + RECORD_HEADER_SIZE;
+            if (entry.length < 0 || entry.offset + entry.length > length)
+                break;
+            Entry old = entry.length > 0 ? mIndex.put(hash, entry) : mIndex.remove(hash);
+            if (old != null)
+                mWasted += RECORD_HEADER_SIZE + old.length;
+            if (entry.length == 0)
+                mWasted += RECORD_HEADER_SIZE;
+            end = entry.offset + entry.length;
+        }
+        mEnd = end;
+        /* Drop a record truncated by a crash */
+        if (mEnd < length)
+            mChannel.truncate(mEnd);
+    }
+
+    private void reset() throws IOException {
+        mChannel.truncate(0);
+        mRaf.seek(0);
+        mRaf.writeInt(MAGIC);
+        mRaf.writeInt(VERSION);
+        mEnd = HEADER_SIZE;
+        mWasted = 0;
+        mIndex.clear();
+        map();
+    }
+
+    private void map() throws IOException {
+        mMap = mChannel.map(FileChannel.MapMode.READ_ONLY, 0, mChannel.size());
+    }
+
+    private void close() {
+        mMap = null;
+        mChannel = null;
+        if (mRaf != null) {
+            try {
+                mRaf.close();
+            } catch (IOException e) {}
+            mRaf = null;
+        }
+        mIndex.clear();
+    }
+
+    /**
+     * Identity of the file of a media: MurmurHash64 of its location, size
+     * and modification date. The last two are 0 for remote media.
+     */
+    public static long[] getIdentity(String location) {
+        long size = 0, lastModified = 0;
+        if (location.startsWith("file://")) {
+            String path = Uri.parse(location).getPath();
+            if (path != null) {
+                File file = new File(path);
+                size = file.length();
+                lastModified = file.lastModified();
+            }
+        }
+        return new long[] { MurmurHash.hash64(location), size, lastModified };
+    }
+
+    /**
+     * Read the JPEG data of a thumbnail from the mapped pack.
+     */
+    private synchronized byte[] read(long[] id) {
+        Entry entry = mIndex.get(id[0]);
+        if (entry == null || entry.size != id[1] || entry.lastModified != id[2])
+            return null;
+        try {
+            if (entry.offset + entry.length > mMap.capacity())
+                map();
+        } catch (IOException e) {
+            return null;
+        }
+        byte[] data = new byte[entry.length];
+        ByteBuffer buffer = mMap.duplicate();
+        buffer.position((int) entry.offset);
+        buffer.get(data);
+        return data;
+    }
+
+    /**
+     * Get the thumbnail of a media.
+     * @return the thumbnail, or null if the store has none for the current
+     *         version of its file
+     */
+    public Bitmap get(String location) {
+        if (location == null || mRaf == null)
+            return null;
+
+        long start = System.nanoTime();
+        byte[] data = read(getIdentity(location));
+        Bitmap picture = null;
+        if (data != null && data.length > 0) {
+            try {
+                picture = BitmapFactory.decodeByteArray(data, 0, data.length);
+            } catch (OutOfMemoryError e) {
+                picture = null;
+            }
+        }
+        synchronized (this) {
+            if (picture != null)
+                mHits++;
+            else
+                mMisses++;
+            mLoadTime += System.nanoTime() - start;
+        }
+        return picture;
+    }
+
+    /**
+     * Store the thumbnail of a media, replacing the previous one.
+     */
+    public void put(String location, Bitmap picture) {
+        if (location == null || picture == null)
+            return;
+
+        ByteArrayOutputStream out = new ByteArrayOutputStream();
+        picture.compress(Bitmap.CompressFormat.JPEG, 90, out);
+        byte[] data = out.toByteArray();
+        long[] id = getIdentity(location);
+
+        synchronized (this) {
+            if (mRaf == null)
+                return;
+            ByteBuffer record = ByteBuffer.allocate(RECORD_HEADER_SIZE + data.length);
+            record.putLong(id[0]).putLong(id[1]).putLong(id[2]).putInt(data.length).put(data);
+            record.flip();
+            try {
+                long position = mEnd;
+                while (record.hasRemaining())
+                    position += mChannel.write(record, position);
+            } catch (IOException e) {
+                Log.e(TAG, "Could not store the thumbnail of " + location, e);
+                return;
+            }
+
+            Entry entry = new Entry();
+            entry.size = id[1];
+            entry.lastModified = id[2];
+            entry.offset = mEnd + RECORD_HEADER_SIZE;
+            entry.length = data.length;
+            mEnd = entry.offset + entry.length;
+            Entry old = mIndex.put(id[0], entry);
+            if (old != null)
+                mWasted += RECORD_HEADER_SIZE + old.length;
+            if (mWasted > MIN_COMPACT_SIZE && mWasted > mEnd / 2)
+                compact();
+        }
+    }
+
+    /**
+     * Remove the thumbnails of media removed from the library.
+     */
+    public void remove(Collection<String> locations) {
+        if (locations.isEmpty())
+            return;
+
+        ByteBuffer records = ByteBuffer.allocate(RECORD_HEADER_SIZE * locations.size());
+        synchronized (this) {
+            if (mRaf == null)
+                return;
+            long wasted = 0;
+            for (String location : locations) {
+                long hash = MurmurHash.hash64(location);
+                Entry entry = mIndex.get(hash);
+                if (entry == null)
+                    continue;
+                records.putLong(hash).putLong(0).putLong(0).putInt(0);
+                wasted += RECORD_HEADER_SIZE + entry.length + RECORD_HEADER_SIZE;
+            }
+            records.flip();
+            if (!records.hasRemaining())
+                return;
+            try {
+                long position = mEnd;
+                while (records.hasRemaining())
+                    position += mChannel.write(records, position);
+                mEnd = position;
+            } catch (IOException e) {
+                Log.e(TAG, "Could not remove " + locations.size() + " thumbnails", e);
+                return;
+            }
+
+            for (String location : locations)
+                mIndex.remove(MurmurHash.hash64(location));
+            mWasted += wasted;
+            if (mWasted > MIN_COMPACT_SIZE && mWasted > mEnd / 2)
+                compact();
+        }
+    }
+
+    /**
+     * Rewrite the pack without the overridden and removed records.
+     */
+    private synchronized void compact() {
+        File tmp = new File(mFile.getPath() + ".tmp");
+        RandomAccessFile raf = null;
+        try {
+            raf = new RandomAccessFile(tmp, "rw");
+            raf.setLength(0);
+            raf.writeInt(MAGIC);
+            raf.writeInt(VERSION);
+            map();
+            for (java.util.Map.Entry<Long, Entry> e : mIndex.entrySet()) {
+                Entry entry = e.getValue();
+                byte[] data = new byte[entry.length];
+                ByteBuffer buffer = mMap.duplicate();
+                buffer.position((int) entry.offset);
+                buffer.get(data);
+                raf.writeLong(e.getKey());
+                raf.writeLong(entry.size);
+                raf.writeLong(entry.lastModified);
+                raf.writeInt(entry.length);
+                raf.write(data);
+            }
+            raf.close();
+            raf = null;
+            close();
+            if (!tmp.renameTo(mFile))
+                throw new IOException("rename failed");
+            open();
+        } catch (IOException e) {
+            Log.e(TAG, "Could not compact the thumbnail store", e);
+            tmp.delete();
+            if (mRaf == null) {
+                try {
+                    open();
+                } catch (IOException e2) {
+                    close();
+                }
+            }
+        } finally {
+            if (raf != null)
+                try {
+                    raf.close();
+                } catch (IOException e) {}
+        }
+    }
+
+    /**
+     * Remove all the thumbnails
+     */
+    public synchronized void clear() {
+        if (mRaf == null)
+            return;
+        try {
+            reset();
+        } catch (IOException e) {
+            Log.e(TAG, "Could not clear the thumbnail store", e);
+        }
+    }
+
+    public static class Stats {
+        /** Thumbnails in the store */
+        public int count;
+        /** Size of the pack file, in bytes */
+        public long size;
+        /** Time spent indexing the pack when it was opened, in ms */
+        public long openTime;
+        /** Thumbnails found and not found */
+        public long hits;
+        public long misses;
+        /** Average time to read and decode a thumbnail, in µs */
+        public long averageLoadTime;
+    }
+
+    public synchronized Stats getStats() {
+        Stats stats = new Stats();
+        stats.count = mIndex.size();
+        stats.size = mEnd;
+        stats.openTime = mOpenTime / 1000000;
+        stats.hits = mHits;
+        stats.misses = mMisses;
+        long loads = mHits + mMisses;
+        stats.averageLoadTime = loads > 0 ? mLoadTime / loads / 1000 : 0;
+        return stats;
+    }
+
+    /**
+     * Measure the time to open a store of count thumbnails, and to load
+     * them all, as the video grid would, in a temporary pack.
+     */
+    public static String benchmark(Context context, int count) {
+        File file = new File(context.getCacheDir(), "benchmark-" + FILE_NAME);
+        file.delete();
+
+        ThumbnailStore store = new ThumbnailStore(file);
+        Bitmap picture = Bitmap.createBitmap(180, 112, Config.ARGB_8888);
+        picture.eraseColor(0xff808080);
+        for (int i = 0; i < count; ++i)
+            store.put("benchmark://" + i, picture);
+        store.close();
+
+        store = new ThumbnailStore(file);
+        long start = System.nanoTime();
+        int loaded = 0;
+        for (int i = 0; i < count; ++i)
+            if (store.get("benchmark://" + i) != null)
+                loaded++;
+        long loadTime = System.nanoTime() - start;
+        Stats stats = store.getStats();
+        store.close();
+        file.delete();
+
+        String result = String.format("%d/%d thumbnails (%d KiB): open %d ms, load %d ms (%d µs each)",
+                loaded, count, stats.size / 1024, stats.openTime, loadTime / 1000000,
+                stats.averageLoadTime);
+        Log.i(TAG, "Benchmark: " + result);
+        return result;
+    }
+}